@@ -0,0 +1,118 @@
+#include "cbor_reader.h"
+
+// Deeper nesting than any document the gateway accepts; bounds the
+// recursion in cbor_skip.
+#define CBOR_MAX_DEPTH 8
+
+static bool fail(cbor_reader_t *r)
+{
+    r->error = true;
+    return false;
+}
+
+void cbor_reader_init(cbor_reader_t *r, const uint8_t *data, size_t len)
+{
+    r->pos = data;
+    r->end = data + len;
+    r->error = false;
+}
+
+bool cbor_get_head(cbor_reader_t *r, uint8_t *major, uint64_t *arg)
+{
+    if (r->error || r->pos >= r->end) {
+        return fail(r);
+    }
+
+    uint8_t initial = *r->pos++;
+    uint8_t info = initial & 0x1f;
+    size_t n;
+
+    *major = initial >> 5;
+    if (info < 24) {
+        *arg = info;
+        return true;
+    } else if (info <= 27) {
+        n = (size_t)1 << (info - 24);
+    } else {
+        // Reserved values and indefinite lengths.
+        return fail(r);
+    }
+
+    if ((size_t)(r->end - r->pos) < n) {
+        return fail(r);
+    }
+    *arg = 0;
+    for (size_t i = 0; i < n; i++) {
+        *arg = *arg << 8 | *r->pos++;
+    }
+    return true;
+}
+
+bool cbor_get_string(cbor_reader_t *r, uint8_t major, const uint8_t **data, size_t *len)
+{
+    uint8_t item_major;
+    uint64_t arg;
+
+    if (!cbor_get_head(r, &item_major, &arg)) {
+        return false;
+    }
+    if (item_major != major || arg > (uint64_t)(r->end - r->pos)) {
+        return fail(r);
+    }
+    *data = r->pos;
+    *len = (size_t)arg;
+    r->pos += arg;
+    return true;
+}
+
+static bool skip_item(cbor_reader_t *r, int depth)
+{
+    uint8_t major;
+    uint64_t arg;
+
+    if (depth > CBOR_MAX_DEPTH || !cbor_get_head(r, &major, &arg)) {
+        return fail(r);
+    }
+
+    switch (major) {
+    case CBOR_MAJOR_BYTES:
+    case CBOR_MAJOR_TEXT:
+        if (arg > (uint64_t)(r->end - r->pos)) {
+            return fail(r);
+        }
+        r->pos += arg;
+        return true;
+    case CBOR_MAJOR_MAP:
+        // Every pair is at least two bytes; reject counts the buffer
+        // cannot hold before looping over them.
+        if (arg > (uint64_t)(r->end - r->pos) / 2) {
+            return fail(r);
+        }
+        arg *= 2;
+        // fall through
+    case CBOR_MAJOR_ARRAY:
+        if (arg > (uint64_t)(r->end - r->pos)) {
+            return fail(r);
+        }
+        for (uint64_t i = 0; i < arg; i++) {
+            if (!skip_item(r, depth + 1)) {
+                return false;
+            }
+        }
+        return true;
+    case CBOR_MAJOR_TAG:
+        return skip_item(r, depth + 1);
+    default:
+        return true;
+    }
+}
+
+bool cbor_skip(cbor_reader_t *r)
+{
+    return skip_item(r, 0);
+}
+
+bool cbor_at_end(const cbor_reader_t *r)
+{
+    return !r->error && r->pos == r->end;
+}
@@ -0,0 +1,48 @@
+#ifndef CBOR_READER_H
+#define CBOR_READER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CBOR_MAJOR_UINT 0
+#define CBOR_MAJOR_NEGINT 1
+#define CBOR_MAJOR_BYTES 2
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+#define CBOR_MAJOR_TAG 6
+#define CBOR_MAJOR_SIMPLE 7
+
+#define CBOR_SIMPLE_FALSE 20
+#define CBOR_SIMPLE_TRUE 21
+
+// Pull decoder for CBOR (RFC 8949) over a caller-owned buffer, the
+// counterpart of cbor_writer. Only definite-length items are accepted,
+// which is what cbor_writer and common encoders produce for documents of
+// known size. Like the writer, an error is sticky: every read after a
+// truncated or malformed item fails, so callers check once.
+typedef struct {
+    const uint8_t *pos;
+    const uint8_t *end;
+    bool error;
+} cbor_reader_t;
+
+void cbor_reader_init(cbor_reader_t *r, const uint8_t *data, size_t len);
+
+// Reads the head of the next item: its major type and argument (the value
+// of an integer, the length of a string, the item count of an array, the
+// pair count of a map, the simple value or float bits of major type 7).
+// String contents are left for cbor_get_string or cbor_skip.
+bool cbor_get_head(cbor_reader_t *r, uint8_t *major, uint64_t *arg);
+
+// Reads a text or byte string of the given major type, pointing `data` into
+// the buffer; nothing is copied or terminated.
+bool cbor_get_string(cbor_reader_t *r, uint8_t major, const uint8_t **data, size_t *len);
+
+// Skips one complete item, nested containers included.
+bool cbor_skip(cbor_reader_t *r);
+
+bool cbor_at_end(const cbor_reader_t *r);
+
+#endif
@@ -0,0 +1,168 @@
+#include "cbor_writer.h"
+#include <string.h>
+
+#define CBOR_MAJOR_UINT 0
+#define CBOR_MAJOR_NEGINT 1
+#define CBOR_MAJOR_BYTES 2
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+
+#define CBOR_FALSE 0xf4
+#define CBOR_TRUE 0xf5
+#define CBOR_NULL 0xf6
+#define CBOR_FLOAT32 0xfa
+#define CBOR_FLOAT64 0xfb
+#define CBOR_MAP_OPEN 0xbf
+#define CBOR_BREAK 0xff
+
+static uint8_t *reserve(cbor_writer_t *w, size_t n)
+{
+    if (w->overflow || w->size - w->len < n) {
+        w->overflow = true;
+        return NULL;
+    }
+    uint8_t *p = &w->buf[w->len];
+    w->len += n;
+    return p;
+}
+
+static void put_byte(cbor_writer_t *w, uint8_t byte)
+{
+    uint8_t *p = reserve(w, 1);
+    if (p != NULL) {
+        *p = byte;
+    }
+}
+
+static void put_be(uint8_t *p, uint64_t value, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        p[i] = (uint8_t)(value >> (8 * (n - 1 - i)));
+    }
+}
+
+// Initial byte plus the shortest argument encoding, as preferred
+// serialization requires.
+static void put_head(cbor_writer_t *w, uint8_t major, uint64_t arg)
+{
+    uint8_t info;
+    size_t n;
+
+    if (arg < 24) {
+        put_byte(w, (uint8_t)(major << 5 | arg));
+        return;
+    } else if (arg <= UINT8_MAX) {
+        info = 24;
+        n = 1;
+    } else if (arg <= UINT16_MAX) {
+        info = 25;
+        n = 2;
+    } else if (arg <= UINT32_MAX) {
+        info = 26;
+        n = 4;
+    } else {
+        info = 27;
+        n = 8;
+    }
+
+    uint8_t *p = reserve(w, 1 + n);
+    if (p != NULL) {
+        p[0] = (uint8_t)(major << 5 | info);
+        put_be(&p[1], arg, n);
+    }
+}
+
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t size)
+{
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->overflow = false;
+}
+
+void cbor_put_uint(cbor_writer_t *w, uint64_t value)
+{
+    put_head(w, CBOR_MAJOR_UINT, value);
+}
+
+void cbor_put_int(cbor_writer_t *w, int64_t value)
+{
+    if (value >= 0) {
+        put_head(w, CBOR_MAJOR_UINT, (uint64_t)value);
+    } else {
+        // -1 - value without overflowing for INT64_MIN.
+        put_head(w, CBOR_MAJOR_NEGINT, ~(uint64_t)value);
+    }
+}
+
+void cbor_put_bool(cbor_writer_t *w, bool value)
+{
+    put_byte(w, value ? CBOR_TRUE : CBOR_FALSE);
+}
+
+void cbor_put_null(cbor_writer_t *w)
+{
+    put_byte(w, CBOR_NULL);
+}
+
+void cbor_put_float(cbor_writer_t *w, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint8_t *p = reserve(w, 5);
+    if (p != NULL) {
+        p[0] = CBOR_FLOAT32;
+        put_be(&p[1], bits, 4);
+    }
+}
+
+void cbor_put_double(cbor_writer_t *w, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint8_t *p = reserve(w, 9);
+    if (p != NULL) {
+        p[0] = CBOR_FLOAT64;
+        put_be(&p[1], bits, 8);
+    }
+}
+
+static void put_string(cbor_writer_t *w, uint8_t major, const void *data, size_t len)
+{
+    put_head(w, major, len);
+    uint8_t *p = reserve(w, len);
+    if (p != NULL) {
+        memcpy(p, data, len);
+    }
+}
+
+void cbor_put_text(cbor_writer_t *w, const char *text)
+{
+    put_string(w, CBOR_MAJOR_TEXT, text, strlen(text));
+}
+
+void cbor_put_bytes(cbor_writer_t *w, const uint8_t *data, size_t len)
+{
+    put_string(w, CBOR_MAJOR_BYTES, data, len);
+}
+
+void cbor_put_array(cbor_writer_t *w, size_t count)
+{
+    put_head(w, CBOR_MAJOR_ARRAY, count);
+}
+
+void cbor_put_map(cbor_writer_t *w, size_t count)
+{
+    put_head(w, CBOR_MAJOR_MAP, count);
+}
+
+void cbor_put_map_open(cbor_writer_t *w)
+{
+    put_byte(w, CBOR_MAP_OPEN);
+}
+
+void cbor_put_break(cbor_writer_t *w)
+{
+    put_byte(w, CBOR_BREAK);
+}
@@ -0,0 +1,37 @@
+#ifndef CBOR_WRITER_H
+#define CBOR_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Streaming CBOR (RFC 8949) encoder over a caller-owned buffer. It never
+// allocates; the same buffer is reused for every message. A write that does
+// not fit sets `overflow` and is dropped, and so is everything after it, so
+// callers check once at the end instead of after every item.
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+} cbor_writer_t;
+
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t size);
+
+void cbor_put_uint(cbor_writer_t *w, uint64_t value);
+void cbor_put_int(cbor_writer_t *w, int64_t value);
+void cbor_put_bool(cbor_writer_t *w, bool value);
+void cbor_put_null(cbor_writer_t *w);
+void cbor_put_float(cbor_writer_t *w, float value);
+void cbor_put_double(cbor_writer_t *w, double value);
+void cbor_put_text(cbor_writer_t *w, const char *text);
+void cbor_put_bytes(cbor_writer_t *w, const uint8_t *data, size_t len);
+
+// Containers of known size take their item count (pairs for maps). Open
+// containers take any number of items and are closed by cbor_put_break.
+void cbor_put_array(cbor_writer_t *w, size_t count);
+void cbor_put_map(cbor_writer_t *w, size_t count);
+void cbor_put_map_open(cbor_writer_t *w);
+void cbor_put_break(cbor_writer_t *w);
+
+#endif
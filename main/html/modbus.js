@@ -79,16 +79,26 @@ function getStatusText(status) {
     }
 }
 
-function formatTimestamp(ms) {
-    if (!ms) return 'Never';
-    const date = new Date(ms);
-    return date.toLocaleTimeString();
+function formatTimestamp(reg) {
+    if (!reg.timestamp_us) return 'Never';
+    if (reg.time_unix_ms) return new Date(reg.time_unix_ms).toLocaleTimeString();
+    return `${(reg.age_ms / 1000).toFixed(1)} s ago`;
 }
 
 function scaledValue(raw, scale, offset) {
     return (raw * scale + offset).toFixed(2);
 }
 
+function displayValue(reg) {
+    if (reg.bit_width === 1) {
+        return reg.last_value ? 'ON' : 'OFF';
+    }
+    if (reg.data_type === 8) {
+        return reg.text || '';
+    }
+    return scaledValue(reg.last_value, reg.scale, reg.offset);
+}
+
 function getRegisterTypeName(type) {
     switch (type) {
         case 1: return 'Coil';
@@ -115,6 +125,9 @@ function openEditDeviceModal(deviceId) {
         document.getElementById('edit-baudrate').value = device.baudrate;
         document.getElementById('edit-parity').value = device.parity || 0;
         document.getElementById('edit-device-enabled').checked = device.enabled;
+        document.getElementById('edit-device-fc23').checked = !!device.supports_fc23;
+        document.getElementById('edit-device-read-gaps').checked = !!device.read_gaps;
+        document.getElementById('edit-device-profile').value = device.profile || '';
 
         document.getElementById('edit-device-modal').style.display = 'block';
     }).catch(error => {
@@ -142,7 +155,10 @@ async function updateDevice(event) {
         poll_interval_ms: parseInt(formData.get('poll_interval')),
         baudrate: parseInt(formData.get('baudrate')),
         parity: parseInt(formData.get('parity')),
-        enabled: formData.get('enabled') === 'on'
+        enabled: formData.get('enabled') === 'on',
+        supports_fc23: formData.get('supports_fc23') === 'on',
+        read_gaps: formData.get('read_gaps') === 'on',
+        profile: formData.get('profile') || null
     };
 
     try {
@@ -155,6 +171,22 @@ async function updateDevice(event) {
     }
 }
 
+async function loadProfiles() {
+    try {
+        const profiles = await apiCall('/profiles');
+        document.querySelectorAll('.profile-select').forEach(select => {
+            profiles.forEach(profile => {
+                const option = document.createElement('option');
+                option.value = profile.id;
+                option.textContent = `${profile.name} (${profile.register_count} points)`;
+                select.appendChild(option);
+            });
+        });
+    } catch (error) {
+        console.error('Failed to load profiles:', error);
+    }
+}
+
 function showTab(tabName) {
     document.querySelectorAll('.tab').forEach(tab => tab.classList.remove('active'));
     document.querySelectorAll('.tab-content').forEach(content => content.classList.remove('active'));
@@ -207,7 +239,7 @@ function renderDevices(devices) {
                 <div>
                     <div class="device-title">${device.name}</div>
                     <div style="color: #6b7280; font-size: 0.9em;">
-                        ID: ${device.device_id} | ${device.description || 'No description'}
+                        ID: ${device.device_id} | ${device.description || 'No description'}${device.profile ? ` | Profile: ${device.profile}` : ''}
                     </div>
                 </div>
                 <div class="status-badge ${getStatusClass(device.status)}">
@@ -247,7 +279,7 @@ function renderDevices(devices) {
                     <tbody>
                         ${device.registers.map(reg => `
                             <tr>
-                                <td>${reg.address}</td>
+                                <td>${reg.bit_width ? `${reg.address}.${reg.bit_offset}` : reg.address}</td>
                                 <td>${getRegisterTypeName(reg.type)}</td>
                                 <td>${reg.name}</td>
                                 <td>${reg.writable ? `
@@ -261,12 +293,12 @@ function renderDevices(devices) {
                                             Write
                                         </button>
                                     </div>
-                                ` : scaledValue(reg.last_value, reg.scale, reg.offset)}
+                                ` : displayValue(reg)}
                                 </td>
                                 <td>${reg.unit || ''}</td>
                                 <td>
                                     <button class="btn btn-sm btn-secondary" 
-                                               onclick="deleteRegister(${device.device_id}, ${reg.address})">
+                                               onclick="deleteRegister(${device.device_id}, ${reg.type}, ${reg.address}, ${reg.bit_width ? reg.bit_offset : null})">
                                         Delete
                                     </button>
                                 </td>
@@ -291,7 +323,10 @@ async function addDevice(event) {
         poll_interval_ms: parseInt(formData.get('poll_interval')),
         baudrate: parseInt(formData.get('baudrate')),
         parity: parseInt(formData.get('parity')),
-        enabled: formData.get('enabled') === 'on'
+        enabled: formData.get('enabled') === 'on',
+        supports_fc23: formData.get('supports_fc23') === 'on',
+        read_gaps: formData.get('read_gaps') === 'on',
+        profile: formData.get('profile') || null
     };
 
     try {
@@ -336,7 +371,16 @@ async function addRegister(event) {
         scale: parseFloat(formData.get('scale')),
         offset: parseFloat(formData.get('offset')),
         writable: formData.get('writable') === 'on',
-        description: formData.get('description')
+        description: formData.get('description'),
+        data_type: parseInt(formData.get('data_type')),
+        word_order: parseInt(formData.get('word_order')),
+        length: parseInt(formData.get('length')),
+        bit_offset: parseInt(formData.get('bit_offset')),
+        bit_width: parseInt(formData.get('bit_width')),
+        publish_min_ms: parseInt(formData.get('publish_min_ms')),
+        deadband: parseFloat(formData.get('deadband')),
+        deadband_mode: parseInt(formData.get('deadband_mode')),
+        heartbeat_s: parseInt(formData.get('heartbeat_s'))
     };
     
     console.log('addRegister: register object =', JSON.stringify(register));
@@ -351,13 +395,14 @@ async function addRegister(event) {
     }
 }
 
-async function deleteRegister(deviceId, address) {
+async function deleteRegister(deviceId, type, address, bit = null) {
     if (!confirm('Are you sure you want to delete this register?')) {
         return;
     }
 
     try {
-        await apiCall(`/registers?device_id=${deviceId}&address=${address}`, 'DELETE');
+        const bitQuery = bit === null ? '' : `&bit=${bit}`;
+        await apiCall(`/registers?device_id=${deviceId}&type=${type}&address=${address}${bitQuery}`, 'DELETE');
         loadDevices();
         showNotification('Register deleted successfully!', 'success');
     } catch (error) {
@@ -514,7 +559,7 @@ async function refreshDashboard() {
                     <div class="value-card">
                         <div class="value-label">${reg.name}</div>
                         <div class="value-display">
-                            ${scaledValue(reg.last_value, reg.scale, reg.offset)}
+                            ${displayValue(reg)}
                             <span class="value-unit">${reg.unit || ''}</span>
                         </div>
                         ${reg.writable ? `
@@ -530,7 +575,7 @@ async function refreshDashboard() {
                             </div>
                         ` : ''}
                         <div class="value-timestamp">
-                            Updated: ${formatTimestamp(reg.last_update)}
+                            Updated: ${formatTimestamp(reg)}
                         </div>
                     </div>
                 `).join('')}
@@ -597,6 +642,7 @@ document.addEventListener('DOMContentLoaded', function() {
     }
 
     if (document.getElementById('devices-list')) {
+        loadProfiles();
         loadDevices();
     }
 
@@ -1,55 +1,121 @@
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
+#include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_storage.h"
 #include "wifi_manager.h"
 #include "web_server.h"
 #include "modbus_devices.h"
 #include "modbus_manager.h"
+#include "modbus_write_queue.h"
+#include "modbus_bulk_write.h"
 #include "mqtt_gateway.h"
 #include <strings.h>
 
 static const char *TAG = "APP";
 
-static void mqtt_write_callback(uint8_t device_id, uint16_t address, uint16_t value)
+static uint32_t write_clock_ms(void)
 {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+// Runs on the Modbus write task once the frame carrying the command is done.
+static void mqtt_write_done(uint8_t device_id, register_type_t type, uint16_t address,
+                            uint16_t value, modbus_result_t result, void *ctx)
+{
+    uint32_t latency_ms = write_clock_ms() - (uint32_t)(uintptr_t)ctx;
+
+    if (result == MODBUS_RESULT_OK) {
+        ESP_LOGI(TAG, "Wrote %u to register %d on device %d in %" PRIu32 " ms",
+                  value, address, device_id, latency_ms);
+    } else {
+        ESP_LOGE(TAG, "Failed to write to register %d on device %d: %s",
+                  address, device_id, modbus_result_to_string(result));
+    }
+    mqtt_client_publish_write_result(device_id, type, address, value, result, latency_ms);
+}
+
+// Called from the esp-mqtt event task, so it only validates and queues the
+// write; mqtt_write_done() reports the outcome.
+static void mqtt_write_callback(uint8_t device_id, register_type_t type, uint16_t address, uint16_t value)
+{
+    modbus_devices_lock();
     modbus_device_t *device = modbus_get_device(device_id);
+    modbus_register_t *reg = type == MQTT_REGISTER_TYPE_ANY ? modbus_find_writable_register(device_id, address) :
+                             modbus_get_register(device_id, type, address);
+    bool writable = reg != NULL && modbus_register_accepts_write(reg);
+    if (reg != NULL) {
+        type = reg->type;
+    }
+    modbus_devices_unlock();
+
     if (device == NULL) {
         ESP_LOGE(TAG, "Device %d not found", device_id);
+        mqtt_client_publish_write_result(device_id, type, address, value, MODBUS_RESULT_INVALID_REGISTER, 0);
         return;
     }
 
-    modbus_register_t *reg = modbus_get_register(device_id, address);
-    if (reg == NULL) {
-        ESP_LOGE(TAG, "Register %d not found in device %d", address, device_id);
+    if (!writable) {
+        ESP_LOGW(TAG, "Register %d (type %d) on device %d is not writable", address, type, device_id);
+        mqtt_client_publish_write_result(device_id, type, address, value, MODBUS_RESULT_INVALID_REGISTER, 0);
         return;
     }
 
-    modbus_result_t result = MODBUS_RESULT_OK;
-
-    if (reg->type == REGISTER_TYPE_COIL) {
-        bool coil_value = (value != 0);
-        ESP_LOGI(TAG, "Writing to coil: device=%d, address=%d, value=%s",
-                  device_id, address, coil_value ? "ON" : "OFF");
-        result = modbus_write_single_coil(device_id, address, coil_value);
-    } else if (reg->type == REGISTER_TYPE_HOLDING && reg->writable) {
-        ESP_LOGI(TAG, "Writing to holding register: device=%d, address=%d, value=%d",
-                  device_id, address, value);
-        result = modbus_write_single_register(device_id, address, value);
-    } else {
-        ESP_LOGW(TAG, "Register type %d at address %d is not writable", reg->type, address);
-        return;
+    if (type == REGISTER_TYPE_COIL) {
+        value = value != 0;
     }
 
-    if (result == MODBUS_RESULT_OK) {
-        modbus_update_register_value(device_id, address, value);
-        ESP_LOGI(TAG, "Successfully wrote to register %d on device %d", address, device_id);
-    } else {
-        ESP_LOGE(TAG, "Failed to write to register %d on device %d: %s",
+    esp_err_t err = modbus_write_queue_submit(device_id, type, address, value, mqtt_write_done,
+                                              (void *)(uintptr_t)write_clock_ms());
+    if (err != ESP_OK) {
+        modbus_result_t result = err == ESP_ERR_NO_MEM ? MODBUS_RESULT_QUEUE_FULL : MODBUS_RESULT_NOT_INITIALIZED;
+        ESP_LOGE(TAG, "Failed to queue write to register %d on device %d: %s",
                   address, device_id, modbus_result_to_string(result));
+        mqtt_client_publish_write_result(device_id, type, address, value, result, 0);
+    }
+}
+
+// Runs on the Modbus write task once the last entry has completed.
+static void mqtt_bulk_write_done(modbus_bulk_write_t *bulk, void *ctx)
+{
+    char *json = modbus_bulk_write_result_json(bulk);
+    if (json != NULL) {
+        mqtt_client_publish_bulk_result(json);
+        free(json);
+    }
+    free(bulk);
+}
+
+static void mqtt_bulk_write_callback(const uint8_t *data, size_t len)
+{
+    modbus_bulk_write_t *bulk = malloc(sizeof(*bulk));
+    if (bulk == NULL) {
+        ESP_LOGE(TAG, "No memory for a bulk write");
+        mqtt_client_publish_bulk_result("{\"ok\":false,\"error\":\"Out of memory\"}");
+        return;
+    }
+
+    char error[128];
+    esp_err_t err = modbus_bulk_write_parse(bulk, data, len, error, sizeof(error));
+    if (err == ESP_OK) {
+        err = modbus_bulk_write_submit(bulk, mqtt_bulk_write_done, NULL);
+        if (err != ESP_OK) {
+            snprintf(error, sizeof(error), "%s",
+                     err == ESP_ERR_NO_MEM ? "Write queue is full" : "Write queue unavailable");
+        }
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Rejected bulk write: %s", error);
+        char payload[160];
+        snprintf(payload, sizeof(payload), "{\"ok\":false,\"error\":\"%s\"}", error);
+        mqtt_client_publish_bulk_result(payload);
+        free(bulk);
     }
 }
 
@@ -69,6 +135,9 @@ void app_main(void)
     ESP_ERROR_CHECK(modbus_manager_init(NULL));
     ESP_LOGI(TAG, "Modbus manager initialized");
 
+    ESP_ERROR_CHECK(modbus_write_queue_init());
+    ESP_LOGI(TAG, "Modbus write queue initialized");
+
     ESP_ERROR_CHECK(modbus_manager_start_polling());
     ESP_LOGI(TAG, "Modbus polling started");
 
@@ -89,6 +158,7 @@ void app_main(void)
         if (strlen(mqtt_cfg.broker) > 0) {
             ESP_ERROR_CHECK(mqtt_client_start(&mqtt_cfg));
             mqtt_client_set_register_write_callback(mqtt_write_callback);
+            mqtt_client_set_bulk_write_callback(mqtt_bulk_write_callback);
             ESP_LOGI(TAG, "MQTT client started");
         }
     }
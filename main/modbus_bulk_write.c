@@ -0,0 +1,361 @@
+#include "modbus_bulk_write.h"
+#include "modbus_devices.h"
+#include "cbor_reader.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "cJSON.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "MODBUS_BULK_WRITE";
+
+#define VALUE_MIN -32768
+#define VALUE_MAX 65535
+
+typedef struct {
+    int64_t device_id;
+    int64_t address;
+    int64_t value;
+    bool has_device_id;
+    bool has_address;
+    bool has_value;
+} bulk_entry_t;
+
+static esp_err_t reject(char *error, size_t error_len, unsigned index, const char *detail)
+{
+    snprintf(error, error_len, "Entry %u: %s", index, detail);
+    return ESP_ERR_INVALID_ARG;
+}
+
+static esp_err_t add_entry(modbus_bulk_write_t *bulk, const bulk_entry_t *entry,
+                           char *error, size_t error_len)
+{
+    unsigned index = bulk->count;
+
+    if (!entry->has_device_id || !entry->has_address || !entry->has_value) {
+        return reject(error, error_len, index, "device_id, address and value are required");
+    }
+    if (entry->device_id < 1 || entry->device_id > MODBUS_MAX_DEVICES) {
+        return reject(error, error_len, index, "device_id must be 1-247");
+    }
+    if (entry->address < 0 || entry->address > UINT16_MAX) {
+        return reject(error, error_len, index, "address must be 0-65535");
+    }
+    if (entry->value < VALUE_MIN || entry->value > VALUE_MAX) {
+        return reject(error, error_len, index, "value must be -32768 to 65535");
+    }
+    if (bulk->count >= MODBUS_BULK_WRITE_MAX_ENTRIES) {
+        snprintf(error, error_len, "At most %d entries per document", MODBUS_BULK_WRITE_MAX_ENTRIES);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    modbus_write_item_t *item = &bulk->items[bulk->count++];
+    item->device_id = (uint8_t)entry->device_id;
+    item->address = (uint16_t)entry->address;
+    item->value = (uint16_t)entry->value;
+    return ESP_OK;
+}
+
+// Reads an integral JSON number or a boolean.
+static bool json_integer(const cJSON *item, int64_t *value)
+{
+    if (cJSON_IsBool(item)) {
+        *value = cJSON_IsTrue(item) ? 1 : 0;
+        return true;
+    }
+    if (!cJSON_IsNumber(item) || item->valuedouble != floor(item->valuedouble) ||
+        fabs(item->valuedouble) > (double)INT32_MAX) {
+        return false;
+    }
+    *value = (int64_t)item->valuedouble;
+    return true;
+}
+
+static esp_err_t parse_json(modbus_bulk_write_t *bulk, const uint8_t *data, size_t len,
+                            char *error, size_t error_len)
+{
+    cJSON *root = cJSON_ParseWithLength((const char *)data, len);
+    if (root == NULL || !cJSON_IsArray(root)) {
+        cJSON_Delete(root);
+        snprintf(error, error_len, "Expected a JSON array of writes");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_OK;
+    const cJSON *object;
+    cJSON_ArrayForEach(object, root) {
+        bulk_entry_t entry = {0};
+        const cJSON *item;
+
+        if (!cJSON_IsObject(object)) {
+            err = reject(error, error_len, bulk->count, "expected an object");
+            break;
+        }
+        if ((item = cJSON_GetObjectItem(object, "device_id")) != NULL) {
+            entry.has_device_id = json_integer(item, &entry.device_id);
+        }
+        if ((item = cJSON_GetObjectItem(object, "address")) != NULL) {
+            entry.has_address = json_integer(item, &entry.address);
+        }
+        if ((item = cJSON_GetObjectItem(object, "value")) != NULL) {
+            entry.has_value = json_integer(item, &entry.value);
+        }
+        if ((err = add_entry(bulk, &entry, error, error_len)) != ESP_OK) {
+            break;
+        }
+    }
+
+    cJSON_Delete(root);
+    return err;
+}
+
+// Reads an integer or a boolean; anything else is rejected.
+static bool cbor_integer(cbor_reader_t *r, int64_t *value)
+{
+    uint8_t major;
+    uint64_t arg;
+
+    if (!cbor_get_head(r, &major, &arg)) {
+        return false;
+    }
+    switch (major) {
+    case CBOR_MAJOR_UINT:
+        *value = arg > INT32_MAX ? INT32_MAX : (int64_t)arg;
+        return true;
+    case CBOR_MAJOR_NEGINT:
+        *value = arg > INT32_MAX ? INT32_MIN : -1 - (int64_t)arg;
+        return true;
+    case CBOR_MAJOR_SIMPLE:
+        if (arg == CBOR_SIMPLE_FALSE || arg == CBOR_SIMPLE_TRUE) {
+            *value = arg == CBOR_SIMPLE_TRUE;
+            return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+static bool key_is(const uint8_t *key, size_t key_len, const char *name)
+{
+    return key_len == strlen(name) && memcmp(key, name, key_len) == 0;
+}
+
+static esp_err_t parse_cbor(modbus_bulk_write_t *bulk, const uint8_t *data, size_t len,
+                            char *error, size_t error_len)
+{
+    cbor_reader_t r;
+    uint8_t major;
+    uint64_t count;
+
+    cbor_reader_init(&r, data, len);
+    if (!cbor_get_head(&r, &major, &count) || major != CBOR_MAJOR_ARRAY) {
+        snprintf(error, error_len, "Expected a CBOR array of writes");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (count > MODBUS_BULK_WRITE_MAX_ENTRIES) {
+        snprintf(error, error_len, "At most %d entries per document", MODBUS_BULK_WRITE_MAX_ENTRIES);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        bulk_entry_t entry = {0};
+        uint64_t pairs;
+
+        if (!cbor_get_head(&r, &major, &pairs) || major != CBOR_MAJOR_MAP) {
+            return reject(error, error_len, bulk->count, "expected a map");
+        }
+        for (uint64_t p = 0; p < pairs; p++) {
+            const uint8_t *key;
+            size_t key_len;
+            bool ok;
+
+            if (!cbor_get_string(&r, CBOR_MAJOR_TEXT, &key, &key_len)) {
+                return reject(error, error_len, bulk->count, "expected a text key");
+            }
+            if (key_is(key, key_len, "device_id")) {
+                ok = entry.has_device_id = cbor_integer(&r, &entry.device_id);
+            } else if (key_is(key, key_len, "address")) {
+                ok = entry.has_address = cbor_integer(&r, &entry.address);
+            } else if (key_is(key, key_len, "value")) {
+                ok = entry.has_value = cbor_integer(&r, &entry.value);
+            } else {
+                ok = cbor_skip(&r);
+            }
+            if (!ok) {
+                return reject(error, error_len, bulk->count,
+                              r.error ? "truncated or malformed CBOR" : "fields must be integers or booleans");
+            }
+        }
+
+        esp_err_t err = add_entry(bulk, &entry, error, error_len);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    if (!cbor_at_end(&r)) {
+        snprintf(error, error_len, "Unexpected data after the CBOR array");
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+// Every entry must name a coil or a writable single-word holding register,
+// and no point may appear twice: the document has to mean one thing before any
+// of it reaches the bus.
+static esp_err_t resolve_entries(modbus_bulk_write_t *bulk, char *error, size_t error_len)
+{
+    esp_err_t err = ESP_OK;
+
+    modbus_devices_lock();
+    for (uint8_t i = 0; i < bulk->count && err == ESP_OK; i++) {
+        modbus_write_item_t *item = &bulk->items[i];
+        modbus_register_t *reg = modbus_find_writable_register(item->device_id, item->address);
+
+        if (reg == NULL || !modbus_register_accepts_write(reg)) {
+            snprintf(error, error_len, "Entry %u: register %u on device %u is not writable",
+                     i, item->address, item->device_id);
+            err = ESP_ERR_NOT_FOUND;
+            break;
+        }
+        item->type = reg->type;
+        if (item->type == REGISTER_TYPE_COIL) {
+            item->value = item->value != 0;
+        }
+
+        for (uint8_t j = 0; j < i; j++) {
+            if (bulk->items[j].device_id == item->device_id && bulk->items[j].address == item->address) {
+                snprintf(error, error_len, "Entry %u: register %u on device %u is already set by entry %u",
+                         i, item->address, item->device_id, j);
+                err = ESP_ERR_INVALID_ARG;
+                break;
+            }
+        }
+    }
+    modbus_devices_unlock();
+
+    return err;
+}
+
+esp_err_t modbus_bulk_write_parse(modbus_bulk_write_t *bulk, const uint8_t *data, size_t len,
+                                  char *error, size_t error_len)
+{
+    bulk->count = 0;
+
+    if (len == 0 || len > MODBUS_BULK_WRITE_DOC_MAX) {
+        snprintf(error, error_len, "Document must be 1-%d bytes", MODBUS_BULK_WRITE_DOC_MAX);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // A JSON document starts with '[' or whitespace; a CBOR array with
+    // major type 4.
+    esp_err_t err = (data[0] >> 5) == CBOR_MAJOR_ARRAY
+        ? parse_cbor(bulk, data, len, error, error_len)
+        : parse_json(bulk, data, len, error, error_len);
+    if (err == ESP_OK) {
+        err = resolve_entries(bulk, error, error_len);
+    }
+    if (err != ESP_OK) {
+        bulk->count = 0;
+    }
+    return err;
+}
+
+static void entry_done(uint8_t device_id, register_type_t type, uint16_t address,
+                       uint16_t value, modbus_result_t result, void *ctx)
+{
+    modbus_bulk_write_t *bulk = (modbus_bulk_write_t *)ctx;
+
+    for (uint8_t i = 0; i < bulk->count; i++) {
+        modbus_write_item_t *item = &bulk->items[i];
+        if (item->device_id == device_id && item->type == type && item->address == address) {
+            item->value = value;
+            bulk->results[i] = result;
+            break;
+        }
+    }
+    if (result != MODBUS_RESULT_OK) {
+        bulk->failed++;
+    }
+
+    if (--bulk->remaining == 0) {
+        bulk->latency_ms = (uint32_t)((esp_timer_get_time() - bulk->started_us) / 1000);
+        ESP_LOGI(TAG, "Bulk write of %d entries done in %" PRIu32 " ms, %d failed",
+                  bulk->count, bulk->latency_ms, bulk->failed);
+        bulk->done(bulk, bulk->ctx);
+    }
+}
+
+esp_err_t modbus_bulk_write_submit(modbus_bulk_write_t *bulk, modbus_bulk_done_cb_t done, void *ctx)
+{
+    if (bulk->count == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (uint8_t i = 0; i < bulk->count; i++) {
+        bulk->results[i] = MODBUS_RESULT_NOT_INITIALIZED;
+    }
+    bulk->remaining = bulk->count;
+    bulk->failed = 0;
+    bulk->latency_ms = 0;
+    bulk->started_us = esp_timer_get_time();
+    bulk->done = done;
+    bulk->ctx = ctx;
+
+    return modbus_write_queue_submit_many(bulk->items, bulk->count, entry_done, bulk);
+}
+
+static void execute_done(modbus_bulk_write_t *bulk, void *ctx)
+{
+    xSemaphoreGive((SemaphoreHandle_t)ctx);
+}
+
+esp_err_t modbus_bulk_write_execute(modbus_bulk_write_t *bulk)
+{
+    StaticSemaphore_t done_buffer;
+    SemaphoreHandle_t done = xSemaphoreCreateBinaryStatic(&done_buffer);
+
+    esp_err_t err = modbus_bulk_write_submit(bulk, execute_done, done);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    xSemaphoreTake(done, portMAX_DELAY);
+    return ESP_OK;
+}
+
+char *modbus_bulk_write_result_json(const modbus_bulk_write_t *bulk)
+{
+    cJSON *root = cJSON_CreateObject();
+    if (root == NULL) {
+        return NULL;
+    }
+
+    cJSON_AddBoolToObject(root, "ok", bulk->failed == 0);
+    cJSON_AddNumberToObject(root, "count", bulk->count);
+    cJSON_AddNumberToObject(root, "failed", bulk->failed);
+    cJSON_AddNumberToObject(root, "latency_ms", bulk->latency_ms);
+
+    cJSON *results = cJSON_AddArrayToObject(root, "results");
+    for (uint8_t i = 0; results != NULL && i < bulk->count; i++) {
+        cJSON *entry = cJSON_CreateObject();
+        if (entry == NULL) {
+            break;
+        }
+        cJSON_AddNumberToObject(entry, "device_id", bulk->items[i].device_id);
+        cJSON_AddNumberToObject(entry, "address", bulk->items[i].address);
+        cJSON_AddNumberToObject(entry, "value", bulk->items[i].value);
+        cJSON_AddNumberToObject(entry, "code", bulk->results[i]);
+        cJSON_AddStringToObject(entry, "result", modbus_result_to_string(bulk->results[i]));
+        cJSON_AddItemToArray(results, entry);
+    }
+
+    char *json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    return json;
+}
@@ -0,0 +1,52 @@
+#ifndef MODBUS_BULK_WRITE_H
+#define MODBUS_BULK_WRITE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "modbus_manager.h"
+#include "modbus_write_queue.h"
+
+// A bulk document is queued in one piece, so it can hold as many writes as
+// the queue does.
+#define MODBUS_BULK_WRITE_MAX_ENTRIES MODBUS_WRITE_QUEUE_DEPTH
+#define MODBUS_BULK_WRITE_DOC_MAX 4096
+
+typedef struct modbus_bulk_write modbus_bulk_write_t;
+
+// Runs on the Modbus write task once every entry has completed. It may
+// free the bulk write.
+typedef void (*modbus_bulk_done_cb_t)(modbus_bulk_write_t *bulk, void *ctx);
+
+struct modbus_bulk_write {
+    modbus_write_item_t items[MODBUS_BULK_WRITE_MAX_ENTRIES];
+    modbus_result_t results[MODBUS_BULK_WRITE_MAX_ENTRIES];
+    uint8_t count;
+    uint8_t remaining;
+    uint8_t failed;
+    int64_t started_us;
+    uint32_t latency_ms;
+    modbus_bulk_done_cb_t done;
+    void *ctx;
+};
+
+// Parses a JSON or CBOR array of {"device_id", "address", "value"} maps
+// (CBOR is recognised by its leading array byte). Values are whole numbers
+// from -32768 to 65535 or booleans. The document is checked as a whole
+// against the registry: on any error nothing is kept and `error` explains
+// which entry was rejected.
+esp_err_t modbus_bulk_write_parse(modbus_bulk_write_t *bulk, const uint8_t *data, size_t len,
+                                  char *error, size_t error_len);
+
+// Queues every entry at once so the write task sorts them per device and
+// sends contiguous addresses as FC0F/FC10 frames. `done` reports the
+// outcome.
+esp_err_t modbus_bulk_write_submit(modbus_bulk_write_t *bulk, modbus_bulk_done_cb_t done, void *ctx);
+
+// Blocking wrapper around modbus_bulk_write_submit().
+esp_err_t modbus_bulk_write_execute(modbus_bulk_write_t *bulk);
+
+// Per-entry outcome as JSON; the caller frees the string.
+char *modbus_bulk_write_result_json(const modbus_bulk_write_t *bulk);
+
+#endif
@@ -0,0 +1,203 @@
+#include "modbus_data.h"
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+uint8_t modbus_data_type_registers(uint8_t data_type, uint8_t length)
+{
+    switch (data_type) {
+        case MODBUS_DATA_UINT32:
+        case MODBUS_DATA_INT32:
+        case MODBUS_DATA_FLOAT32:
+            return 2;
+        case MODBUS_DATA_UINT64:
+        case MODBUS_DATA_INT64:
+        case MODBUS_DATA_FLOAT64:
+            return 4;
+        case MODBUS_DATA_STRING:
+            if (length == 0) {
+                return 1;
+            }
+            return (length > MODBUS_STRING_MAX_REGS) ? MODBUS_STRING_MAX_REGS : length;
+        default:
+            return 1;
+    }
+}
+
+bool modbus_data_type_is_valid(uint8_t data_type)
+{
+    return data_type < MODBUS_DATA_TYPE_COUNT;
+}
+
+bool modbus_data_type_is_integer(uint8_t data_type)
+{
+    switch (data_type) {
+        case MODBUS_DATA_UINT16:
+        case MODBUS_DATA_INT16:
+        case MODBUS_DATA_UINT32:
+        case MODBUS_DATA_INT32:
+        case MODBUS_DATA_UINT64:
+        case MODBUS_DATA_INT64:
+            return true;
+        default:
+            return false;
+    }
+}
+
+const char* modbus_data_type_to_string(uint8_t data_type)
+{
+    switch (data_type) {
+        case MODBUS_DATA_UINT16: return "uint16";
+        case MODBUS_DATA_INT16: return "int16";
+        case MODBUS_DATA_UINT32: return "uint32";
+        case MODBUS_DATA_INT32: return "int32";
+        case MODBUS_DATA_FLOAT32: return "float32";
+        case MODBUS_DATA_UINT64: return "uint64";
+        case MODBUS_DATA_INT64: return "int64";
+        case MODBUS_DATA_FLOAT64: return "float64";
+        case MODBUS_DATA_STRING: return "string";
+        default: return "unknown";
+    }
+}
+
+static uint64_t decode_string(const uint16_t *regs, uint8_t count, bool swap_bytes, char *text)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint8_t len = 0;
+
+    for (uint8_t k = 0; k < count; k++) {
+        uint16_t word = regs[k];
+        char pair[2] = {
+            swap_bytes ? (char)(word & 0xFF) : (char)(word >> 8),
+            swap_bytes ? (char)(word >> 8) : (char)(word & 0xFF)
+        };
+        for (uint8_t b = 0; b < 2; b++) {
+            if (pair[b] == '\0') {
+                goto done;
+            }
+            if (text != NULL) {
+                text[len] = pair[b];
+            }
+            len++;
+            hash = (hash ^ (uint8_t)pair[b]) * 0x100000001b3ULL;
+        }
+    }
+
+done:
+    while (len > 0 && text != NULL && text[len - 1] == ' ') {
+        len--;
+    }
+    if (text != NULL) {
+        text[len] = '\0';
+    }
+    return hash;
+}
+
+// Turns a raw register block into typed values in one pass. Each item
+// names the register offset of a point inside the block; multi-register
+// points must lie entirely within `regs`. Items with a bit width extract
+// an unsigned field from the assembled word instead of converting it.
+void modbus_decode_block(const uint16_t *regs, const modbus_decode_item_t *items,
+                         size_t count, modbus_value_t *values)
+{
+    for (size_t i = 0; i < count; i++) {
+        const modbus_decode_item_t *item = &items[i];
+        const uint16_t *src = &regs[item->offset];
+        uint8_t words = modbus_data_type_registers(item->data_type, item->length);
+        bool swap_words = item->word_order == MODBUS_ORDER_CDAB || item->word_order == MODBUS_ORDER_DCBA;
+        bool swap_bytes = item->word_order == MODBUS_ORDER_BADC || item->word_order == MODBUS_ORDER_DCBA;
+
+        if (item->data_type == MODBUS_DATA_STRING) {
+            values[i].u64 = decode_string(src, words, swap_bytes, item->text);
+            continue;
+        }
+
+        uint64_t raw = 0;
+        for (uint8_t k = 0; k < words; k++) {
+            uint16_t word = src[swap_words ? words - 1 - k : k];
+            if (swap_bytes) {
+                word = (word << 8) | (word >> 8);
+            }
+            raw = (raw << 16) | word;
+        }
+
+        if (item->bit_width > 0) {
+            uint64_t mask = (item->bit_width >= 64) ? UINT64_MAX : ((1ULL << item->bit_width) - 1);
+            values[i].u64 = (raw >> item->bit_offset) & mask;
+            continue;
+        }
+
+        switch (item->data_type) {
+            case MODBUS_DATA_INT16:
+                values[i].i64 = (int16_t)raw;
+                break;
+            case MODBUS_DATA_INT32:
+                values[i].i64 = (int32_t)(uint32_t)raw;
+                break;
+            case MODBUS_DATA_INT64:
+                values[i].i64 = (int64_t)raw;
+                break;
+            case MODBUS_DATA_FLOAT32: {
+                uint32_t bits = (uint32_t)raw;
+                float f;
+                memcpy(&f, &bits, sizeof(f));
+                values[i].f64 = f;
+                break;
+            }
+            case MODBUS_DATA_FLOAT64:
+                memcpy(&values[i].f64, &raw, sizeof(double));
+                break;
+            default:
+                values[i].u64 = raw;
+                break;
+        }
+    }
+}
+
+double modbus_value_to_double(uint8_t data_type, modbus_value_t value)
+{
+    switch (data_type) {
+        case MODBUS_DATA_INT16:
+        case MODBUS_DATA_INT32:
+        case MODBUS_DATA_INT64:
+            return (double)value.i64;
+        case MODBUS_DATA_FLOAT32:
+        case MODBUS_DATA_FLOAT64:
+            return value.f64;
+        case MODBUS_DATA_STRING:
+            return 0.0;
+        default:
+            return (double)value.u64;
+    }
+}
+
+int modbus_value_format(uint8_t data_type, modbus_value_t value, float scale, float offset,
+                        const char *text, char *buf, size_t len)
+{
+    bool unscaled = scale == 1.0f && offset == 0.0f;
+
+    switch (data_type) {
+        case MODBUS_DATA_STRING:
+            return snprintf(buf, len, "%s", text != NULL ? text : "");
+        case MODBUS_DATA_FLOAT32:
+            return snprintf(buf, len, "%.6g", value.f64 * scale + offset);
+        case MODBUS_DATA_FLOAT64:
+            return snprintf(buf, len, "%.15g", value.f64 * scale + offset);
+        case MODBUS_DATA_INT32:
+        case MODBUS_DATA_INT64:
+            if (unscaled) {
+                return snprintf(buf, len, "%" PRId64, value.i64);
+            }
+            break;
+        case MODBUS_DATA_UINT32:
+        case MODBUS_DATA_UINT64:
+            if (unscaled) {
+                return snprintf(buf, len, "%" PRIu64, value.u64);
+            }
+            break;
+        default:
+            break;
+    }
+
+    return snprintf(buf, len, "%.2f", modbus_value_to_double(data_type, value) * scale + offset);
+}
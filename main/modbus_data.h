@@ -0,0 +1,65 @@
+#ifndef MODBUS_DATA_H
+#define MODBUS_DATA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MODBUS_STRING_MAX_REGS 16
+#define MODBUS_STRING_MAX_LEN (MODBUS_STRING_MAX_REGS * 2)
+
+typedef enum {
+    MODBUS_DATA_UINT16 = 0,
+    MODBUS_DATA_INT16 = 1,
+    MODBUS_DATA_UINT32 = 2,
+    MODBUS_DATA_INT32 = 3,
+    MODBUS_DATA_FLOAT32 = 4,
+    MODBUS_DATA_UINT64 = 5,
+    MODBUS_DATA_INT64 = 6,
+    MODBUS_DATA_FLOAT64 = 7,
+    MODBUS_DATA_STRING = 8,
+    MODBUS_DATA_TYPE_COUNT
+} modbus_data_type_t;
+
+// Byte letters name the bytes of the value from most to least significant
+// as they appear on the wire. ABCD is plain Modbus big-endian with the high
+// word in the lowest register.
+typedef enum {
+    MODBUS_ORDER_ABCD = 0,
+    MODBUS_ORDER_CDAB = 1,
+    MODBUS_ORDER_BADC = 2,
+    MODBUS_ORDER_DCBA = 3
+} modbus_word_order_t;
+
+// Decoded point value. Signed types use i64, unsigned types and bits use
+// u64, floating point types use f64. Strings keep an FNV-1a hash of the
+// text in u64 so change detection stays a single compare.
+typedef union {
+    uint64_t u64;
+    int64_t i64;
+    double f64;
+} modbus_value_t;
+
+typedef struct {
+    uint16_t offset;
+    uint8_t data_type;
+    uint8_t word_order;
+    uint8_t length;
+    uint8_t bit_offset;
+    uint8_t bit_width;
+    char *text;
+} modbus_decode_item_t;
+
+uint8_t modbus_data_type_registers(uint8_t data_type, uint8_t length);
+bool modbus_data_type_is_valid(uint8_t data_type);
+bool modbus_data_type_is_integer(uint8_t data_type);
+const char* modbus_data_type_to_string(uint8_t data_type);
+
+void modbus_decode_block(const uint16_t *regs, const modbus_decode_item_t *items,
+                         size_t count, modbus_value_t *values);
+
+double modbus_value_to_double(uint8_t data_type, modbus_value_t value);
+int modbus_value_format(uint8_t data_type, modbus_value_t value, float scale, float offset,
+                        const char *text, char *buf, size_t len);
+
+#endif
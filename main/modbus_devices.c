@@ -2,27 +2,946 @@
 #include "nvs_flash.h"
 #include "nvs.h"
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <math.h>
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include "mqtt_gateway.h"
+#include "modbus_events.h"
+#include "modbus_pool.h"
+#include "modbus_poll_plan.h"
+#include "modbus_profiles.h"
+#include "modbus_strings.h"
+#include "esp_rom_crc.h"
 
 static const char *TAG = "MODBUS_DEVICES";
 static const char *NVS_NAMESPACE = "modbus_config";
 
-static modbus_device_t devices[MAX_MODBUS_DEVICES];
+#define DEVICE_POOL_CHUNK 4
+#define DEVICE_TABLE_GROWTH 8
+#define REGISTER_TABLE_MIN 8
+
+// Device records come from a pool so their addresses stay stable; the
+// table below only holds pointers, in insertion order.
+static modbus_pool_t device_pool;
+static modbus_device_t **devices = NULL;
+static uint16_t device_capacity = 0;
 static uint8_t device_count = 0;
+static modbus_device_t *device_by_id[MODBUS_MAX_DEVICES + 1];
+static size_t register_bytes_reserved = 0;
+static SemaphoreHandle_t registry_mutex = NULL;
+// Bumped whenever a device or register is added, removed or changed, so
+// work planned under the lock can tell whether it is still valid.
+static uint32_t registry_generation = 0;
+// Generation of the published snapshot, the last generation the commit
+// task was told about, and the recursion depth of the registry lock (all
+// only ever touched by the lock holder).
+static uint32_t plan_generation = UINT32_MAX;
+static uint32_t notified_generation = UINT32_MAX;
+static uint32_t lock_depth = 0;
+// Devices (by ID) whose NVS shard must be rewritten, or erased if the ID
+// no longer exists, plus whether the device index changed. Flushed by the
+// background save task.
+static uint8_t dirty_devices[(MODBUS_MAX_DEVICES + 8) / 8];
+static bool index_dirty = false;
+static TaskHandle_t save_task_handle = NULL;
+static TaskHandle_t commit_task_handle = NULL;
+
+static void save_task(void *pvParameters);
+static void commit_task(void *pvParameters);
 
 esp_err_t modbus_devices_init(void)
 {
-    memset(devices, 0, sizeof(devices));
+    if (registry_mutex == NULL) {
+        registry_mutex = xSemaphoreCreateRecursiveMutex();
+        if (registry_mutex == NULL) {
+            ESP_LOGE(TAG, "Failed to create registry mutex");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (save_task_handle == NULL &&
+        xTaskCreate(save_task, "modbus_save", 4096, NULL, 3, &save_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create config save task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (commit_task_handle == NULL &&
+        xTaskCreate(commit_task, "modbus_commit", 4096, NULL, 4, &commit_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create registry commit task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    modbus_pool_init(&device_pool, "devices", sizeof(modbus_device_t), DEVICE_POOL_CHUNK);
     device_count = 0;
     ESP_LOGI(TAG, "Modbus devices manager initialized");
     return ESP_OK;
 }
 
+void modbus_devices_lock(void)
+{
+    xSemaphoreTakeRecursive(registry_mutex, portMAX_DELAY);
+    lock_depth++;
+}
+
+// Leaving the outermost lock section after an edit only wakes the commit
+// task; a burst of edits is published as one snapshot once it settles.
+void modbus_devices_unlock(void)
+{
+    bool edited = --lock_depth == 0 && notified_generation != registry_generation &&
+                  plan_generation != registry_generation;
+    if (edited) {
+        notified_generation = registry_generation;
+    }
+    xSemaphoreGiveRecursive(registry_mutex);
+
+    if (edited && commit_task_handle != NULL) {
+        xTaskNotifyGive(commit_task_handle);
+    }
+}
+
+uint32_t modbus_devices_generation(void)
+{
+    return registry_generation;
+}
+
+static void mark_dirty(uint8_t device_id)
+{
+    dirty_devices[device_id / 8] |= 1 << (device_id % 8);
+}
+
+static bool take_dirty(uint8_t device_id)
+{
+    bool dirty = dirty_devices[device_id / 8] & (1 << (device_id % 8));
+    dirty_devices[device_id / 8] &= ~(1 << (device_id % 8));
+    return dirty;
+}
+
+static esp_err_t reserve_device_slots(uint16_t needed)
+{
+    if (needed <= device_capacity) {
+        return ESP_OK;
+    }
+
+    uint16_t capacity = device_capacity + DEVICE_TABLE_GROWTH;
+    if (capacity < needed) {
+        capacity = needed;
+    }
+
+    size_t bytes = capacity * sizeof(modbus_device_t *);
+    if (!modbus_heap_can_allocate(bytes)) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    modbus_device_t **table = heap_caps_realloc(devices, bytes, MALLOC_CAP_8BIT);
+    if (table == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    devices = table;
+    device_capacity = capacity;
+    return ESP_OK;
+}
+
+static esp_err_t own_registers(modbus_device_t *device);
+
+static esp_err_t reserve_registers(modbus_device_t *device, uint16_t needed)
+{
+    if (own_registers(device) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (needed <= device->register_capacity) {
+        return ESP_OK;
+    }
+
+    uint32_t capacity = device->register_capacity ? device->register_capacity * 2 : REGISTER_TABLE_MIN;
+    if (capacity < needed) {
+        capacity = needed;
+    }
+    if (capacity > MODBUS_MAX_REGISTERS_PER_DEVICE) {
+        capacity = MODBUS_MAX_REGISTERS_PER_DEVICE;
+    }
+    if (capacity < needed) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Fall back to an exact fit when doubling would eat into the reserve.
+    if (!modbus_heap_can_allocate(capacity * sizeof(modbus_register_t))) {
+        capacity = needed;
+    }
+
+    size_t bytes = capacity * sizeof(modbus_register_t);
+    if (!modbus_heap_can_allocate(bytes)) {
+        ESP_LOGW(TAG, "Not enough heap for %" PRIu32 " registers on device %d", capacity, device->device_id);
+        return ESP_ERR_NO_MEM;
+    }
+
+    modbus_register_t *table = heap_caps_realloc(device->registers, bytes, MALLOC_CAP_8BIT);
+    if (table == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    register_bytes_reserved += bytes - device->register_capacity * sizeof(modbus_register_t);
+    device->registers = table;
+    device->register_capacity = capacity;
+    return ESP_OK;
+}
+
+// Swaps the caller's string pointers in `reg` for interned copies.
+static esp_err_t intern_strings(modbus_register_t *reg)
+{
+    const char *name = modbus_str_intern(reg->name);
+    const char *unit = modbus_str_intern(reg->unit);
+    const char *description = modbus_str_intern(reg->description);
+    if (name == NULL || unit == NULL || description == NULL) {
+        modbus_str_release(name);
+        modbus_str_release(unit);
+        modbus_str_release(description);
+        return ESP_ERR_NO_MEM;
+    }
+    reg->name = name;
+    reg->unit = unit;
+    reg->description = description;
+    return ESP_OK;
+}
+
+static void release_strings(const modbus_register_t *reg)
+{
+    modbus_str_release(reg->name);
+    modbus_str_release(reg->unit);
+    modbus_str_release(reg->description);
+}
+
+static void retain_strings(const modbus_register_t *reg)
+{
+    modbus_str_retain(reg->name);
+    modbus_str_retain(reg->unit);
+    modbus_str_retain(reg->description);
+}
+
+static void free_register_table(modbus_register_t *registers, uint16_t count, uint16_t capacity,
+                                uint16_t *point_index)
+{
+    for (uint16_t i = 0; i < count; i++) {
+        release_strings(&registers[i]);
+    }
+    register_bytes_reserved -= capacity * sizeof(modbus_register_t);
+    heap_caps_free(registers);
+    heap_caps_free(point_index);
+}
+
+// Drops the register map and point index. Profile tables live in flash and
+// published ones are retired by the next commit, so only a draft that was
+// never published is freed here.
+static void release_registers(modbus_device_t *device)
+{
+    if (device->profile == NULL && !device->registers_published) {
+        free_register_table(device->registers, device->register_count, device->register_capacity,
+                            device->point_index);
+    }
+    device->profile = NULL;
+    device->registers_published = false;
+    device->registers = NULL;
+    device->register_count = 0;
+    device->register_capacity = 0;
+    device->point_index = NULL;
+    device->point_index_mask = 0;
+}
+
+// The value store belongs to the published snapshot and goes with it.
+static void free_device(modbus_device_t *device)
+{
+    registry_generation++;
+    release_registers(device);
+    modbus_pool_free(&device_pool, device);
+}
+
+// Per-device open-addressing table mapping (type, address) to a register
+// index. Slots hold index + 1 so zero marks an empty slot; bitfields are
+// not indexed since they share their address with the whole-word point.
+static uint32_t point_hash(register_type_t type, uint16_t address)
+{
+    uint32_t key = ((uint32_t)type << 16) | address;
+    return key * 2654435761u;
+}
+
+static void point_index_insert(modbus_device_t *device, uint16_t index)
+{
+    const modbus_register_t *reg = &device->registers[index];
+    uint32_t slot = point_hash(reg->type, reg->address) & device->point_index_mask;
+    while (device->point_index[slot] != 0) {
+        const modbus_register_t *other = &device->registers[device->point_index[slot] - 1];
+        if (other->type == reg->type && other->address == reg->address) {
+            return;
+        }
+        slot = (slot + 1) & device->point_index_mask;
+    }
+    device->point_index[slot] = index + 1;
+}
+
+static esp_err_t rebuild_point_index(modbus_device_t *device)
+{
+    // Keep the load factor at or below one half.
+    uint32_t slots = 16;
+    while (slots < (uint32_t)device->register_count * 2) {
+        slots <<= 1;
+    }
+
+    // The table only ever grows, so rebuilding after a removal needs no
+    // allocation and cannot fail.
+    if (device->point_index == NULL || slots > (uint32_t)device->point_index_mask + 1) {
+        size_t bytes = slots * sizeof(uint16_t);
+        if (!modbus_heap_can_allocate(bytes)) {
+            return ESP_ERR_NO_MEM;
+        }
+        uint16_t *table = heap_caps_realloc(device->point_index, bytes, MALLOC_CAP_8BIT);
+        if (table == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        device->point_index = table;
+        device->point_index_mask = slots - 1;
+    }
+
+    memset(device->point_index, 0, (device->point_index_mask + 1) * sizeof(uint16_t));
+    for (uint16_t i = 0; i < device->register_count; i++) {
+        if (!modbus_register_is_bitfield(&device->registers[i])) {
+            point_index_insert(device, i);
+        }
+    }
+    return ESP_OK;
+}
+
+static modbus_register_t *point_index_find(const modbus_device_t *device, register_type_t type, uint16_t address)
+{
+    if (device->point_index == NULL) {
+        return NULL;
+    }
+
+    uint32_t slot = point_hash(type, address) & device->point_index_mask;
+    while (device->point_index[slot] != 0) {
+        modbus_register_t *reg = &device->registers[device->point_index[slot] - 1];
+        if (reg->type == type && reg->address == address) {
+            return reg;
+        }
+        slot = (slot + 1) & device->point_index_mask;
+    }
+    return NULL;
+}
+
+static uint16_t text_slot_size(const modbus_register_t *reg)
+{
+    return modbus_data_type_registers(reg->data_type, reg->length) * 2 + 1;
+}
+
+// Gives the device a private register map and index ahead of an edit. The
+// published tables are read by the poll task and the publisher without a
+// lock and profile tables live in flash, so neither is written in place;
+// the originals stay untouched until the next commit retires them.
+static esp_err_t own_registers(modbus_device_t *device)
+{
+    if (device->profile == NULL && !device->registers_published) {
+        return ESP_OK;
+    }
+
+    size_t register_bytes = device->register_count * sizeof(modbus_register_t);
+    size_t index_bytes = device->point_index != NULL ? (device->point_index_mask + 1) * sizeof(uint16_t) : 0;
+    modbus_register_t *registers = NULL;
+    uint16_t *index = NULL;
+    if (register_bytes > 0) {
+        if (!modbus_heap_can_allocate(register_bytes + index_bytes)) {
+            return ESP_ERR_NO_MEM;
+        }
+        registers = heap_caps_malloc(register_bytes, MALLOC_CAP_8BIT);
+        index = index_bytes > 0 ? heap_caps_malloc(index_bytes, MALLOC_CAP_8BIT) : NULL;
+        if (registers == NULL || (index_bytes > 0 && index == NULL)) {
+            heap_caps_free(registers);
+            heap_caps_free(index);
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy(registers, device->registers, register_bytes);
+        memcpy(index, device->point_index, index_bytes);
+        for (uint16_t i = 0; i < device->register_count; i++) {
+            retain_strings(&registers[i]);
+        }
+    }
+
+    device->registers = registers;
+    device->register_capacity = device->register_count;
+    device->point_index = index;
+    device->point_index_mask = index != NULL ? device->point_index_mask : 0;
+    device->profile = NULL;
+    device->registers_published = false;
+    register_bytes_reserved += register_bytes;
+    registry_generation++;
+    return ESP_OK;
+}
+
+// Points a device at a profile's flash tables. Its value store, with the
+// text area of string points, is laid out by the next commit.
+static esp_err_t attach_profile(modbus_device_t *device, const modbus_profile_t *profile)
+{
+    release_registers(device);
+    device->profile = profile;
+    device->registers = (modbus_register_t *)profile->registers;
+    device->register_count = profile->register_count;
+    device->register_capacity = profile->register_count;
+    device->point_index = (uint16_t *)profile->point_index;
+    device->point_index_mask = profile->point_index_mask;
+    registry_generation++;
+    return ESP_OK;
+}
+
+static void free_all_devices(void)
+{
+    registry_generation++;
+    for (uint8_t i = 0; i < device_count; i++) {
+        release_registers(devices[i]);
+    }
+    memset(device_by_id, 0, sizeof(device_by_id));
+    memset(dirty_devices, 0, sizeof(dirty_devices));
+    index_dirty = false;
+    modbus_pool_reset(&device_pool);
+    heap_caps_free(devices);
+    devices = NULL;
+    device_capacity = 0;
+    device_count = 0;
+}
+
+// Configuration is stored as one CRC-protected blob per device, keyed by
+// Modbus ID ("dev<id>"), plus a small index blob listing the IDs in table
+// order. Multi-byte fields are little-endian and strings are length-prefixed,
+// so the layout does not depend on struct packing. Saving rewrites every
+// shard, but NVS skips blobs whose content is unchanged.
+// Version 2 adds the profile ID to device shards; a device using a
+// profile stores no registers of its own. Version 3 writes each distinct
+// register string once per shard and has registers refer to it by index.
+// Version 4 adds each register's publish_min_ms, version 5 its deadband
+// and heartbeat, version 6 the device's read_gaps flag.
+#define CONFIG_BLOB_VERSION 6
+#define CONFIG_INDEX_MAGIC 0x58494243u  // "CBIX"
+#define CONFIG_DEVICE_MAGIC 0x56444243u // "CBDV"
+#define CONFIG_INDEX_KEY "dev_index"
+
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t reserved[3];
+    uint32_t length;
+    uint32_t crc;
+} config_blob_header_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t pos;
+} blob_writer_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    bool error;
+} blob_reader_t;
+
+// With a NULL buffer the writer only counts, which sizes the blob.
+static void blob_put(blob_writer_t *w, const void *src, size_t len)
+{
+    if (w->data != NULL) {
+        memcpy(&w->data[w->pos], src, len);
+    }
+    w->pos += len;
+}
+
+static void blob_put_u8(blob_writer_t *w, uint8_t value)
+{
+    blob_put(w, &value, 1);
+}
+
+static void blob_put_u16(blob_writer_t *w, uint16_t value)
+{
+    uint8_t bytes[2] = { value & 0xFF, value >> 8 };
+    blob_put(w, bytes, sizeof(bytes));
+}
+
+static void blob_put_u32(blob_writer_t *w, uint32_t value)
+{
+    uint8_t bytes[4] = { value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24 };
+    blob_put(w, bytes, sizeof(bytes));
+}
+
+static void blob_put_float(blob_writer_t *w, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    blob_put_u32(w, bits);
+}
+
+static void blob_put_str(blob_writer_t *w, const char *str, size_t max_len)
+{
+    uint8_t len = strnlen(str, max_len - 1);
+    blob_put_u8(w, len);
+    blob_put(w, str, len);
+}
+
+static const uint8_t *blob_get(blob_reader_t *r, size_t len)
+{
+    if (r->error || r->len - r->pos < len) {
+        r->error = true;
+        return NULL;
+    }
+    const uint8_t *src = &r->data[r->pos];
+    r->pos += len;
+    return src;
+}
+
+static uint8_t blob_get_u8(blob_reader_t *r)
+{
+    const uint8_t *src = blob_get(r, 1);
+    return src != NULL ? src[0] : 0;
+}
+
+static uint16_t blob_get_u16(blob_reader_t *r)
+{
+    const uint8_t *src = blob_get(r, 2);
+    return src != NULL ? (uint16_t)(src[0] | (src[1] << 8)) : 0;
+}
+
+static uint32_t blob_get_u32(blob_reader_t *r)
+{
+    const uint8_t *src = blob_get(r, 4);
+    if (src == NULL) {
+        return 0;
+    }
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static float blob_get_float(blob_reader_t *r)
+{
+    uint32_t bits = blob_get_u32(r);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void blob_get_str(blob_reader_t *r, char *dst, size_t size)
+{
+    uint8_t len = blob_get_u8(r);
+    const uint8_t *src = blob_get(r, len);
+    if (src == NULL) {
+        dst[0] = '\0';
+        return;
+    }
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+// Distinct string pointers of one device, sorted by address so a
+// register's strings map to table indices with a binary search. Strings
+// are interned, so equal text almost always shares one pointer.
+typedef struct {
+    const char **strings;
+    uint32_t count;
+} blob_strings_t;
+
+static int compare_pointers(const void *a, const void *b)
+{
+    uintptr_t pa = (uintptr_t)*(const char *const *)a;
+    uintptr_t pb = (uintptr_t)*(const char *const *)b;
+    return (pa > pb) - (pa < pb);
+}
+
+static esp_err_t collect_strings(const modbus_device_t *dev, blob_strings_t *table)
+{
+    table->strings = NULL;
+    table->count = 0;
+    if (dev->profile != NULL || dev->register_count == 0) {
+        return ESP_OK;
+    }
+
+    size_t bytes = (size_t)dev->register_count * 3 * sizeof(const char *);
+    if (!modbus_heap_can_allocate(bytes)) {
+        return ESP_ERR_NO_MEM;
+    }
+    const char **strings = heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+    if (strings == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint32_t n = 0;
+    for (uint16_t j = 0; j < dev->register_count; j++) {
+        strings[n++] = dev->registers[j].name;
+        strings[n++] = dev->registers[j].unit;
+        strings[n++] = dev->registers[j].description;
+    }
+    qsort(strings, n, sizeof(*strings), compare_pointers);
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (count == 0 || strings[i] != strings[count - 1]) {
+            strings[count++] = strings[i];
+        }
+    }
+    if (count > UINT16_MAX) {
+        heap_caps_free(strings);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    table->strings = strings;
+    table->count = count;
+    return ESP_OK;
+}
+
+static uint16_t string_index(const blob_strings_t *table, const char *str)
+{
+    const char **found = bsearch(&str, table->strings, table->count, sizeof(*table->strings), compare_pointers);
+    return found - table->strings;
+}
+
+static void encode_device(blob_writer_t *w, const modbus_device_t *dev, const blob_strings_t *table)
+{
+    blob_put_u8(w, dev->device_id);
+    blob_put_str(w, dev->name, sizeof(dev->name));
+    blob_put_str(w, dev->description, sizeof(dev->description));
+    blob_put_u32(w, dev->poll_interval_ms);
+    blob_put_u8(w, dev->enabled);
+    blob_put_u16(w, dev->baudrate);
+    blob_put_u8(w, dev->parity);
+    blob_put_u8(w, dev->supports_fc23);
+    blob_put_u8(w, dev->read_gaps);
+    blob_put_str(w, dev->profile != NULL ? dev->profile->id : "", MODBUS_PROFILE_ID_MAX_LEN);
+    blob_put_u16(w, table->count);
+    for (uint32_t i = 0; i < table->count; i++) {
+        blob_put_str(w, table->strings[i], MODBUS_STR_MAX_LEN + 1);
+    }
+    if (dev->profile != NULL) {
+        blob_put_u16(w, 0);
+        return;
+    }
+    blob_put_u16(w, dev->register_count);
+
+    for (uint16_t j = 0; j < dev->register_count; j++) {
+        const modbus_register_t *reg = &dev->registers[j];
+        blob_put_u16(w, reg->address);
+        blob_put_u8(w, reg->type);
+        blob_put_u16(w, string_index(table, reg->name));
+        blob_put_u16(w, string_index(table, reg->unit));
+        blob_put_float(w, reg->scale);
+        blob_put_float(w, reg->offset);
+        blob_put_u8(w, reg->writable);
+        blob_put_u16(w, string_index(table, reg->description));
+        blob_put_u8(w, reg->data_type);
+        blob_put_u8(w, reg->word_order);
+        blob_put_u8(w, reg->length);
+        blob_put_u8(w, reg->bit_offset);
+        blob_put_u8(w, reg->bit_width);
+        blob_put_u16(w, reg->publish_min_ms);
+        blob_put_float(w, reg->deadband);
+        blob_put_u8(w, reg->deadband_mode);
+        blob_put_u16(w, reg->heartbeat_s);
+    }
+}
+
+static void release_string_table(const char **strings, uint16_t count)
+{
+    for (uint16_t i = 0; i < count; i++) {
+        modbus_str_release(strings[i]);
+    }
+    heap_caps_free(strings);
+}
+
+// Interns the string table of a version 3 shard. Each entry holds one
+// reference until release_string_table().
+static esp_err_t decode_string_table(blob_reader_t *r, const char ***strings, uint16_t *count)
+{
+    *strings = NULL;
+    *count = 0;
+    uint16_t stored = blob_get_u16(r);
+    if (r->error || stored == 0) {
+        return r->error ? ESP_ERR_INVALID_SIZE : ESP_OK;
+    }
+
+    size_t bytes = stored * sizeof(const char *);
+    const char **table = modbus_heap_can_allocate(bytes) ? heap_caps_malloc(bytes, MALLOC_CAP_8BIT) : NULL;
+    if (table == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    char text[MODBUS_STR_MAX_LEN + 1];
+    uint16_t n = 0;
+    esp_err_t err = ESP_OK;
+    while (n < stored) {
+        blob_get_str(r, text, sizeof(text));
+        if (r->error) {
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        if ((table[n] = modbus_str_intern(text)) == NULL) {
+            err = ESP_ERR_NO_MEM;
+            break;
+        }
+        n++;
+    }
+    if (err != ESP_OK) {
+        release_string_table(table, n);
+        return err;
+    }
+
+    *strings = table;
+    *count = n;
+    return ESP_OK;
+}
+
+// Reads one register string with a reference held: a table index from
+// version 3 on, inline text before that. Sets r->error on a bad index or
+// when out of memory.
+static const char *decode_register_string(blob_reader_t *r, uint8_t version,
+                                          const char **strings, uint16_t count)
+{
+    if (version >= 3) {
+        uint16_t index = blob_get_u16(r);
+        if (r->error || index >= count) {
+            r->error = true;
+            return "";
+        }
+        modbus_str_retain(strings[index]);
+        return strings[index];
+    }
+
+    char text[MODBUS_STR_MAX_LEN + 1];
+    blob_get_str(r, text, sizeof(text));
+    const char *str = modbus_str_intern(text);
+    if (str == NULL) {
+        r->error = true;
+        return "";
+    }
+    return str;
+}
+
+static esp_err_t decode_device(blob_reader_t *r, modbus_device_t *dev, uint8_t version)
+{
+    char profile_id[MODBUS_PROFILE_ID_MAX_LEN] = "";
+    const char **strings = NULL;
+    uint16_t string_count = 0;
+
+    dev->device_id = blob_get_u8(r);
+    blob_get_str(r, dev->name, sizeof(dev->name));
+    blob_get_str(r, dev->description, sizeof(dev->description));
+    dev->poll_interval_ms = blob_get_u32(r);
+    dev->enabled = blob_get_u8(r) != 0;
+    dev->baudrate = blob_get_u16(r);
+    dev->parity = (parity_mode_t)blob_get_u8(r);
+    dev->supports_fc23 = blob_get_u8(r) != 0;
+    if (version >= 6) {
+        dev->read_gaps = blob_get_u8(r) != 0;
+    }
+    if (version >= 2) {
+        blob_get_str(r, profile_id, sizeof(profile_id));
+    }
+    if (version >= 3) {
+        esp_err_t err = decode_string_table(r, &strings, &string_count);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    uint16_t stored_registers = blob_get_u16(r);
+    if (r->error) {
+        release_string_table(strings, string_count);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (profile_id[0] != '\0') {
+        release_string_table(strings, string_count);
+        const modbus_profile_t *profile = modbus_profile_find(profile_id);
+        if (profile == NULL) {
+            // Keep the device so its settings survive; it has no points
+            // until a profile or registers are assigned again.
+            ESP_LOGE(TAG, "Device %d uses unknown profile '%s'", dev->device_id, profile_id);
+            return ESP_OK;
+        }
+        return attach_profile(dev, profile);
+    }
+
+    if (reserve_registers(dev, stored_registers) != ESP_OK) {
+        release_string_table(strings, string_count);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Fields an older version does not store keep their zero default.
+    for (uint16_t j = 0; j < stored_registers && !r->error; j++) {
+        modbus_register_t *reg = &dev->registers[j];
+        memset(reg, 0, sizeof(*reg));
+        reg->address = blob_get_u16(r);
+        reg->type = (register_type_t)blob_get_u8(r);
+        reg->name = decode_register_string(r, version, strings, string_count);
+        reg->unit = decode_register_string(r, version, strings, string_count);
+        reg->scale = blob_get_float(r);
+        reg->offset = blob_get_float(r);
+        reg->writable = blob_get_u8(r) != 0;
+        reg->description = decode_register_string(r, version, strings, string_count);
+        reg->data_type = blob_get_u8(r);
+        reg->word_order = blob_get_u8(r);
+        reg->length = blob_get_u8(r);
+        reg->bit_offset = blob_get_u8(r);
+        reg->bit_width = blob_get_u8(r);
+        if (version >= 4) {
+            reg->publish_min_ms = blob_get_u16(r);
+        }
+        if (version >= 5) {
+            reg->deadband = blob_get_float(r);
+            reg->deadband_mode = blob_get_u8(r);
+            reg->heartbeat_s = blob_get_u16(r);
+        }
+        if (!modbus_data_type_is_valid(reg->data_type)) {
+            reg->data_type = MODBUS_DATA_UINT16;
+        }
+        // Same limits the API enforces; a NaN deadband would suppress every
+        // change.
+        if (!(reg->deadband >= 0) || isinf(reg->deadband)) {
+            reg->deadband = 0;
+        }
+        if (reg->deadband_mode > DEADBAND_PERCENT) {
+            reg->deadband_mode = DEADBAND_ABSOLUTE;
+        }
+        if (r->error) {
+            release_strings(reg);
+        } else {
+            dev->register_count = j + 1;
+        }
+    }
+    release_string_table(strings, string_count);
+    return r->error ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
+
+static esp_err_t write_blob(nvs_handle_t nvs_handle, const char *key, uint32_t magic, uint8_t *buf, size_t payload_len)
+{
+    config_blob_header_t header = {
+        .magic = magic,
+        .version = CONFIG_BLOB_VERSION,
+        .length = payload_len,
+        .crc = esp_rom_crc32_le(0, buf + sizeof(header), payload_len)
+    };
+    memcpy(buf, &header, sizeof(header));
+    return nvs_set_blob(nvs_handle, key, buf, sizeof(header) + payload_len);
+}
+
+// Reads and verifies one blob. On success *buf holds the whole blob (free
+// it with heap_caps_free) and the payload starts after the header.
+static esp_err_t read_blob(nvs_handle_t nvs_handle, const char *key, uint32_t magic,
+                           uint8_t **buf, size_t *payload_len, uint8_t *version)
+{
+    size_t len = 0;
+    esp_err_t err = nvs_get_blob(nvs_handle, key, NULL, &len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (len < sizeof(config_blob_header_t) || !modbus_heap_can_allocate(len)) {
+        return len < sizeof(config_blob_header_t) ? ESP_ERR_INVALID_SIZE : ESP_ERR_NO_MEM;
+    }
+
+    uint8_t *data = heap_caps_malloc(len, MALLOC_CAP_8BIT);
+    if (data == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    err = nvs_get_blob(nvs_handle, key, data, &len);
+    if (err != ESP_OK) {
+        heap_caps_free(data);
+        return err;
+    }
+
+    config_blob_header_t header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != magic || header.version == 0 || header.version > CONFIG_BLOB_VERSION) {
+        ESP_LOGE(TAG, "%s: unknown format (magic 0x%08" PRIx32 ", version %d)", key, header.magic, header.version);
+        heap_caps_free(data);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (header.length != len - sizeof(header) ||
+        header.crc != esp_rom_crc32_le(0, data + sizeof(header), header.length)) {
+        ESP_LOGE(TAG, "%s: CRC or length mismatch", key);
+        heap_caps_free(data);
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    *buf = data;
+    *payload_len = header.length;
+    if (version != NULL) {
+        *version = header.version;
+    }
+    return ESP_OK;
+}
+
+static const char *const LEGACY_DEVICE_KEYS[] = {
+    "id", "name", "desc", "poll", "en", "baud", "par", "fc23", "rn", "rc"
+};
+static const char LEGACY_REGISTER_KEYS[] = "atnusowdyklbx";
+
+// Drops the per-field keys written before the blob format. Only runs once,
+// on the first save after an upgrade.
+static void erase_legacy_keys(nvs_handle_t nvs_handle)
+{
+    uint8_t stored_count = 0;
+    if (nvs_get_u8(nvs_handle, "device_count", &stored_count) != ESP_OK) {
+        return;
+    }
+
+    char key[16];
+    for (uint8_t i = 0; i < stored_count; i++) {
+        uint16_t stored_registers = 0;
+        snprintf(key, sizeof(key), "d%d_rn", i);
+        if (nvs_get_u16(nvs_handle, key, &stored_registers) != ESP_OK) {
+            uint8_t legacy_count = 0;
+            snprintf(key, sizeof(key), "d%d_rc", i);
+            nvs_get_u8(nvs_handle, key, &legacy_count);
+            stored_registers = legacy_count;
+        }
+
+        for (uint16_t j = 0; j < stored_registers; j++) {
+            for (const char *suffix = LEGACY_REGISTER_KEYS; *suffix != '\0'; suffix++) {
+                snprintf(key, sizeof(key), "d%dr%d%c", i, j, *suffix);
+                nvs_erase_key(nvs_handle, key);
+            }
+        }
+        for (size_t k = 0; k < sizeof(LEGACY_DEVICE_KEYS) / sizeof(LEGACY_DEVICE_KEYS[0]); k++) {
+            snprintf(key, sizeof(key), "d%d_%s", i, LEGACY_DEVICE_KEYS[k]);
+            nvs_erase_key(nvs_handle, key);
+        }
+    }
+    nvs_erase_key(nvs_handle, "device_count");
+    ESP_LOGI(TAG, "Migrated %d device(s) from per-field keys", stored_count);
+}
+
+// Encodes one device into a buffer with room for the blob header in front.
+static uint8_t *encode_device_blob(const modbus_device_t *dev, size_t *payload_len)
+{
+    blob_strings_t table;
+    if (collect_strings(dev, &table) != ESP_OK) {
+        return NULL;
+    }
+
+    blob_writer_t counter = { 0 };
+    encode_device(&counter, dev, &table);
+
+    size_t len = sizeof(config_blob_header_t) + counter.pos;
+    uint8_t *buf = modbus_heap_can_allocate(len) ? heap_caps_malloc(len, MALLOC_CAP_8BIT) : NULL;
+    if (buf != NULL) {
+        blob_writer_t writer = { .data = buf, .pos = sizeof(config_blob_header_t) };
+        encode_device(&writer, dev, &table);
+        *payload_len = counter.pos;
+    }
+    heap_caps_free(table.strings);
+    return buf;
+}
+
+// Writes the shards of dirty devices and, if needed, the index. Each shard
+// is encoded under the registry lock but written to flash without it, so
+// polling is never held up by NVS.
 esp_err_t modbus_devices_save(void)
 {
     nvs_handle_t nvs_handle;
@@ -34,234 +953,574 @@ esp_err_t modbus_devices_save(void)
         return err;
     }
 
-    err = nvs_set_u8(nvs_handle, "device_count", device_count);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to save device count: %s", esp_err_to_name(err));
-        nvs_close(nvs_handle);
-        return err;
-    }
-
     char key[16];
-    for (uint8_t i = 0; i < device_count; i++) {
-        snprintf(key, sizeof(key), "d%d_id", i);
-        err = nvs_set_u8(nvs_handle, key, devices[i].device_id);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save d%d_id: %s", i, esp_err_to_name(err));
+    esp_err_t result = ESP_OK;
+    uint16_t written = 0;
+    uint8_t removed[sizeof(dirty_devices)] = { 0 };
+
+    for (uint16_t id = 0; id <= MODBUS_MAX_DEVICES; id++) {
+        modbus_devices_lock();
+        if (!take_dirty(id)) {
+            modbus_devices_unlock();
+            continue;
+        }
+        modbus_device_t *dev = modbus_get_device(id);
+        size_t len = 0;
+        uint8_t *buf = dev != NULL ? encode_device_blob(dev, &len) : NULL;
+        if (dev != NULL && buf == NULL) {
+            mark_dirty(id);
         }
+        modbus_devices_unlock();
 
-        snprintf(key, sizeof(key), "d%d_name", i);
-        err = nvs_set_str(nvs_handle, key, devices[i].name);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save d%d_name: %s", i, esp_err_to_name(err));
+        if (dev == NULL) {
+            removed[id / 8] |= 1 << (id % 8);
+            continue;
+        }
+        if (buf == NULL) {
+            ESP_LOGE(TAG, "Not enough memory to save device %d", id);
+            result = ESP_ERR_NO_MEM;
+            continue;
         }
 
-        snprintf(key, sizeof(key), "d%d_desc", i);
-        err = nvs_set_str(nvs_handle, key, devices[i].description);
+        snprintf(key, sizeof(key), "dev%d", id);
+        err = write_blob(nvs_handle, key, CONFIG_DEVICE_MAGIC, buf, len);
+        heap_caps_free(buf);
         if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save d%d_desc: %s", i, esp_err_to_name(err));
+            ESP_LOGE(TAG, "Failed to save %s: %s", key, esp_err_to_name(err));
+            modbus_devices_lock();
+            mark_dirty(id);
+            modbus_devices_unlock();
+            result = err;
+        } else {
+            written++;
         }
+    }
 
-        snprintf(key, sizeof(key), "d%d_poll", i);
-        err = nvs_set_u32(nvs_handle, key, devices[i].poll_interval_ms);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save d%d_poll: %s", i, esp_err_to_name(err));
+    // The index is written only once every shard it names is on flash: a
+    // device still dirty here failed to save or was added meanwhile, and its
+    // shard may not exist yet. Stale shards are erased only after the index
+    // stopped naming them, so an interrupted save never leaves the index
+    // pointing at a missing shard.
+    uint8_t index[sizeof(config_blob_header_t) + MODBUS_MAX_DEVICES];
+    modbus_devices_lock();
+    bool write_index = index_dirty;
+    bool index_ready = true;
+    uint8_t count = device_count;
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t id = devices[i]->device_id;
+        index[sizeof(config_blob_header_t) + i] = id;
+        if (dirty_devices[id / 8] & (1 << (id % 8))) {
+            index_ready = false;
         }
+    }
+    if (write_index && index_ready) {
+        index_dirty = false;
+    }
+    modbus_devices_unlock();
 
-        snprintf(key, sizeof(key), "d%d_en", i);
-        err = nvs_set_u8(nvs_handle, key, devices[i].enabled);
+    bool index_saved = !write_index;
+    if (write_index && !index_ready) {
+        ESP_LOGW(TAG, "Device index not saved: a device it names is not on flash yet");
+        if (result == ESP_OK) {
+            result = ESP_ERR_INVALID_STATE;
+        }
+    } else if (write_index) {
+        err = write_blob(nvs_handle, CONFIG_INDEX_KEY, CONFIG_INDEX_MAGIC, index, count);
         if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save d%d_en: %s", i, esp_err_to_name(err));
+            ESP_LOGE(TAG, "Failed to save device index: %s", esp_err_to_name(err));
+            modbus_devices_lock();
+            index_dirty = true;
+            modbus_devices_unlock();
+            result = err;
+        } else {
+            index_saved = true;
         }
+    }
 
-        snprintf(key, sizeof(key), "d%d_baud", i);
-        err = nvs_set_u16(nvs_handle, key, devices[i].baudrate);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save d%d_baud: %s", i, esp_err_to_name(err));
+    for (uint16_t id = 0; id <= MODBUS_MAX_DEVICES; id++) {
+        if (!(removed[id / 8] & (1 << (id % 8)))) {
+            continue;
+        }
+        if (index_saved) {
+            snprintf(key, sizeof(key), "dev%d", id);
+            nvs_erase_key(nvs_handle, key);
+        } else {
+            modbus_devices_lock();
+            mark_dirty(id);
+            modbus_devices_unlock();
         }
+    }
 
-        snprintf(key, sizeof(key), "d%d_par", i);
-        err = nvs_set_u8(nvs_handle, key, devices[i].parity);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save d%d_par: %s", i, esp_err_to_name(err));
+    if (result == ESP_OK) {
+        erase_legacy_keys(nvs_handle);
+    }
+
+    err = nvs_commit(nvs_handle);
+    nvs_close(nvs_handle);
+    if (result == ESP_OK) {
+        result = err;
+    }
+
+    if (result == ESP_OK) {
+        if (written > 0 || write_index) {
+            ESP_LOGI(TAG, "Saved %d changed device(s)%s to NVS", written, write_index ? " and the index" : "");
         }
+    } else {
+        ESP_LOGE(TAG, "Failed to save devices: %s", esp_err_to_name(result));
+    }
+    return result;
+}
 
-        snprintf(key, sizeof(key), "d%d_rc", i);
-        err = nvs_set_u8(nvs_handle, key, devices[i].register_count);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to save d%d_rc: %s", i, esp_err_to_name(err));
+// Waits for a burst of edits to settle before saving, so a UI adding many
+// registers in a row ends up as one NVS write per touched device. A steady
+// stream of edits still gets saved after the maximum delay. A failed save
+// left its devices dirty, so it is retried after MODBUS_CONFIG_SAVE_RETRY_MS
+// even if no further edit arrives.
+static void save_task(void *pvParameters)
+{
+    bool retry = false;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, retry ? pdMS_TO_TICKS(MODBUS_CONFIG_SAVE_RETRY_MS) : portMAX_DELAY);
+
+        TickType_t first = xTaskGetTickCount();
+        while (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MODBUS_CONFIG_SAVE_DELAY_MS)) > 0 &&
+               xTaskGetTickCount() - first < pdMS_TO_TICKS(MODBUS_CONFIG_SAVE_MAX_DELAY_MS)) {
         }
 
-        ESP_LOGI(TAG, "Saving %d register(s) for device %d", devices[i].register_count, i);
-        for (uint8_t j = 0; j < devices[i].register_count; j++) {
-            snprintf(key, sizeof(key), "d%dr%da", i, j);
-            err = nvs_set_u16(nvs_handle, key, devices[i].registers[j].address);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to save d%dr%da: %s", i, j, esp_err_to_name(err));
-            }
+        retry = modbus_devices_save() != ESP_OK;
+    }
+}
 
-            snprintf(key, sizeof(key), "d%dr%dt", i, j);
-            err = nvs_set_u8(nvs_handle, key, devices[i].registers[j].type);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to save d%dr%dt: %s", i, j, esp_err_to_name(err));
-            }
+void modbus_devices_schedule_save(void)
+{
+    if (save_task_handle == NULL) {
+        modbus_devices_save();
+        return;
+    }
+    xTaskNotifyGive(save_task_handle);
+}
 
-            snprintf(key, sizeof(key), "d%dr%dn", i, j);
-            err = nvs_set_str(nvs_handle, key, devices[i].registers[j].name);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to save d%dr%dn: %s", i, j, esp_err_to_name(err));
+// Finds the point of a previous snapshot that `reg` continues: same key
+// and the same decoding, so its stored value still means the same thing.
+static const modbus_register_t *find_same_point(const modbus_device_t *old, const modbus_register_t *reg)
+{
+    const modbus_register_t *prev = NULL;
+    if (!modbus_register_is_bitfield(reg)) {
+        prev = point_index_find(old, reg->type, reg->address);
+    } else {
+        for (uint16_t i = 0; i < old->register_count && prev == NULL; i++) {
+            const modbus_register_t *other = &old->registers[i];
+            if (other->type == reg->type && other->address == reg->address &&
+                other->bit_offset == reg->bit_offset && modbus_register_is_bitfield(other)) {
+                prev = other;
             }
+        }
+    }
 
-            snprintf(key, sizeof(key), "d%dr%du", i, j);
-            err = nvs_set_str(nvs_handle, key, devices[i].registers[j].unit);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to save d%dr%du: %s", i, j, esp_err_to_name(err));
-            }
+    if (prev == NULL || prev->data_type != reg->data_type || prev->length != reg->length ||
+        prev->word_order != reg->word_order || prev->bit_width != reg->bit_width) {
+        return NULL;
+    }
+    return prev;
+}
 
-            snprintf(key, sizeof(key), "d%dr%ds", i, j);
-            err = nvs_set_u32(nvs_handle, key, *(uint32_t*)&devices[i].registers[j].scale);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to save d%dr%ds: %s", i, j, esp_err_to_name(err));
+// Lays out a value store for a device whose register map changed and
+// carries over every point that kept its key and shape, so an edit does
+// not blank the points around it. Assigns the text slots of a heap map.
+static modbus_value_store_t *build_store(modbus_device_t *device, const modbus_device_t *old)
+{
+    uint32_t text_bytes = 0;
+    if (device->profile != NULL) {
+        text_bytes = device->profile->text_bytes;
+    } else {
+        for (uint16_t i = 0; i < device->register_count; i++) {
+            modbus_register_t *reg = &device->registers[i];
+            reg->text_offset = 0;
+            if (reg->data_type == MODBUS_DATA_STRING) {
+                reg->text_offset = text_bytes;
+                text_bytes += text_slot_size(reg);
             }
+        }
+    }
+    if (text_bytes > UINT16_MAX) {
+        ESP_LOGE(TAG, "String points of device %d need more than 64 KB of text", device->device_id);
+        return NULL;
+    }
 
-            snprintf(key, sizeof(key), "d%dr%do", i, j);
-            err = nvs_set_u32(nvs_handle, key, *(uint32_t*)&devices[i].registers[j].offset);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to save d%dr%do: %s", i, j, esp_err_to_name(err));
-            }
+    modbus_value_store_t *values = modbus_value_store_create(device->register_count, text_bytes);
+    if (values == NULL) {
+        return NULL;
+    }
+    for (uint16_t i = 0; old != NULL && i < device->register_count; i++) {
+        const modbus_register_t *reg = &device->registers[i];
+        const modbus_register_t *prev = find_same_point(old, reg);
+        if (prev != NULL) {
+            modbus_value_store_copy_point(values, i, reg->text_offset, old->values,
+                                          modbus_register_index(old, prev), prev->text_offset,
+                                          reg->data_type == MODBUS_DATA_STRING ? text_slot_size(reg) : 0);
+        }
+    }
+    return values;
+}
 
-            snprintf(key, sizeof(key), "d%dr%dw", i, j);
-            err = nvs_set_u8(nvs_handle, key, devices[i].registers[j].writable);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to save d%dr%dw: %s", i, j, esp_err_to_name(err));
+// The record in `plan` that publishes `values`, i.e. the device's previous
+// snapshot; IDs may have changed since.
+static const modbus_device_t *published_record(modbus_poll_plan_t *plan, const modbus_value_store_t *values)
+{
+    for (uint16_t i = 0; plan != NULL && values != NULL && i < plan->device_count; i++) {
+        if (plan->devices[i].device.values == values) {
+            return &plan->devices[i].device;
+        }
+    }
+    return NULL;
+}
+
+// Poll statistics live in the published records; carry them over.
+static void carry_status(modbus_device_t *record, const modbus_device_t *previous)
+{
+    record->last_error = previous != NULL ? previous->last_error : 0;
+    record->last_seen = previous != NULL ? previous->last_seen : 0;
+    record->status = previous != NULL ? previous->status : DEVICE_STATUS_UNKNOWN;
+    record->poll_count = previous != NULL ? previous->poll_count : 0;
+    record->error_count = previous != NULL ? previous->error_count : 0;
+}
+
+// Lists the tables of `old` that `plan` no longer uses.
+static void collect_retired(modbus_poll_plan_t *plan, modbus_poll_plan_t *old)
+{
+    for (uint16_t i = 0; old != NULL && i < old->device_count; i++) {
+        const modbus_device_t *prev = &old->devices[i].device;
+        bool table_kept = prev->profile != NULL || (prev->registers == NULL && prev->point_index == NULL);
+        bool values_kept = false;
+        for (uint16_t j = 0; j < plan->device_count; j++) {
+            const modbus_device_t *next = &plan->devices[j].device;
+            table_kept |= next->registers == prev->registers && next->point_index == prev->point_index;
+            values_kept |= next->values == prev->values;
+        }
+
+        modbus_plan_retired_t retired = { 0 };
+        if (!table_kept) {
+            retired.registers = prev->registers;
+            retired.register_count = prev->register_count;
+            retired.register_capacity = prev->register_capacity;
+            retired.point_index = prev->point_index;
+        }
+        if (!values_kept) {
+            retired.values = prev->values;
+        }
+        if (!table_kept || !values_kept) {
+            plan->retired[plan->retired_count++] = retired;
+        }
+    }
+}
+
+static void release_retired(const modbus_plan_retired_t *retired)
+{
+    if (retired->registers != NULL || retired->point_index != NULL) {
+        free_register_table(retired->registers, retired->register_count, retired->register_capacity,
+                            retired->point_index);
+    }
+    modbus_value_store_free(retired->values);
+}
+
+// Publishes the registry as a new snapshot in one swap: drafted register
+// maps become immutable, devices whose map changed get a value store laid
+// out for it, and the poll plan is recompiled. If memory runs short
+// nothing changes and the current snapshot stays in use. Registry lock
+// held.
+static esp_err_t commit_locked(void)
+{
+    if (plan_generation == registry_generation) {
+        return ESP_OK;
+    }
+
+    modbus_poll_plan_t *old = modbus_poll_plan_acquire();
+    uint32_t point_count = 0;
+    for (uint8_t i = 0; i < device_count; i++) {
+        point_count += devices[i]->register_count;
+    }
+
+    modbus_poll_plan_t *plan = modbus_poll_plan_create(registry_generation, device_count, point_count,
+                                                       old != NULL ? old->device_count : 0);
+    esp_err_t err = plan != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+    for (uint8_t i = 0; i < device_count && err == ESP_OK; i++) {
+        modbus_device_t *device = devices[i];
+        const modbus_device_t *previous = published_record(old, device->values);
+        modbus_device_t *record = modbus_poll_plan_add_device(plan, device);
+        carry_status(record, previous);
+        if (!device->registers_published) {
+            record->values = build_store(device, previous);
+            if (record->values == NULL) {
+                err = ESP_ERR_NO_MEM;
             }
+        }
+    }
 
-            snprintf(key, sizeof(key), "d%dr%dd", i, j);
-            err = nvs_set_str(nvs_handle, key, devices[i].registers[j].description);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to save d%dr%dd: %s", i, j, esp_err_to_name(err));
+    if (err != ESP_OK) {
+        for (uint16_t i = 0; plan != NULL && i < plan->device_count; i++) {
+            if (plan->devices[i].device.values != devices[i]->values) {
+                modbus_value_store_free(plan->devices[i].device.values);
             }
         }
+        modbus_poll_plan_discard(plan);
+        modbus_poll_plan_release(old);
+        ESP_LOGW(TAG, "Not enough memory to publish registry generation %" PRIu32 ", keeping %" PRIu32,
+                 registry_generation, plan_generation);
+        return err;
     }
 
-    err = nvs_commit(nvs_handle);
-    nvs_close(nvs_handle);
+    collect_retired(plan, old);
+    modbus_poll_plan_release(old);
+    modbus_poll_plan_publish(plan);
+    for (uint8_t i = 0; i < device_count; i++) {
+        devices[i]->values = plan->devices[i].device.values;
+        devices[i]->registers_published = true;
+    }
+    plan_generation = registry_generation;
+    return ESP_OK;
+}
 
-    if (err == ESP_OK) {
-        ESP_LOGI(TAG, "Saved %d device(s) to NVS successfully", device_count);
-        for (uint8_t i = 0; i < device_count; i++) {
-            ESP_LOGI(TAG, "  Device %d: ID=%d, Name='%s', Regs=%d", i, devices[i].device_id, devices[i].name, devices[i].register_count);
+esp_err_t modbus_devices_commit(void)
+{
+    modbus_devices_lock();
+    esp_err_t err = commit_locked();
+    modbus_poll_plan_reclaim(release_retired);
+    modbus_devices_unlock();
+    return err;
+}
+
+// Waits for a burst of edits to settle like save_task, on a shorter clock,
+// so adding a preset's registers one request at a time compiles one plan.
+// A failed commit leaves the old snapshot running and is retried; plans
+// still held by a reader are freed on a later pass.
+static void commit_task(void *pvParameters)
+{
+    bool retry = false;
+    bool held = false;
+    while (1) {
+        TickType_t wait = retry ? pdMS_TO_TICKS(MODBUS_PLAN_RETRY_MS) :
+                          held ? pdMS_TO_TICKS(MODBUS_PLAN_COMMIT_MAX_DELAY_MS) : portMAX_DELAY;
+        if (ulTaskNotifyTake(pdTRUE, wait) > 0) {
+            TickType_t first = xTaskGetTickCount();
+            while (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MODBUS_PLAN_COMMIT_DELAY_MS)) > 0 &&
+                   xTaskGetTickCount() - first < pdMS_TO_TICKS(MODBUS_PLAN_COMMIT_MAX_DELAY_MS)) {
+            }
         }
+
+        modbus_devices_lock();
+        retry = commit_locked() != ESP_OK;
+        held = modbus_poll_plan_reclaim(release_retired);
+        modbus_devices_unlock();
+    }
+}
+
+// Sets up the lookups of a freshly loaded device: the point index and the
+// ID map. Profile devices come with their index; value stores are laid out
+// when the loaded registry is committed.
+static bool finish_loaded_device(modbus_device_t *dev)
+{
+    bool ok = true;
+
+    if (dev->profile == NULL && rebuild_point_index(dev) != ESP_OK) {
+        ESP_LOGW(TAG, "Not enough memory to index registers of device %d", dev->device_id);
+        ok = false;
+    }
+
+    if (dev->device_id <= MODBUS_MAX_DEVICES && device_by_id[dev->device_id] == NULL) {
+        device_by_id[dev->device_id] = dev;
     } else {
-        ESP_LOGE(TAG, "Failed to commit NVS: %s", esp_err_to_name(err));
+        ESP_LOGW(TAG, "Duplicate or invalid device ID %d", dev->device_id);
+        ok = false;
     }
 
-    return err;
+    dev->last_error = 0;
+    dev->last_seen = 0;
+    dev->status = DEVICE_STATUS_UNKNOWN;
+    dev->poll_count = 0;
+    dev->error_count = 0;
+    return ok;
 }
 
-esp_err_t modbus_devices_load(void)
+static bool load_device_blobs(nvs_handle_t nvs_handle, const uint8_t *ids, size_t count)
 {
-    nvs_handle_t nvs_handle;
-    esp_err_t err;
-    
-    err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
-    if (err != ESP_OK) {
-        ESP_LOGI(TAG, "No modbus configuration found in NVS");
-        return ESP_OK;
+    bool load_success = true;
+    char key[16];
+
+    if (reserve_device_slots(count) != ESP_OK) {
+        ESP_LOGE(TAG, "Not enough memory for %d device(s)", (int)count);
+        return false;
     }
-    
-    err = nvs_get_u8(nvs_handle, "device_count", &device_count);
-    if (err != ESP_OK) {
-        ESP_LOGI(TAG, "No devices found in NVS");
-        nvs_close(nvs_handle);
-        return ESP_OK;
+
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *buf;
+        size_t len;
+        uint8_t version;
+        snprintf(key, sizeof(key), "dev%d", ids[i]);
+        esp_err_t err = read_blob(nvs_handle, key, CONFIG_DEVICE_MAGIC, &buf, &len, &version);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read %s: %s", key, esp_err_to_name(err));
+            load_success = false;
+            continue;
+        }
+
+        modbus_device_t *dev = modbus_pool_alloc(&device_pool);
+        if (dev == NULL) {
+            ESP_LOGE(TAG, "Out of memory, loaded %d of %d device(s)", device_count, (int)count);
+            heap_caps_free(buf);
+            return false;
+        }
+
+        blob_reader_t reader = { .data = buf + sizeof(config_blob_header_t), .len = len };
+        err = decode_device(&reader, dev, version);
+        heap_caps_free(buf);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to decode %s: %s", key, esp_err_to_name(err));
+            load_success = false;
+            if (dev->register_count == 0) {
+                free_device(dev);
+                continue;
+            }
+        }
+
+        devices[device_count++] = dev;
+        if (!finish_loaded_device(dev)) {
+            load_success = false;
+        }
     }
-    
-    if (device_count > MAX_MODBUS_DEVICES) {
-        device_count = MAX_MODBUS_DEVICES;
-        ESP_LOGW(TAG, "Device count exceeds maximum, limiting to %d", MAX_MODBUS_DEVICES);
+    return load_success;
+}
+
+static const char *legacy_string(const char *text, bool *load_success)
+{
+    const char *str = modbus_str_intern(text);
+    if (str == NULL) {
+        ESP_LOGW(TAG, "Not enough memory for register text '%s'", text);
+        *load_success = false;
+        return "";
+    }
+    return str;
+}
+
+// Reads the per-field key layout used before the blob format.
+static bool load_legacy_devices(nvs_handle_t nvs_handle, uint8_t stored_count)
+{
+    esp_err_t err;
+
+    if (stored_count > MODBUS_MAX_DEVICES) {
+        stored_count = MODBUS_MAX_DEVICES;
+        ESP_LOGW(TAG, "Device count exceeds maximum, limiting to %d", MODBUS_MAX_DEVICES);
     }
     
     char key[16];
     bool load_success = true;
+
+    if (reserve_device_slots(stored_count) != ESP_OK) {
+        ESP_LOGE(TAG, "Not enough memory for %d device(s)", stored_count);
+        return false;
+    }
     
-    for (uint8_t i = 0; i < device_count; i++) {
+    for (uint8_t i = 0; i < stored_count; i++) {
+        modbus_device_t *dev = modbus_pool_alloc(&device_pool);
+        if (dev == NULL) {
+            ESP_LOGE(TAG, "Out of memory, loaded %d of %d device(s)", i, stored_count);
+            load_success = false;
+            break;
+        }
+        devices[device_count++] = dev;
+
         snprintf(key, sizeof(key), "d%d_id", i);
-        err = nvs_get_u8(nvs_handle, key, &devices[i].device_id);
+        err = nvs_get_u8(nvs_handle, key, &dev->device_id);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "Failed to read d%d_id: %s", i, esp_err_to_name(err));
-            devices[i].device_id = i;
+            dev->device_id = i;
             load_success = false;
         }
         
         snprintf(key, sizeof(key), "d%d_name", i);
-        size_t len = sizeof(devices[i].name);
-        err = nvs_get_str(nvs_handle, key, devices[i].name, &len);
+        size_t len = sizeof(dev->name);
+        err = nvs_get_str(nvs_handle, key, dev->name, &len);
         if (err != ESP_OK || len == 0) {
             ESP_LOGE(TAG, "Failed to read d%d_name: %s", i, esp_err_to_name(err));
-            memset(devices[i].name, 0, sizeof(devices[i].name));
-            strcpy(devices[i].name, "Unnamed Device");
+            memset(dev->name, 0, sizeof(dev->name));
+            strcpy(dev->name, "Unnamed Device");
             load_success = false;
         }
         
         snprintf(key, sizeof(key), "d%d_desc", i);
-        len = sizeof(devices[i].description);
-        err = nvs_get_str(nvs_handle, key, devices[i].description, &len);
+        len = sizeof(dev->description);
+        err = nvs_get_str(nvs_handle, key, dev->description, &len);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "Failed to read d%d_desc: %s", i, esp_err_to_name(err));
-            memset(devices[i].description, 0, sizeof(devices[i].description));
+            memset(dev->description, 0, sizeof(dev->description));
             load_success = false;
         }
         
         snprintf(key, sizeof(key), "d%d_poll", i);
-        err = nvs_get_u32(nvs_handle, key, &devices[i].poll_interval_ms);
+        err = nvs_get_u32(nvs_handle, key, &dev->poll_interval_ms);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "Failed to read d%d_poll: %s", i, esp_err_to_name(err));
-            devices[i].poll_interval_ms = 5000;
+            dev->poll_interval_ms = 5000;
             load_success = false;
         }
         
         snprintf(key, sizeof(key), "d%d_en", i);
-        err = nvs_get_u8(nvs_handle, key, (uint8_t*)&devices[i].enabled);
+        err = nvs_get_u8(nvs_handle, key, (uint8_t*)&dev->enabled);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "Failed to read d%d_en: %s", i, esp_err_to_name(err));
-            devices[i].enabled = 1;
+            dev->enabled = 1;
             load_success = false;
         }
         
         snprintf(key, sizeof(key), "d%d_baud", i);
-        err = nvs_get_u16(nvs_handle, key, &devices[i].baudrate);
+        err = nvs_get_u16(nvs_handle, key, &dev->baudrate);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "Failed to read d%d_baud: %s", i, esp_err_to_name(err));
-            devices[i].baudrate = 9600;
+            dev->baudrate = 9600;
             load_success = false;
         }
 
         snprintf(key, sizeof(key), "d%d_par", i);
-        err = nvs_get_u8(nvs_handle, key, (uint8_t*)&devices[i].parity);
+        err = nvs_get_u8(nvs_handle, key, (uint8_t*)&dev->parity);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "Failed to read d%d_par: %s", i, esp_err_to_name(err));
-            devices[i].parity = PARITY_NONE;
+            dev->parity = PARITY_NONE;
             load_success = false;
         }
 
-        snprintf(key, sizeof(key), "d%d_rc", i);
-        err = nvs_get_u8(nvs_handle, key, &devices[i].register_count);
+        snprintf(key, sizeof(key), "d%d_fc23", i);
+        err = nvs_get_u8(nvs_handle, key, (uint8_t*)&dev->supports_fc23);
+        if (err != ESP_OK) {
+            dev->supports_fc23 = false;
+        }
+
+        uint16_t stored_registers = 0;
+        snprintf(key, sizeof(key), "d%d_rn", i);
+        err = nvs_get_u16(nvs_handle, key, &stored_registers);
+        if (err != ESP_OK) {
+            uint8_t legacy_count = 0;
+            snprintf(key, sizeof(key), "d%d_rc", i);
+            err = nvs_get_u8(nvs_handle, key, &legacy_count);
+            stored_registers = legacy_count;
+        }
         if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to read d%d_rc: %s", i, esp_err_to_name(err));
-            devices[i].register_count = 0;
+            ESP_LOGE(TAG, "Failed to read register count of device %d: %s", i, esp_err_to_name(err));
             load_success = false;
         }
         
-        if (devices[i].register_count > MAX_REGISTERS_PER_DEVICE) {
-            ESP_LOGW(TAG, "Device_%d has %d registers, limiting to %d", i, devices[i].register_count, MAX_REGISTERS_PER_DEVICE);
-            devices[i].register_count = MAX_REGISTERS_PER_DEVICE;
+        if (reserve_registers(dev, stored_registers) != ESP_OK) {
+            ESP_LOGW(TAG, "Not enough memory for %d registers on device_%d", stored_registers, i);
+            stored_registers = dev->register_capacity;
+            load_success = false;
         }
+        dev->register_count = stored_registers;
         
-        ESP_LOGI(TAG, "Loading %d register(s) for device %d", devices[i].register_count, i);
+        ESP_LOGI(TAG, "Loading %d register(s) for device %d", dev->register_count, i);
         
-        for (uint8_t j = 0; j < devices[i].register_count; j++) {
+        // The per-key format predates the reporting settings; they stay 0.
+        for (uint16_t j = 0; j < dev->register_count; j++) {
+            memset(&dev->registers[j], 0, sizeof(dev->registers[j]));
             snprintf(key, sizeof(key), "d%dr%da", i, j);
-            err = nvs_get_u16(nvs_handle, key, &devices[i].registers[j].address);
+            err = nvs_get_u16(nvs_handle, key, &dev->registers[j].address);
             if (err != ESP_OK) {
                 ESP_LOGE(TAG, "Failed to read d%dr%da: %s", i, j, esp_err_to_name(err));
                 load_success = false;
@@ -272,73 +1531,142 @@ esp_err_t modbus_devices_load(void)
             err = nvs_get_u8(nvs_handle, key, &type);
             if (err != ESP_OK) {
                 ESP_LOGE(TAG, "Failed to read d%dr%dt: %s", i, j, esp_err_to_name(err));
-                devices[i].registers[j].type = REGISTER_TYPE_HOLDING;
+                dev->registers[j].type = REGISTER_TYPE_HOLDING;
                 load_success = false;
             } else {
-                devices[i].registers[j].type = (register_type_t)type;
+                dev->registers[j].type = (register_type_t)type;
             }
             
+            char text[DEVICE_DESC_MAX_LEN];
             snprintf(key, sizeof(key), "d%dr%dn", i, j);
-            len = sizeof(devices[i].registers[j].name);
-            err = nvs_get_str(nvs_handle, key, devices[i].registers[j].name, &len);
+            len = sizeof(text);
+            err = nvs_get_str(nvs_handle, key, text, &len);
             if (err != ESP_OK || len == 0) {
                 ESP_LOGE(TAG, "Failed to read d%dr%dn: %s", i, j, esp_err_to_name(err));
-                memset(devices[i].registers[j].name, 0, sizeof(devices[i].registers[j].name));
-                strcpy(devices[i].registers[j].name, "Unnamed");
+                strcpy(text, "Unnamed");
                 load_success = false;
             }
+            dev->registers[j].name = legacy_string(text, &load_success);
             
             snprintf(key, sizeof(key), "d%dr%du", i, j);
-            len = sizeof(devices[i].registers[j].unit);
-            err = nvs_get_str(nvs_handle, key, devices[i].registers[j].unit, &len);
+            len = sizeof(text);
+            err = nvs_get_str(nvs_handle, key, text, &len);
             if (err != ESP_OK) {
-                memset(devices[i].registers[j].unit, 0, sizeof(devices[i].registers[j].unit));
+                text[0] = '\0';
             }
+            dev->registers[j].unit = legacy_string(text, &load_success);
             
             snprintf(key, sizeof(key), "d%dr%ds", i, j);
             uint32_t scale_val;
             err = nvs_get_u32(nvs_handle, key, &scale_val);
             if (err == ESP_OK) {
-                devices[i].registers[j].scale = *(float*)&scale_val;
+                dev->registers[j].scale = *(float*)&scale_val;
             } else {
-                devices[i].registers[j].scale = 1.0;
+                dev->registers[j].scale = 1.0;
             }
             
             snprintf(key, sizeof(key), "d%dr%do", i, j);
             uint32_t offset_val;
             err = nvs_get_u32(nvs_handle, key, &offset_val);
             if (err == ESP_OK) {
-                devices[i].registers[j].offset = *(float*)&offset_val;
+                dev->registers[j].offset = *(float*)&offset_val;
             } else {
-                devices[i].registers[j].offset = 0.0;
+                dev->registers[j].offset = 0.0;
             }
             
             snprintf(key, sizeof(key), "d%dr%dw", i, j);
-            err = nvs_get_u8(nvs_handle, key, (uint8_t*)&devices[i].registers[j].writable);
+            err = nvs_get_u8(nvs_handle, key, (uint8_t*)&dev->registers[j].writable);
             if (err != ESP_OK) {
-                devices[i].registers[j].writable = 0;
+                dev->registers[j].writable = 0;
             }
             
             snprintf(key, sizeof(key), "d%dr%dd", i, j);
-            len = sizeof(devices[i].registers[j].description);
-            err = nvs_get_str(nvs_handle, key, devices[i].registers[j].description, &len);
+            len = sizeof(text);
+            err = nvs_get_str(nvs_handle, key, text, &len);
             if (err != ESP_OK) {
-                memset(devices[i].registers[j].description, 0, sizeof(devices[i].registers[j].description));
+                text[0] = '\0';
             }
+            dev->registers[j].description = legacy_string(text, &load_success);
             
-            devices[i].registers[j].last_value = 0;
-            devices[i].registers[j].last_update = 0;
-            
-            ESP_LOGI(TAG, "  Loaded reg_%d: Addr=%d, Type=%d, Name='%s'", j, devices[i].registers[j].address, devices[i].registers[j].type, devices[i].registers[j].name);
+            snprintf(key, sizeof(key), "d%dr%dy", i, j);
+            if (nvs_get_u8(nvs_handle, key, &dev->registers[j].data_type) != ESP_OK ||
+                !modbus_data_type_is_valid(dev->registers[j].data_type)) {
+                dev->registers[j].data_type = MODBUS_DATA_UINT16;
+            }
+
+            snprintf(key, sizeof(key), "d%dr%dk", i, j);
+            if (nvs_get_u8(nvs_handle, key, &dev->registers[j].word_order) != ESP_OK) {
+                dev->registers[j].word_order = MODBUS_ORDER_ABCD;
+            }
+
+            snprintf(key, sizeof(key), "d%dr%dl", i, j);
+            if (nvs_get_u8(nvs_handle, key, &dev->registers[j].length) != ESP_OK) {
+                dev->registers[j].length = 0;
+            }
+
+            snprintf(key, sizeof(key), "d%dr%db", i, j);
+            if (nvs_get_u8(nvs_handle, key, &dev->registers[j].bit_offset) != ESP_OK) {
+                dev->registers[j].bit_offset = 0;
+            }
+
+            snprintf(key, sizeof(key), "d%dr%dx", i, j);
+            if (nvs_get_u8(nvs_handle, key, &dev->registers[j].bit_width) != ESP_OK) {
+                dev->registers[j].bit_width = 0;
+            }
+
+            ESP_LOGI(TAG, "  Loaded reg_%d: Addr=%d, Type=%d, Name='%s'", j, dev->registers[j].address, dev->registers[j].type, dev->registers[j].name);
         }
         
-        devices[i].last_error = 0;
-        devices[i].last_seen = 0;
-        devices[i].status = DEVICE_STATUS_UNKNOWN;
-        devices[i].poll_count = 0;
-        devices[i].error_count = 0;
+        if (!finish_loaded_device(dev)) {
+            load_success = false;
+        }
     }
     
+    return load_success;
+}
+
+esp_err_t modbus_devices_load(void)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err;
+    
+    err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGI(TAG, "No modbus configuration found in NVS");
+        return ESP_OK;
+    }
+
+    uint8_t *index = NULL;
+    size_t stored_count = 0;
+    bool load_success;
+    bool migrate = false;
+
+    err = read_blob(nvs_handle, CONFIG_INDEX_KEY, CONFIG_INDEX_MAGIC, &index, &stored_count, NULL);
+    if (err == ESP_OK) {
+        modbus_devices_lock();
+        free_all_devices();
+        load_success = load_device_blobs(nvs_handle, index + sizeof(config_blob_header_t),
+                                         stored_count > MODBUS_MAX_DEVICES ? MODBUS_MAX_DEVICES : stored_count);
+        modbus_devices_unlock();
+        heap_caps_free(index);
+    } else {
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGE(TAG, "Device index unreadable: %s", esp_err_to_name(err));
+        }
+
+        uint8_t legacy_count = 0;
+        if (nvs_get_u8(nvs_handle, "device_count", &legacy_count) != ESP_OK) {
+            ESP_LOGI(TAG, "No devices found in NVS");
+            nvs_close(nvs_handle);
+            return ESP_OK;
+        }
+
+        modbus_devices_lock();
+        free_all_devices();
+        load_success = load_legacy_devices(nvs_handle, legacy_count);
+        modbus_devices_unlock();
+        migrate = true;
+    }
     nvs_close(nvs_handle);
     
     if (!load_success) {
@@ -349,32 +1677,78 @@ esp_err_t modbus_devices_load(void)
     
     for (uint8_t i = 0; i < device_count; i++) {
         ESP_LOGI(TAG, "Device %d: ID=%d, Name='%s', Baud=%d, Poll=%dms, Regs=%d",
-                 i, devices[i].device_id, devices[i].name, devices[i].baudrate,
-                 devices[i].poll_interval_ms, devices[i].register_count);
+                 i, devices[i]->device_id, devices[i]->name, devices[i]->baudrate,
+                 (int)devices[i]->poll_interval_ms, devices[i]->register_count);
     }
-    
+
+    // Rewrite the old key layout as blobs; the legacy keys are dropped only
+    // once every shard has been written.
+    if (migrate && load_success) {
+        modbus_devices_lock();
+        for (uint8_t i = 0; i < device_count; i++) {
+            mark_dirty(devices[i]->device_id);
+        }
+        index_dirty = true;
+        modbus_devices_unlock();
+        modbus_devices_save();
+    }
+
+    // Start polling the loaded devices without waiting for the commit task.
+    modbus_devices_commit();
     return ESP_OK;
 }
 
 esp_err_t modbus_add_device(const modbus_device_t *device)
 {
-    if (device_count >= MAX_MODBUS_DEVICES) {
+    modbus_devices_lock();
+
+    if (device_count >= MODBUS_MAX_DEVICES) {
         ESP_LOGE(TAG, "Maximum number of devices reached");
+        modbus_devices_unlock();
         return ESP_ERR_NO_MEM;
     }
 
+    if (device->device_id > MODBUS_MAX_DEVICES) {
+        modbus_devices_unlock();
+        return ESP_ERR_INVALID_ARG;
+    }
+
     if (modbus_device_exists(device->device_id)) {
         ESP_LOGE(TAG, "Device ID %d already exists", device->device_id);
+        modbus_devices_unlock();
         return ESP_ERR_INVALID_ARG;
     }
 
-    memcpy(&devices[device_count], device, sizeof(modbus_device_t));
-    devices[device_count].last_error = 0;
-    devices[device_count].last_seen = 0;
-    devices[device_count].status = DEVICE_STATUS_UNKNOWN;
-    devices[device_count].poll_count = 0;
-    devices[device_count].error_count = 0;
-    device_count++;
+    modbus_device_t *added = NULL;
+    if (reserve_device_slots(device_count + 1) == ESP_OK) {
+        added = modbus_pool_alloc(&device_pool);
+    }
+    if (added == NULL) {
+        ESP_LOGE(TAG, "Not enough memory for another device");
+        modbus_devices_unlock();
+        return ESP_ERR_NO_MEM;
+    }
+
+    memcpy(added, device, sizeof(modbus_device_t));
+    added->registers = NULL;
+    added->register_count = 0;
+    added->register_capacity = 0;
+    added->last_error = 0;
+    added->last_seen = 0;
+    added->status = DEVICE_STATUS_UNKNOWN;
+    added->poll_count = 0;
+    added->error_count = 0;
+    added->point_index = NULL;
+    added->point_index_mask = 0;
+    added->profile = NULL;
+    added->registers_published = false;
+    added->values = NULL;
+    devices[device_count++] = added;
+    device_by_id[added->device_id] = added;
+    registry_generation++;
+    mark_dirty(added->device_id);
+    index_dirty = true;
+    modbus_devices_unlock();
 
     ESP_LOGI(TAG, "Added device: ID=%d, Name=%s", device->device_id, device->name);
     return ESP_OK;
@@ -382,57 +1756,101 @@ esp_err_t modbus_add_device(const modbus_device_t *device)
 
 esp_err_t modbus_update_device(uint8_t device_id, const modbus_device_t *device)
 {
-    for (uint8_t i = 0; i < device_count; i++) {
-        if (devices[i].device_id == device_id) {
-            uint8_t register_count = devices[i].register_count;
-            modbus_register_t registers[MAX_REGISTERS_PER_DEVICE];
-            memcpy(registers, devices[i].registers, sizeof(registers));
-            
-            devices[i].device_id = device->device_id;
-            strncpy(devices[i].name, device->name, sizeof(devices[i].name) - 1);
-            devices[i].name[sizeof(devices[i].name) - 1] = '\0';
-            strncpy(devices[i].description, device->description, sizeof(devices[i].description) - 1);
-            devices[i].description[sizeof(devices[i].description) - 1] = '\0';
-            devices[i].poll_interval_ms = device->poll_interval_ms;
-            devices[i].baudrate = device->baudrate;
-            devices[i].parity = device->parity;
-            devices[i].enabled = device->enabled;
-            devices[i].register_count = register_count;
-            memcpy(devices[i].registers, registers, sizeof(registers));
-            
-            ESP_LOGI(TAG, "Updated device: ID=%d, Name=%s, Registers preserved", device_id, device->name);
-            return ESP_OK;
+    modbus_devices_lock();
+    modbus_device_t *existing = modbus_get_device(device_id);
+    if (existing == NULL) {
+        modbus_devices_unlock();
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (device->device_id != device_id) {
+        if (device->device_id > MODBUS_MAX_DEVICES || device_by_id[device->device_id] != NULL) {
+            modbus_devices_unlock();
+            return ESP_ERR_INVALID_ARG;
         }
+        device_by_id[device_id] = NULL;
+        device_by_id[device->device_id] = existing;
+        index_dirty = true;
     }
-    return ESP_ERR_NOT_FOUND;
+
+    existing->device_id = device->device_id;
+    registry_generation++;
+    mark_dirty(device_id);
+    mark_dirty(device->device_id);
+    strncpy(existing->name, device->name, sizeof(existing->name) - 1);
+    existing->name[sizeof(existing->name) - 1] = '\0';
+    strncpy(existing->description, device->description, sizeof(existing->description) - 1);
+    existing->description[sizeof(existing->description) - 1] = '\0';
+    existing->poll_interval_ms = device->poll_interval_ms;
+    existing->baudrate = device->baudrate;
+    existing->parity = device->parity;
+    existing->enabled = device->enabled;
+    existing->supports_fc23 = device->supports_fc23;
+    existing->read_gaps = device->read_gaps;
+    modbus_devices_unlock();
+
+    ESP_LOGI(TAG, "Updated device: ID=%d, Name=%s, Registers preserved", device_id, device->name);
+    return ESP_OK;
 }
 
 esp_err_t modbus_remove_device(uint8_t device_id)
 {
+    modbus_devices_lock();
     for (uint8_t i = 0; i < device_count; i++) {
-        if (devices[i].device_id == device_id) {
+        if (devices[i]->device_id == device_id) {
+            device_by_id[device_id] = NULL;
+            free_device(devices[i]);
+            mark_dirty(device_id);
+            index_dirty = true;
             if (i < device_count - 1) {
-                memmove(&devices[i], &devices[i + 1], (device_count - 1 - i) * sizeof(modbus_device_t));
+                memmove(&devices[i], &devices[i + 1], (device_count - 1 - i) * sizeof(modbus_device_t *));
             }
             device_count--;
+            modbus_devices_unlock();
             ESP_LOGI(TAG, "Removed device ID=%d", device_id);
             return ESP_OK;
         }
     }
+    modbus_devices_unlock();
     return ESP_ERR_NOT_FOUND;
 }
 
+esp_err_t modbus_set_device_profile(uint8_t device_id, const char *profile_id)
+{
+    modbus_devices_lock();
+    modbus_device_t *device = modbus_get_device(device_id);
+    const modbus_profile_t *profile = NULL;
+    esp_err_t err = ESP_OK;
+
+    if (device == NULL) {
+        err = ESP_ERR_NOT_FOUND;
+    } else if (profile_id == NULL || profile_id[0] == '\0') {
+        err = own_registers(device);
+    } else if ((profile = modbus_profile_find(profile_id)) == NULL) {
+        err = ESP_ERR_NOT_FOUND;
+    } else if (profile != device->profile) {
+        err = attach_profile(device, profile);
+    }
+    if (err == ESP_OK) {
+        mark_dirty(device_id);
+    }
+    modbus_devices_unlock();
+
+    if (err == ESP_OK && profile != NULL) {
+        ESP_LOGI(TAG, "Device %d uses profile %s (%d points)", device_id, profile->id, profile->register_count);
+    }
+    return err;
+}
+
 modbus_device_t* modbus_get_device(uint8_t device_id)
 {
-    for (uint8_t i = 0; i < device_count; i++) {
-        if (devices[i].device_id == device_id) {
-            return &devices[i];
-        }
+    if (device_id > MODBUS_MAX_DEVICES) {
+        return NULL;
     }
-    return NULL;
+    return device_by_id[device_id];
 }
 
-modbus_device_t* modbus_list_devices(uint8_t *count)
+modbus_device_t** modbus_list_devices(uint8_t *count)
 {
     if (count == NULL) {
         return NULL;
@@ -447,128 +1865,454 @@ modbus_device_t* modbus_list_devices(uint8_t *count)
     return devices;
 }
 
-esp_err_t modbus_add_register(uint8_t device_id, const modbus_register_t *reg)
+// Field checks shared by add and update.
+static esp_err_t validate_register(const modbus_register_t *reg)
+{
+    if (!modbus_data_type_is_valid(reg->data_type) || reg->word_order > MODBUS_ORDER_DCBA) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (modbus_register_is_bitfield(reg)) {
+        if ((reg->type != REGISTER_TYPE_HOLDING && reg->type != REGISTER_TYPE_INPUT) ||
+            !modbus_data_type_is_integer(reg->data_type) ||
+            reg->bit_offset + reg->bit_width > modbus_register_span(reg) * 16) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    return ESP_OK;
+}
+
+// Whether a point other than `self` already has the key of `reg`: its
+// (type, address), or for a bitfield also its bit offset.
+static bool point_key_taken(const modbus_device_t *device, const modbus_register_t *reg,
+                            const modbus_register_t *self)
+{
+    if (!modbus_register_is_bitfield(reg)) {
+        const modbus_register_t *other = point_index_find(device, reg->type, reg->address);
+        return other != NULL && other != self;
+    }
+    for (uint16_t i = 0; i < device->register_count; i++) {
+        const modbus_register_t *existing = &device->registers[i];
+        if (existing != self && existing->address == reg->address && existing->type == reg->type &&
+            modbus_register_is_bitfield(existing) && existing->bit_offset == reg->bit_offset) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void normalize_register(modbus_register_t *reg)
+{
+    if (reg->type == REGISTER_TYPE_COIL || reg->type == REGISTER_TYPE_DISCRETE) {
+        reg->data_type = MODBUS_DATA_UINT16;
+    }
+    reg->length = modbus_data_type_registers(reg->data_type, reg->length);
+    if (modbus_register_is_bitfield(reg)) {
+        reg->writable = false;
+    } else {
+        reg->bit_offset = 0;
+    }
+}
+
+static esp_err_t add_register_locked(uint8_t device_id, const modbus_register_t *reg)
 {
     modbus_device_t *device = modbus_get_device(device_id);
     if (device == NULL) {
         return ESP_ERR_NOT_FOUND;
     }
 
-    if (device->register_count >= MAX_REGISTERS_PER_DEVICE) {
+    if (point_key_taken(device, reg, NULL)) {
+        ESP_LOGW(TAG, "Register address %d (Type %d) already exists for device %d", 
+                  reg->address, reg->type, device_id);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (validate_register(reg) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (reserve_registers(device, device->register_count + 1) != ESP_OK) {
         return ESP_ERR_NO_MEM;
     }
 
-    for (uint8_t i = 0; i < device->register_count; i++) {
-        if (device->registers[i].address == reg->address && device->registers[i].type == reg->type) {
-            ESP_LOGW(TAG, "Register address %d (Type %d) already exists for device %d", 
-                      reg->address, reg->type, device_id);
-            return ESP_ERR_INVALID_ARG;
+    modbus_register_t *added = &device->registers[device->register_count];
+    memcpy(added, reg, sizeof(modbus_register_t));
+    if (intern_strings(added) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    normalize_register(added);
+    device->register_count++;
+    registry_generation++;
+    mark_dirty(device_id);
+
+    if ((uint32_t)device->register_count * 2 > (uint32_t)device->point_index_mask + 1 ||
+        device->point_index == NULL) {
+        if (rebuild_point_index(device) != ESP_OK) {
+            release_strings(added);
+            device->register_count--;
+            return ESP_ERR_NO_MEM;
         }
+    } else if (!modbus_register_is_bitfield(added)) {
+        point_index_insert(device, device->register_count - 1);
     }
 
-    memcpy(&device->registers[device->register_count], reg, sizeof(modbus_register_t));
-    device->registers[device->register_count].last_value = 0;
-    device->registers[device->register_count].last_update = 0;
-    device->register_count++;
+    if (modbus_register_is_bitfield(added)) {
+        ESP_LOGI(TAG, "Added bitfield: Device=%d, Addr=%d, Bits=%d+%d, Name=%s",
+                  device_id, reg->address, reg->bit_offset, reg->bit_width, reg->name);
+    } else {
+        ESP_LOGI(TAG, "Added register: Device=%d, Addr=%d, Name=%s", device_id, reg->address, reg->name);
+    }
+    return ESP_OK;
+}
+
+esp_err_t modbus_add_register(uint8_t device_id, const modbus_register_t *reg)
+{
+    modbus_devices_lock();
+    esp_err_t err = add_register_locked(device_id, reg);
+    modbus_devices_unlock();
+    return err;
+}
+
+// Replaces the point currently keyed (type, address) with `reg`, whose
+// key, type or shape may differ.
+static esp_err_t update_register_locked(uint8_t device_id, register_type_t type, uint16_t address,
+                                        const modbus_register_t *reg)
+{
+    modbus_device_t *device = modbus_get_device(device_id);
+    if (device == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (validate_register(reg) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (own_registers(device) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    modbus_register_t *existing = point_index_find(device, type, address);
+    if (existing == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (point_key_taken(device, reg, existing)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    modbus_register_t updated = *reg;
+    if (intern_strings(&updated) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    normalize_register(&updated);
+
+    release_strings(existing);
+    memcpy(existing, &updated, sizeof(modbus_register_t));
+    registry_generation++;
+    mark_dirty(device_id);
+
+    // Same point count, so the table keeps its size and needs no memory.
+    // The value carries over at commit only if key and shape are unchanged.
+    rebuild_point_index(device);
+    ESP_LOGI(TAG, "Updated register: Device=%d, Type=%d, Addr=%d", device_id, type, address);
+    return ESP_OK;
+}
+
+esp_err_t modbus_update_register(uint8_t device_id, register_type_t type, uint16_t address,
+                                 const modbus_register_t *reg)
+{
+    modbus_devices_lock();
+    esp_err_t err = update_register_locked(device_id, type, address, reg);
+    modbus_devices_unlock();
+    return err;
+}
+
+static esp_err_t remove_register_at(modbus_device_t *device, uint16_t i)
+{
+    if (own_registers(device) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    release_strings(&device->registers[i]);
+    if (i < device->register_count - 1) {
+        memmove(&device->registers[i], &device->registers[i + 1], (device->register_count - 1 - i) * sizeof(modbus_register_t));
+    }
+    device->register_count--;
+    registry_generation++;
+    mark_dirty(device->device_id);
 
-    ESP_LOGI(TAG, "Added register: Device=%d, Addr=%d, Name=%s", device_id, reg->address, reg->name);
+    // Indices above the removed point shifted down.
+    rebuild_point_index(device);
     return ESP_OK;
 }
 
-esp_err_t modbus_update_register(uint8_t device_id, uint16_t address, const modbus_register_t *reg)
+static esp_err_t remove_register_locked(uint8_t device_id, register_type_t type, uint16_t address)
 {
     modbus_device_t *device = modbus_get_device(device_id);
     if (device == NULL) {
         return ESP_ERR_NOT_FOUND;
     }
 
-    for (uint8_t i = 0; i < device->register_count; i++) {
-        if (device->registers[i].address == address) {
-            uint16_t last_val = device->registers[i].last_value;
-            uint32_t last_upd = device->registers[i].last_update;
-            memcpy(&device->registers[i], reg, sizeof(modbus_register_t));
-            device->registers[i].last_value = last_val;
-            device->registers[i].last_update = last_upd;
-            ESP_LOGI(TAG, "Updated register: Device=%d, Addr=%d", device_id, address);
-            return ESP_OK;
-        }
+    modbus_register_t *reg = point_index_find(device, type, address);
+    if (reg == NULL) {
+        return ESP_ERR_NOT_FOUND;
     }
-    return ESP_ERR_NOT_FOUND;
+
+    ESP_LOGI(TAG, "Removed register: Device=%d, Type=%d, Addr=%d", device_id, type, address);
+    return remove_register_at(device, modbus_register_index(device, reg));
+}
+
+esp_err_t modbus_remove_register(uint8_t device_id, register_type_t type, uint16_t address)
+{
+    modbus_devices_lock();
+    esp_err_t err = remove_register_locked(device_id, type, address);
+    modbus_devices_unlock();
+    return err;
 }
 
-esp_err_t modbus_remove_register(uint8_t device_id, uint16_t address)
+static esp_err_t remove_bitfield_locked(uint8_t device_id, uint16_t address, uint8_t bit_offset)
 {
     modbus_device_t *device = modbus_get_device(device_id);
     if (device == NULL) {
         return ESP_ERR_NOT_FOUND;
     }
 
-    for (uint8_t i = 0; i < device->register_count; i++) {
-        if (device->registers[i].address == address) {
-            if (i < device->register_count - 1) {
-                memmove(&device->registers[i], &device->registers[i + 1], (device->register_count - 1 - i) * sizeof(modbus_register_t));
-            }
-            device->register_count--;
-            ESP_LOGI(TAG, "Removed register: Device=%d, Addr=%d", device_id, address);
-            return ESP_OK;
+    for (uint16_t i = 0; i < device->register_count; i++) {
+        const modbus_register_t *reg = &device->registers[i];
+        if (reg->address == address && modbus_register_is_bitfield(reg) && reg->bit_offset == bit_offset) {
+            ESP_LOGI(TAG, "Removed bitfield: Device=%d, Addr=%d, Bit=%d", device_id, address, bit_offset);
+            return remove_register_at(device, i);
         }
     }
     return ESP_ERR_NOT_FOUND;
 }
 
-modbus_register_t* modbus_get_register(uint8_t device_id, uint16_t address)
+esp_err_t modbus_remove_bitfield(uint8_t device_id, uint16_t address, uint8_t bit_offset)
+{
+    modbus_devices_lock();
+    esp_err_t err = remove_bitfield_locked(device_id, address, bit_offset);
+    modbus_devices_unlock();
+    return err;
+}
+
+modbus_register_t* modbus_get_register(uint8_t device_id, register_type_t type, uint16_t address)
 {
     modbus_device_t *device = modbus_get_device(device_id);
     if (device == NULL) {
         return NULL;
     }
+    return point_index_find(device, type, address);
+}
+
+// Writes only target coils and holding registers; a coil wins when both
+// exist at the same address.
+modbus_register_t* modbus_find_writable_register(uint8_t device_id, uint16_t address)
+{
+    modbus_register_t *reg = modbus_get_register(device_id, REGISTER_TYPE_COIL, address);
+    if (reg == NULL) {
+        reg = modbus_get_register(device_id, REGISTER_TYPE_HOLDING, address);
+    }
+    return reg;
+}
+
+// Writes go out one 16-bit word per point, so a holding register spanning
+// several words (float32, int64, strings) cannot take one without tearing.
+bool modbus_register_accepts_write(const modbus_register_t *reg)
+{
+    if (reg->type == REGISTER_TYPE_COIL) {
+        return true;
+    }
+    return reg->type == REGISTER_TYPE_HOLDING && reg->writable && !modbus_register_is_bitfield(reg) &&
+           modbus_register_span(reg) == 1;
+}
+
+bool modbus_register_is_bitfield(const modbus_register_t *reg)
+{
+    return reg->bit_width > 0;
+}
+
+// Whole-word points are in the point index; bitfields are not, so those
+// few are compared directly.
+bool modbus_register_address_shared(const modbus_device_t *device, const modbus_register_t *reg)
+{
+    if (!modbus_register_is_bitfield(reg)) {
+        for (int type = REGISTER_TYPE_COIL; type <= REGISTER_TYPE_INPUT; type++) {
+            if (type != reg->type && point_index_find(device, (register_type_t)type, reg->address) != NULL) {
+                return true;
+            }
+        }
+        return false;
+    }
 
-    for (uint8_t i = 0; i < device->register_count; i++) {
-        if (device->registers[i].address == address) {
-            return &device->registers[i];
+    for (uint16_t i = 0; i < device->register_count; i++) {
+        const modbus_register_t *other = &device->registers[i];
+        if (other->type != reg->type && other->address == reg->address &&
+            modbus_register_is_bitfield(other) && other->bit_offset == reg->bit_offset) {
+            return true;
         }
     }
-    return NULL;
+    return false;
 }
 
-esp_err_t modbus_update_register_value(uint8_t device_id, uint16_t address, uint16_t value)
+uint8_t modbus_register_span(const modbus_register_t *reg)
 {
-    modbus_register_t *reg = modbus_get_register(device_id, address);
-    if (reg == NULL) {
+    if (reg->type == REGISTER_TYPE_COIL || reg->type == REGISTER_TYPE_DISCRETE) {
+        return 1;
+    }
+    return modbus_data_type_registers(reg->data_type, reg->length);
+}
+
+uint16_t modbus_register_index(const modbus_device_t *device, const modbus_register_t *reg)
+{
+    return reg - device->registers;
+}
+
+void modbus_set_register_value(modbus_device_t *device, uint16_t index, modbus_value_t value, const char *text,
+                               int64_t timestamp_us)
+{
+    const modbus_register_t *reg = &device->registers[index];
+    modbus_value_store_t *values = device->values;
+
+    modbus_value_store_write_begin(values);
+    if (reg->data_type == MODBUS_DATA_STRING && text != NULL) {
+        char *slot = &values->text[reg->text_offset];
+        size_t len = strnlen(text, text_slot_size(reg) - 1);
+        memcpy(slot, text, len);
+        slot[len] = '\0';
+    }
+    bool changed = modbus_value_store_set(values, index, value, timestamp_us);
+    modbus_value_store_write_end(values);
+
+    // Other points wait for the publisher's periodic flush.
+    if (changed && reg->publish_min_ms > 0 && mqtt_client_is_connected()) {
+        modbus_change_event_t event = {
+            .value = value.u64,
+            .timestamp_us = timestamp_us,
+            .layout_id = values->layout_id,
+            .register_index = index,
+            .device_id = device->device_id,
+            .quality = MODBUS_QUALITY_GOOD
+        };
+        modbus_events_push(&event);
+    }
+}
+
+void modbus_set_register_quality(modbus_device_t *device, uint16_t index, modbus_quality_t quality)
+{
+    modbus_value_store_write_begin(device->values);
+    modbus_value_store_set_quality(device->values, index, quality);
+    modbus_value_store_write_end(device->values);
+}
+
+void modbus_read_register_value(const modbus_device_t *device, uint16_t index, modbus_point_value_t *out,
+                                char *text, size_t text_len)
+{
+    const modbus_register_t *reg = &device->registers[index];
+    const modbus_value_store_t *values = device->values;
+    bool copy_text = text != NULL && text_len > 0 && reg->data_type == MODBUS_DATA_STRING;
+    uint32_t begin;
+
+    do {
+        begin = modbus_value_store_read_begin(values);
+        modbus_value_store_get(values, index, out);
+        if (copy_text) {
+            size_t len = strnlen(&values->text[reg->text_offset], text_slot_size(reg) - 1);
+            if (len >= text_len) {
+                len = text_len - 1;
+            }
+            memcpy(text, &values->text[reg->text_offset], len);
+            text[len] = '\0';
+        }
+    } while (modbus_value_store_read_retry(values, begin));
+
+    if (!copy_text && text != NULL && text_len > 0) {
+        text[0] = '\0';
+    }
+}
+
+// `device` is a record of an acquired plan, so no registry lock is needed.
+static esp_err_t apply_written_value(modbus_device_t *device, register_type_t type, uint16_t address,
+                                     uint16_t value)
+{
+    modbus_register_t *primary = point_index_find(device, type, address);
+    if (primary == NULL) {
         return ESP_ERR_NOT_FOUND;
     }
 
-    reg->last_value = value;
-    reg->last_update = xTaskGetTickCount() * portTICK_PERIOD_MS;
-    
-    if (mqtt_client_is_connected()) {
-        modbus_device_t *device = modbus_get_device(device_id);
-        if (device != NULL) {
-            mqtt_client_publish_register(device_id, device->name, reg);
+    if (modbus_register_span(primary) > 1) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    char text[MODBUS_STRING_MAX_LEN + 1];
+    for (uint16_t i = 0; i < device->register_count; i++) {
+        modbus_register_t *reg = &device->registers[i];
+        if (reg != primary && (reg->address != address || reg->type != primary->type ||
+                               !modbus_register_is_bitfield(reg) || modbus_register_span(reg) > 1)) {
+            continue;
         }
+
+        modbus_value_t decoded;
+        if (reg->type == REGISTER_TYPE_COIL || reg->type == REGISTER_TYPE_DISCRETE) {
+            decoded.u64 = value;
+        } else {
+            modbus_decode_item_t item = {
+                .offset = 0,
+                .data_type = reg->data_type,
+                .word_order = reg->word_order,
+                .length = reg->length,
+                .bit_offset = reg->bit_offset,
+                .bit_width = reg->bit_width,
+                .text = text
+            };
+            modbus_decode_block(&value, &item, 1, &decoded);
+        }
+
+        modbus_set_register_value(device, i, decoded, text, now_us);
     }
-    
     return ESP_OK;
 }
 
-float modbus_get_scaled_value(uint8_t device_id, uint16_t address)
+// Applies a freshly written single-register value to the point at
+// `address` and to every bitfield carved out of that same word.
+esp_err_t modbus_update_register_value(uint8_t device_id, register_type_t type, uint16_t address, uint16_t value)
 {
-    modbus_register_t *reg = modbus_get_register(device_id, address);
-    if (reg == NULL) {
-        return 0.0f;
+    modbus_poll_plan_t *plan = modbus_poll_plan_acquire();
+    modbus_device_t *device = plan != NULL ? modbus_poll_plan_find_device(plan, device_id) : NULL;
+    esp_err_t err = device != NULL ? apply_written_value(device, type, address, value) : ESP_ERR_NOT_FOUND;
+    modbus_poll_plan_release(plan);
+    return err;
+}
+
+// Reads a point from the published snapshot; false if it has none.
+static bool read_published_value(uint8_t device_id, register_type_t type, uint16_t address,
+                                 modbus_register_t *reg, modbus_point_value_t *point)
+{
+    modbus_poll_plan_t *plan = modbus_poll_plan_acquire();
+    modbus_device_t *device = plan != NULL ? modbus_poll_plan_find_device(plan, device_id) : NULL;
+    modbus_register_t *found = device != NULL ? point_index_find(device, type, address) : NULL;
+    if (found != NULL) {
+        *reg = *found;
+        modbus_read_register_value(device, modbus_register_index(device, found), point, NULL, 0);
     }
+    modbus_poll_plan_release(plan);
+    return found != NULL;
+}
 
-    return (float)reg->last_value * reg->scale + reg->offset;
+float modbus_get_scaled_value(uint8_t device_id, register_type_t type, uint16_t address)
+{
+    modbus_register_t reg;
+    modbus_point_value_t point;
+    if (!read_published_value(device_id, type, address, &reg, &point)) {
+        return 0.0f;
+    }
+    return (float)modbus_value_to_double(reg.data_type, point.value) * reg.scale + reg.offset;
 }
 
-uint16_t modbus_get_raw_value(uint8_t device_id, uint16_t address)
+uint16_t modbus_get_raw_value(uint8_t device_id, register_type_t type, uint16_t address)
 {
-    modbus_register_t *reg = modbus_get_register(device_id, address);
-    if (reg == NULL) {
+    modbus_register_t reg;
+    modbus_point_value_t point;
+    if (!read_published_value(device_id, type, address, &reg, &point)) {
         return 0;
     }
-
-    return reg->last_value;
+    return (uint16_t)point.value.u64;
 }
 
 uint8_t modbus_get_device_count(void)
@@ -583,8 +2327,9 @@ bool modbus_device_exists(uint8_t device_id)
 
 esp_err_t modbus_clear_all_devices(void)
 {
-    memset(devices, 0, sizeof(devices));
-    device_count = 0;
+    modbus_devices_lock();
+    free_all_devices();
+    modbus_devices_unlock();
     
     nvs_handle_t nvs_handle;
     if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) == ESP_OK) {
@@ -595,4 +2340,34 @@ esp_err_t modbus_clear_all_devices(void)
     
     ESP_LOGI(TAG, "Cleared all devices");
     return ESP_OK;
-}
\ No newline at end of file
+}
+void modbus_devices_get_stats(modbus_registry_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    modbus_devices_lock();
+    modbus_pool_get_stats(&device_pool, &stats->devices);
+    stats->device_table_bytes = device_capacity * sizeof(modbus_device_t *);
+    for (uint8_t i = 0; i < device_count; i++) {
+        if (devices[i]->profile != NULL) {
+            stats->profile_registers += devices[i]->register_count;
+            continue;
+        }
+        stats->registers_in_use += devices[i]->register_count;
+        stats->registers_capacity += devices[i]->register_capacity;
+    }
+    stats->register_bytes_reserved = register_bytes_reserved;
+    stats->register_bytes_in_use = stats->registers_in_use * sizeof(modbus_register_t);
+    for (uint8_t i = 0; i < device_count; i++) {
+        stats->value_bytes_reserved += modbus_value_store_bytes(devices[i]->values);
+        if (devices[i]->point_index != NULL && devices[i]->profile == NULL) {
+            stats->index_bytes_reserved += (devices[i]->point_index_mask + 1) * sizeof(uint16_t);
+        }
+    }
+    stats->index_bytes_reserved += sizeof(device_by_id);
+    stats->string_bytes = modbus_str_bytes();
+    modbus_devices_unlock();
+
+    stats->free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    stats->largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+}
@@ -4,11 +4,21 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "esp_err.h"
+#include "modbus_data.h"
+#include "modbus_pool.h"
+#include "modbus_value_store.h"
 
-#define MAX_MODBUS_DEVICES 1
-#define MAX_REGISTERS_PER_DEVICE 20
+// Slave addresses 1-247. Point counts are bounded by free heap only; the
+// per-device cap just keeps register indices within uint16_t.
+#define MODBUS_MAX_DEVICES 247
+#define MODBUS_MAX_REGISTERS_PER_DEVICE UINT16_MAX
 #define DEVICE_NAME_MAX_LEN 32
 #define DEVICE_DESC_MAX_LEN 64
+// Register strings are interned (see modbus_strings.h); these bound what
+// the API accepts, including the terminator.
+#define REGISTER_NAME_MAX_LEN 64
+#define REGISTER_UNIT_MAX_LEN 16
+#define REGISTER_DESC_MAX_LEN 256
 
 typedef enum {
     REGISTER_TYPE_COIL = 0x01,
@@ -22,6 +32,11 @@ typedef enum {
     PARITY_EVEN = 1
 } parity_mode_t;
 
+typedef enum {
+    DEADBAND_ABSOLUTE = 0,
+    DEADBAND_PERCENT = 1
+} deadband_mode_t;
+
 typedef enum {
     DEVICE_STATUS_UNKNOWN = 0,
     DEVICE_STATUS_ONLINE = 1,
@@ -29,17 +44,33 @@ typedef enum {
     DEVICE_STATUS_ERROR = 3
 } device_status_t;
 
+// name, unit and description point at interned strings owned by the
+// registry and are never NULL once a register is stored. Callers passing
+// a register in may point them at their own buffers; they are copied.
+// publish_min_ms > 0 publishes a change on its own, at most that often;
+// 0 leaves the point to the periodic MQTT flush. A change is only sent if
+// it moves the engineering value past `deadband` (in units, or percent of
+// the last sent value), and heartbeat_s > 0 resends an unchanged value
+// after that much silence.
 typedef struct {
     uint16_t address;
     register_type_t type;
-    char name[32];
-    char unit[16];
+    const char *name;
+    const char *unit;
     float scale;
     float offset;
     bool writable;
-    char description[64];
-    uint16_t last_value;
-    uint32_t last_update;
+    const char *description;
+    uint8_t data_type;
+    uint8_t word_order;
+    uint8_t length;
+    uint8_t bit_offset;
+    uint8_t bit_width;
+    uint16_t publish_min_ms;
+    uint16_t heartbeat_s;
+    float deadband;
+    uint8_t deadband_mode;
+    uint16_t text_offset;
 } modbus_register_t;
 
 typedef struct {
@@ -49,33 +80,125 @@ typedef struct {
     uint32_t poll_interval_ms;
     bool enabled;
     uint8_t last_error;
-    uint64_t last_seen;
+    int64_t last_seen;
     device_status_t status;
     uint32_t poll_count;
     uint32_t error_count;
     uint16_t baudrate;
-    uint8_t register_count;
-    modbus_register_t registers[MAX_REGISTERS_PER_DEVICE];
+    uint16_t register_count;
+    uint16_t register_capacity;
+    modbus_register_t *registers;
+    // Published with the snapshot (see modbus_poll_plan.h); NULL until the
+    // device's first commit.
+    modbus_value_store_t *values;
+    uint16_t *point_index;
+    uint16_t point_index_mask;
     parity_mode_t parity;
+    bool supports_fc23;
+    // The device answers reads that span unconfigured addresses, so the
+    // poll plan may merge nearby points into one block across small gaps.
+    // Off by default: many devices reject such reads with exception 02.
+    bool read_gaps;
+    // Set while registers and point_index point at a flash-resident
+    // profile. The first register edit copies them to the heap and clears
+    // this, so the device no longer follows the profile.
+    const struct modbus_profile *profile;
+    // Set once registers and point_index belong to the published snapshot.
+    // They are immutable from then on; the next edit works on a private
+    // copy, which the following commit publishes.
+    bool registers_published;
 } modbus_device_t;
 
+typedef struct {
+    modbus_pool_stats_t devices;
+    size_t device_table_bytes;
+    uint32_t registers_in_use;
+    uint32_t registers_capacity;
+    uint32_t profile_registers;
+    size_t register_bytes_reserved;
+    size_t register_bytes_in_use;
+    size_t value_bytes_reserved;
+    size_t index_bytes_reserved;
+    size_t string_bytes;
+    size_t free_heap;
+    size_t largest_free_block;
+} modbus_registry_stats_t;
+
 esp_err_t modbus_devices_init(void);
+// Edits are persisted by a background task once no further edit has
+// arrived for MODBUS_CONFIG_SAVE_DELAY_MS, or at most
+// MODBUS_CONFIG_SAVE_MAX_DELAY_MS after the first one. Only devices that
+// changed are rewritten; a failed save is retried after
+// MODBUS_CONFIG_SAVE_RETRY_MS.
+#define MODBUS_CONFIG_SAVE_DELAY_MS 2000
+#define MODBUS_CONFIG_SAVE_MAX_DELAY_MS 10000
+#define MODBUS_CONFIG_SAVE_RETRY_MS 30000
+
+// Edits go to the registry and reach the poll task, MQTT and the value
+// readers with the next published snapshot. A background task commits
+// once no further edit has arrived for MODBUS_PLAN_COMMIT_DELAY_MS, or at
+// most MODBUS_PLAN_COMMIT_MAX_DELAY_MS after the first one. If memory is
+// short the previous snapshot stays in use and the commit is retried after
+// MODBUS_PLAN_RETRY_MS.
+#define MODBUS_PLAN_COMMIT_DELAY_MS 200
+#define MODBUS_PLAN_COMMIT_MAX_DELAY_MS 1000
+#define MODBUS_PLAN_RETRY_MS 2000
+
 esp_err_t modbus_devices_save(void);
+// Publishes pending edits now instead of waiting for the commit task.
+esp_err_t modbus_devices_commit(void);
+void modbus_devices_schedule_save(void);
 esp_err_t modbus_devices_load(void);
 
 esp_err_t modbus_add_device(const modbus_device_t *device);
 esp_err_t modbus_update_device(uint8_t device_id, const modbus_device_t *device);
 esp_err_t modbus_remove_device(uint8_t device_id);
+// Replaces the register map of a device with a built-in profile (see
+// modbus_profiles.h). A NULL or empty ID detaches the device from its
+// profile and keeps a private copy of the registers.
+esp_err_t modbus_set_device_profile(uint8_t device_id, const char *profile_id);
 modbus_device_t* modbus_get_device(uint8_t device_id);
-modbus_device_t* modbus_list_devices(uint8_t *count);
+modbus_device_t** modbus_list_devices(uint8_t *count);
+
+// Serializes access to the device table and register arrays being edited.
+// Recursive, so holders may call back into the modbus_* accessors. Values
+// and the published tables are read through modbus_poll_plan_acquire()
+// instead and need no lock.
+void modbus_devices_lock(void);
+void modbus_devices_unlock(void);
+// Changes whenever the device table or any register layout changes. Read
+// it under the lock; a different value later means indices and pointers
+// taken before may be stale.
+uint32_t modbus_devices_generation(void);
+void modbus_devices_get_stats(modbus_registry_stats_t *stats);
 
 esp_err_t modbus_add_register(uint8_t device_id, const modbus_register_t *reg);
-esp_err_t modbus_update_register(uint8_t device_id, uint16_t address, const modbus_register_t *reg);
-esp_err_t modbus_remove_register(uint8_t device_id, uint16_t address);
-modbus_register_t* modbus_get_register(uint8_t device_id, uint16_t address);
-esp_err_t modbus_update_register_value(uint8_t device_id, uint16_t address, uint16_t value);
-float modbus_get_scaled_value(uint8_t device_id, uint16_t address);
-uint16_t modbus_get_raw_value(uint8_t device_id, uint16_t address);
+// Replaces the point keyed (type, address); `reg` carries the new key.
+esp_err_t modbus_update_register(uint8_t device_id, register_type_t type, uint16_t address,
+                                 const modbus_register_t *reg);
+esp_err_t modbus_remove_register(uint8_t device_id, register_type_t type, uint16_t address);
+esp_err_t modbus_remove_bitfield(uint8_t device_id, uint16_t address, uint8_t bit_offset);
+// Lookups are keyed by (type, address) through a per-device hash index;
+// bitfields are not indexed and are reached via the owning word.
+modbus_register_t* modbus_get_register(uint8_t device_id, register_type_t type, uint16_t address);
+modbus_register_t* modbus_find_writable_register(uint8_t device_id, uint16_t address);
+esp_err_t modbus_update_register_value(uint8_t device_id, register_type_t type, uint16_t address, uint16_t value);
+uint16_t modbus_register_index(const modbus_device_t *device, const modbus_register_t *reg);
+// Value access goes through a device record of an acquired plan, never
+// through the registry.
+void modbus_set_register_value(modbus_device_t *device, uint16_t index, modbus_value_t value, const char *text,
+                               int64_t timestamp_us);
+void modbus_set_register_quality(modbus_device_t *device, uint16_t index, modbus_quality_t quality);
+void modbus_read_register_value(const modbus_device_t *device, uint16_t index, modbus_point_value_t *out,
+                                char *text, size_t text_len);
+uint8_t modbus_register_span(const modbus_register_t *reg);
+bool modbus_register_accepts_write(const modbus_register_t *reg);
+bool modbus_register_is_bitfield(const modbus_register_t *reg);
+// Whether a point of another register type has the same address (and for
+// a bitfield the same bit), so the address alone does not name `reg`.
+bool modbus_register_address_shared(const modbus_device_t *device, const modbus_register_t *reg);
+float modbus_get_scaled_value(uint8_t device_id, register_type_t type, uint16_t address);
+uint16_t modbus_get_raw_value(uint8_t device_id, register_type_t type, uint16_t address);
 
 uint8_t modbus_get_device_count(void);
 bool modbus_device_exists(uint8_t device_id);
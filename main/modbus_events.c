@@ -0,0 +1,72 @@
+#include "modbus_events.h"
+
+#define EVENT_MASK (MODBUS_EVENT_QUEUE_LEN - 1)
+
+_Static_assert((MODBUS_EVENT_QUEUE_LEN & EVENT_MASK) == 0, "MODBUS_EVENT_QUEUE_LEN must be a power of two");
+
+static modbus_change_event_t ring[MODBUS_EVENT_QUEUE_LEN];
+
+// Free-running indices; head is written only by producers, under
+// producer_mux, and tail only by the consumer, so the two sides need
+// nothing stronger than acquire/release.
+static portMUX_TYPE producer_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t head = 0;
+static uint32_t tail = 0;
+static uint32_t pushed = 0;
+static uint32_t dropped = 0;
+static TaskHandle_t consumer = NULL;
+
+void modbus_events_set_consumer(TaskHandle_t task)
+{
+    __atomic_store_n(&consumer, task, __ATOMIC_RELEASE);
+}
+
+bool modbus_events_push(const modbus_change_event_t *event)
+{
+    portENTER_CRITICAL(&producer_mux);
+    uint32_t h = head;
+    uint32_t t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+
+    if (h - t >= MODBUS_EVENT_QUEUE_LEN) {
+        portEXIT_CRITICAL(&producer_mux);
+        __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    ring[h & EVENT_MASK] = *event;
+    __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+    portEXIT_CRITICAL(&producer_mux);
+    __atomic_add_fetch(&pushed, 1, __ATOMIC_RELAXED);
+
+    // The consumer drains until it sees the ring empty before it sleeps,
+    // so it only needs a wakeup if it had already caught up with this
+    // event. The fences pair with the one in pop(): either the consumer
+    // sees the new head or this side sees its final tail.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    TaskHandle_t task = __atomic_load_n(&consumer, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&tail, __ATOMIC_RELAXED) == h && task != NULL) {
+        xTaskNotifyGive(task);
+    }
+    return true;
+}
+
+bool modbus_events_pop(modbus_change_event_t *event)
+{
+    uint32_t t = tail;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (t == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    *event = ring[t & EVENT_MASK];
+    __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void modbus_events_get_stats(modbus_events_stats_t *stats)
+{
+    stats->pushed = __atomic_load_n(&pushed, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    stats->pending = __atomic_load_n(&head, __ATOMIC_ACQUIRE) - __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+    stats->capacity = MODBUS_EVENT_QUEUE_LEN;
+}
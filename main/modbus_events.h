@@ -0,0 +1,41 @@
+#ifndef MODBUS_EVENTS_H
+#define MODBUS_EVENTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Ring capacity in events; must be a power of two.
+#define MODBUS_EVENT_QUEUE_LEN 256
+
+// One sampled point. `register_index` is only meaningful for a device
+// whose published value store still has this `layout_id`; consumers drop
+// events from older layouts instead of looking the point up again.
+typedef struct {
+    uint64_t value;
+    int64_t timestamp_us;
+    uint32_t layout_id;
+    uint16_t register_index;
+    uint8_t device_id;
+    uint8_t quality;
+} modbus_change_event_t;
+
+typedef struct {
+    uint32_t pushed;
+    uint32_t dropped;
+    uint32_t pending;
+    uint32_t capacity;
+} modbus_events_stats_t;
+
+// Ring of change events with a single consumer. The poll task and the
+// write path both produce, serialized by a short spinlock; the one
+// consumer task registered with modbus_events_set_consumer() drains it
+// without one. Neither side blocks: a full ring drops the new event and
+// counts it.
+void modbus_events_set_consumer(TaskHandle_t task);
+bool modbus_events_push(const modbus_change_event_t *event);
+bool modbus_events_pop(modbus_change_event_t *event);
+void modbus_events_get_stats(modbus_events_stats_t *stats);
+
+#endif
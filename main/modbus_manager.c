@@ -1,12 +1,15 @@
 #include "modbus_manager.h"
 #include "modbus_protocol.h"
 #include "modbus_devices.h"
+#include "modbus_data.h"
+#include "modbus_poll_plan.h"
 #include "nvs_storage.h"
 #include "driver/uart.h"
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
 #include "esp_timer.h"
 #include <inttypes.h>
 #include <string.h>
@@ -124,12 +127,39 @@ static modbus_result_t send_request(uint8_t *frame, uint16_t frame_len)
     return MODBUS_RESULT_OK;
 }
 
-static modbus_result_t receive_response(uint8_t *frame, uint16_t *frame_len)
+// Reads `want` bytes into buf at `len`, giving up at `deadline_us`.
+// Returns the new length.
+static int read_until(uint8_t *buf, int len, int want, int64_t deadline_us)
+{
+    int64_t remaining_us = deadline_us - esp_timer_get_time();
+    TickType_t ticks = remaining_us > 0 ? pdMS_TO_TICKS((remaining_us + 999) / 1000) : 0;
+    int got = uart_read_bytes(UART_NUM, buf + len, want - len, ticks);
+    return got > 0 ? len + got : len;
+}
+
+// Reads one response frame. With a known `expected` length the address and
+// function code are read first: a function code with bit 7 set announces a
+// 5-byte exception frame, anything else is read to its expected length. Either
+// way the read returns as soon as the last byte arrives, so `received_us`
+// marks when the frame completed rather than when the timeout ran out.
+static modbus_result_t receive_response(uint8_t *frame, uint16_t *frame_len, uint16_t expected,
+                                        int64_t *received_us)
 {
     int64_t start_time = esp_timer_get_time();
+    int64_t deadline = start_time + (int64_t)modbus_config.timeout_ms * 1000;
 
     uint8_t buf[BUF_SIZE];
-    int len = uart_read_bytes(UART_NUM, buf, sizeof(buf), pdMS_TO_TICKS(modbus_config.timeout_ms));
+    int len;
+    if (expected > MODBUS_EXCEPTION_FRAME_LEN && expected <= sizeof(buf)) {
+        len = read_until(buf, 0, 2, deadline);
+        if (len == 2) {
+            len = read_until(buf, len, (buf[1] & 0x80) ? MODBUS_EXCEPTION_FRAME_LEN : expected, deadline);
+        }
+    } else {
+        uint16_t want = (expected > 0 && expected <= sizeof(buf)) ? expected : sizeof(buf);
+        len = read_until(buf, 0, want, deadline);
+    }
+    int64_t end_time = esp_timer_get_time();
 
     if (len < 3) {
         ESP_LOGW(TAG, "Timeout waiting for response: %d bytes", len);
@@ -146,11 +176,12 @@ static modbus_result_t receive_response(uint8_t *frame, uint16_t *frame_len)
 
     log_hex_dump(buf, len);
 
-    int64_t rx_time = (esp_timer_get_time() - start_time) / 1000;
+    int64_t rx_time = (end_time - start_time) / 1000;
     ESP_LOGI(TAG, "RX completed in %lld ms", rx_time);
 
     memcpy(frame, buf, len);
     *frame_len = len;
+    *received_us = end_time;
 
     return MODBUS_RESULT_OK;
 }
@@ -158,7 +189,8 @@ static modbus_result_t receive_response(uint8_t *frame, uint16_t *frame_len)
 static modbus_result_t execute_modbus_transaction(uint8_t device_id, uint8_t function,
                                                 uint16_t address, uint16_t quantity,
                                                 const uint8_t *data, uint16_t data_len,
-                                                uint8_t *response_frame, uint16_t *response_len)
+                                                uint8_t *response_frame, uint16_t *response_len,
+                                                int64_t *received_us)
 {
     int64_t transaction_start = esp_timer_get_time();
 
@@ -176,6 +208,8 @@ static modbus_result_t execute_modbus_transaction(uint8_t device_id, uint8_t fun
     uint16_t request_len = 0;
     modbus_response_t response;
     modbus_result_t result = MODBUS_RESULT_OK;
+    uint16_t expected_len = modbus_response_length(function, quantity);
+    int64_t frame_us = 0;
 
     ESP_LOGI(TAG, "TRANSACTION START: DevID=%d, FC=0x%02X (%s), Addr=%d, Qty=%d",
               device_id, function, modbus_function_to_string(function), address, quantity);
@@ -197,7 +231,7 @@ static modbus_result_t execute_modbus_transaction(uint8_t device_id, uint8_t fun
             continue;
         }
 
-        result = receive_response(response_frame, response_len);
+        result = receive_response(response_frame, response_len, expected_len, &frame_us);
         if (result != MODBUS_RESULT_OK) {
             ESP_LOGW(TAG, "ATTEMPT %d/%d: DevID=%d, FC=0x%02X, Addr=%d, Result=%s",
                       retry + 1, modbus_config.retry_attempts, device_id, function, address,
@@ -231,6 +265,9 @@ static modbus_result_t execute_modbus_transaction(uint8_t device_id, uint8_t fun
         ESP_LOGI(TAG, "TRANSACTION SUCCESS: DevID=%d, FC=0x%02X, Attempts=%d, Total Time=%lld ms",
                   device_id, function, retry + 1, total_time);
 
+        if (received_us != NULL) {
+            *received_us = frame_us;
+        }
         last_error = 0;
         xSemaphoreGive(modbus_mutex);
         return MODBUS_RESULT_OK;
@@ -314,8 +351,8 @@ bool modbus_manager_is_initialized(void)
     return modbus_config.initialized;
 }
 
-modbus_result_t modbus_read_holding_registers(uint8_t device_id, uint16_t address,
-                                           uint16_t count, uint16_t *values)
+static modbus_result_t read_registers(uint8_t device_id, uint8_t function, uint16_t address,
+                                      uint16_t count, uint16_t *values, int64_t *received_us)
 {
     if (!modbus_config.initialized) {
         return MODBUS_RESULT_NOT_INITIALIZED;
@@ -323,15 +360,15 @@ modbus_result_t modbus_read_holding_registers(uint8_t device_id, uint16_t addres
 
     uint8_t response_frame[MODBUS_MAX_FRAME_LEN];
     uint16_t response_len = 0;
-    modbus_response_t response;
 
-    modbus_result_t result = execute_modbus_transaction(device_id, MODBUS_FC_READ_HOLDING_REGISTERS,
+    modbus_result_t result = execute_modbus_transaction(device_id, function,
                                                      address, count, NULL, 0,
-                                                     response_frame, &response_len);
+                                                     response_frame, &response_len, received_us);
     if (result != MODBUS_RESULT_OK) {
         return result;
     }
 
+    modbus_response_t response;
     if (modbus_parse_response(response_frame, response_len, &response) != ESP_OK) {
         return MODBUS_RESULT_INVALID_RESPONSE;
     }
@@ -348,19 +385,35 @@ modbus_result_t modbus_read_holding_registers(uint8_t device_id, uint16_t addres
     return MODBUS_RESULT_OK;
 }
 
+modbus_result_t modbus_read_holding_registers(uint8_t device_id, uint16_t address,
+                                           uint16_t count, uint16_t *values)
+{
+    return read_registers(device_id, MODBUS_FC_READ_HOLDING_REGISTERS, address, count, values, NULL);
+}
+
 modbus_result_t modbus_read_input_registers(uint8_t device_id, uint16_t address,
                                           uint16_t count, uint16_t *values)
+{
+    return read_registers(device_id, MODBUS_FC_READ_INPUT_REGISTERS, address, count, values, NULL);
+}
+
+static modbus_result_t read_bits(uint8_t device_id, uint8_t function, uint16_t address,
+                                 uint16_t count, uint8_t *values, int64_t *received_us)
 {
     if (!modbus_config.initialized) {
         return MODBUS_RESULT_NOT_INITIALIZED;
     }
 
+    if (values == NULL || count == 0 || count > MODBUS_MAX_READ_BITS) {
+        return MODBUS_RESULT_INVALID_RESPONSE;
+    }
+
     uint8_t response_frame[MODBUS_MAX_FRAME_LEN];
     uint16_t response_len = 0;
 
-    modbus_result_t result = execute_modbus_transaction(device_id, MODBUS_FC_READ_INPUT_REGISTERS,
+    modbus_result_t result = execute_modbus_transaction(device_id, function,
                                                      address, count, NULL, 0,
-                                                     response_frame, &response_len);
+                                                     response_frame, &response_len, received_us);
     if (result != MODBUS_RESULT_OK) {
         return result;
     }
@@ -370,67 +423,25 @@ modbus_result_t modbus_read_input_registers(uint8_t device_id, uint16_t address,
         return MODBUS_RESULT_INVALID_RESPONSE;
     }
 
-    if (response.byte_count != count * 2) {
+    if (response.byte_count != (count + 7) / 8) {
+        ESP_LOGE(TAG, "Unexpected byte count: %d (expected %d)", response.byte_count, (count + 7) / 8);
         return MODBUS_RESULT_INVALID_RESPONSE;
     }
 
-    for (uint16_t i = 0; i < count; i++) {
-        values[i] = (response.data[i * 2] << 8) | response.data[i * 2 + 1];
-    }
-
+    modbus_unpack_bits(response.data, count, values);
     return MODBUS_RESULT_OK;
 }
 
 modbus_result_t modbus_read_coils(uint8_t device_id, uint16_t address,
                                   uint16_t count, uint8_t *values)
 {
-    if (!modbus_config.initialized) {
-        return MODBUS_RESULT_NOT_INITIALIZED;
-    }
-
-    uint8_t response_frame[MODBUS_MAX_FRAME_LEN];
-    uint16_t response_len = 0;
-
-    modbus_result_t result = execute_modbus_transaction(device_id, MODBUS_FC_READ_COILS,
-                                                     address, count, NULL, 0,
-                                                     response_frame, &response_len);
-    if (result != MODBUS_RESULT_OK) {
-        return result;
-    }
-
-    modbus_response_t response;
-    if (modbus_parse_response(response_frame, response_len, &response) != ESP_OK) {
-        return MODBUS_RESULT_INVALID_RESPONSE;
-    }
-
-    memcpy(values, response.data, response.byte_count);
-    return MODBUS_RESULT_OK;
+    return read_bits(device_id, MODBUS_FC_READ_COILS, address, count, values, NULL);
 }
 
 modbus_result_t modbus_read_discrete_inputs(uint8_t device_id, uint16_t address,
                                           uint16_t count, uint8_t *values)
 {
-    if (!modbus_config.initialized) {
-        return MODBUS_RESULT_NOT_INITIALIZED;
-    }
-
-    uint8_t response_frame[MODBUS_MAX_FRAME_LEN];
-    uint16_t response_len = 0;
-
-    modbus_result_t result = execute_modbus_transaction(device_id, MODBUS_FC_READ_DISCRETE_INPUTS,
-                                                     address, count, NULL, 0,
-                                                     response_frame, &response_len);
-    if (result != MODBUS_RESULT_OK) {
-        return result;
-    }
-
-    modbus_response_t response;
-    if (modbus_parse_response(response_frame, response_len, &response) != ESP_OK) {
-        return MODBUS_RESULT_INVALID_RESPONSE;
-    }
-
-    memcpy(values, response.data, response.byte_count);
-    return MODBUS_RESULT_OK;
+    return read_bits(device_id, MODBUS_FC_READ_DISCRETE_INPUTS, address, count, values, NULL);
 }
 
 modbus_result_t modbus_write_single_register(uint8_t device_id, uint16_t address,
@@ -440,12 +451,13 @@ modbus_result_t modbus_write_single_register(uint8_t device_id, uint16_t address
         return MODBUS_RESULT_NOT_INITIALIZED;
     }
 
+    uint8_t payload[2] = { (value >> 8) & 0xFF, value & 0xFF };
     uint8_t response_frame[MODBUS_MAX_FRAME_LEN];
     uint16_t response_len = 0;
 
     modbus_result_t result = execute_modbus_transaction(device_id, MODBUS_FC_WRITE_SINGLE_REGISTER,
-                                                     address, 1, (uint8_t*)&value, 2,
-                                                     response_frame, &response_len);
+                                                     address, 1, payload, sizeof(payload),
+                                                     response_frame, &response_len, NULL);
     return result;
 }
 
@@ -456,12 +468,22 @@ modbus_result_t modbus_write_multiple_registers(uint8_t device_id, uint16_t addr
         return MODBUS_RESULT_NOT_INITIALIZED;
     }
 
+    if (values == NULL || count == 0 || count > MODBUS_MAX_WRITE_REGISTERS) {
+        return MODBUS_RESULT_INVALID_RESPONSE;
+    }
+
+    uint8_t payload[MODBUS_MAX_WRITE_REGISTERS * 2];
+    for (uint16_t i = 0; i < count; i++) {
+        payload[i * 2] = (values[i] >> 8) & 0xFF;
+        payload[i * 2 + 1] = values[i] & 0xFF;
+    }
+
     uint8_t response_frame[MODBUS_MAX_FRAME_LEN];
     uint16_t response_len = 0;
 
     modbus_result_t result = execute_modbus_transaction(device_id, MODBUS_FC_WRITE_MULTIPLE_REGISTERS,
-                                                     address, count, (uint8_t*)values, count * 2,
-                                                     response_frame, &response_len);
+                                                     address, count, payload, count * 2,
+                                                     response_frame, &response_len, NULL);
     return result;
 }
 
@@ -478,7 +500,7 @@ modbus_result_t modbus_write_single_coil(uint8_t device_id, uint16_t address,
 
     modbus_result_t result = execute_modbus_transaction(device_id, MODBUS_FC_WRITE_SINGLE_COIL,
                                                      address, 1, &coil_value, 1,
-                                                     response_frame, &response_len);
+                                                     response_frame, &response_len, NULL);
     return result;
 }
 
@@ -489,88 +511,288 @@ modbus_result_t modbus_write_multiple_coils(uint8_t device_id, uint16_t address,
         return MODBUS_RESULT_NOT_INITIALIZED;
     }
 
+    if (values == NULL || count == 0 || count > MODBUS_MAX_WRITE_BITS) {
+        return MODBUS_RESULT_INVALID_RESPONSE;
+    }
+
+    uint8_t packed[(MODBUS_MAX_WRITE_BITS + 7) / 8];
+    modbus_pack_bits(values, count, packed);
+
     uint8_t response_frame[MODBUS_MAX_FRAME_LEN];
     uint16_t response_len = 0;
 
     modbus_result_t result = execute_modbus_transaction(device_id, MODBUS_FC_WRITE_MULTIPLE_COILS,
-                                                     address, count, values, count,
-                                                     response_frame, &response_len);
+                                                     address, count, packed, (count + 7) / 8,
+                                                     response_frame, &response_len, NULL);
     return result;
 }
 
+modbus_result_t modbus_read_write_multiple_registers(uint8_t device_id,
+                                                  uint16_t read_address, uint16_t read_count,
+                                                  uint16_t *read_values,
+                                                  uint16_t write_address,
+                                                  const uint16_t *write_values, uint16_t write_count)
+{
+    if (!modbus_config.initialized) {
+        return MODBUS_RESULT_NOT_INITIALIZED;
+    }
+
+    if (read_values == NULL || write_values == NULL ||
+        read_count == 0 || read_count > MODBUS_MAX_READ_REGISTERS ||
+        write_count == 0 || write_count > MODBUS_MAX_RW_WRITE_REGISTERS) {
+        return MODBUS_RESULT_INVALID_RESPONSE;
+    }
+
+    uint8_t payload[4 + MODBUS_MAX_RW_WRITE_REGISTERS * 2];
+    payload[0] = (write_address >> 8) & 0xFF;
+    payload[1] = write_address & 0xFF;
+    payload[2] = (write_count >> 8) & 0xFF;
+    payload[3] = write_count & 0xFF;
+    for (uint16_t i = 0; i < write_count; i++) {
+        payload[4 + i * 2] = (write_values[i] >> 8) & 0xFF;
+        payload[4 + i * 2 + 1] = write_values[i] & 0xFF;
+    }
+
+    uint8_t response_frame[MODBUS_MAX_FRAME_LEN];
+    uint16_t response_len = 0;
+
+    modbus_result_t result = execute_modbus_transaction(device_id, MODBUS_FC_READ_WRITE_MULTIPLE_REGISTERS,
+                                                     read_address, read_count,
+                                                     payload, 4 + write_count * 2,
+                                                     response_frame, &response_len, NULL);
+    if (result != MODBUS_RESULT_OK) {
+        return result;
+    }
+
+    modbus_response_t response;
+    if (modbus_parse_response(response_frame, response_len, &response) != ESP_OK) {
+        return MODBUS_RESULT_INVALID_RESPONSE;
+    }
+
+    if (response.byte_count != read_count * 2) {
+        ESP_LOGE(TAG, "Unexpected byte count: %d (expected %d)", response.byte_count, read_count * 2);
+        return MODBUS_RESULT_INVALID_RESPONSE;
+    }
+
+    for (uint16_t i = 0; i < read_count; i++) {
+        read_values[i] = (response.data[i * 2] << 8) | response.data[i * 2 + 1];
+    }
+
+    return MODBUS_RESULT_OK;
+}
+
+// Writes one holding register and reports the value the device holds
+// afterwards. Devices flagged with FC23 support do this in one round trip;
+// otherwise the FC06 echo is taken as confirmation.
+modbus_result_t modbus_write_register_verified(uint8_t device_id, uint16_t address,
+                                             uint16_t value, uint16_t *confirmed)
+{
+    modbus_devices_lock();
+    modbus_device_t *device = modbus_get_device(device_id);
+    bool use_fc23 = device != NULL && device->supports_fc23;
+    modbus_devices_unlock();
+    modbus_result_t result;
+
+    if (use_fc23) {
+        uint16_t readback = value;
+        result = modbus_read_write_multiple_registers(device_id, address, 1, &readback,
+                                                    address, &value, 1);
+        if (result == MODBUS_RESULT_OK && confirmed != NULL) {
+            *confirmed = readback;
+        }
+        if (result == MODBUS_RESULT_OK && readback != value) {
+            ESP_LOGW(TAG, "Write verify: device %d register %d reads back %d (wrote %d)",
+                      device_id, address, readback, value);
+        }
+        return result;
+    }
+
+    result = modbus_write_single_register(device_id, address, value);
+    if (result == MODBUS_RESULT_OK && confirmed != NULL) {
+        *confirmed = value;
+    }
+    return result;
+}
+
+// Counts one block transaction. The device status is settled once per
+// cycle by poll_device().
+static void record_poll_result(modbus_device_t *device, modbus_result_t result, int64_t sampled_us)
+{
+    device->poll_count++;
+    if (result == MODBUS_RESULT_OK) {
+        device->last_seen = sampled_us;
+    } else {
+        device->error_count++;
+        device->last_error = last_error;
+    }
+}
+
+static modbus_result_t read_block(uint8_t device_id, register_type_t type, uint16_t start,
+                                  uint16_t count, uint16_t *words, uint8_t *bits, int64_t *sampled_us)
+{
+    switch (type) {
+        case REGISTER_TYPE_COIL:
+            return read_bits(device_id, MODBUS_FC_READ_COILS, start, count, bits, sampled_us);
+        case REGISTER_TYPE_DISCRETE:
+            return read_bits(device_id, MODBUS_FC_READ_DISCRETE_INPUTS, start, count, bits, sampled_us);
+        case REGISTER_TYPE_HOLDING:
+            return read_registers(device_id, MODBUS_FC_READ_HOLDING_REGISTERS, start, count, words, sampled_us);
+        case REGISTER_TYPE_INPUT:
+            return read_registers(device_id, MODBUS_FC_READ_INPUT_REGISTERS, start, count, words, sampled_us);
+        default:
+            return MODBUS_RESULT_INVALID_RESPONSE;
+    }
+}
+
+// Decode scratch for one block, grown to the largest block seen so far and
+// reused across cycles.
+static modbus_decode_item_t *poll_items = NULL;
+static modbus_value_t *poll_values = NULL;
+static uint32_t poll_scratch_capacity = 0;
+
+static bool poll_scratch_reserve(uint32_t count)
+{
+    if (count <= poll_scratch_capacity) {
+        return true;
+    }
+
+    modbus_decode_item_t *items = heap_caps_realloc(poll_items, count * sizeof(*items), MALLOC_CAP_8BIT);
+    if (items != NULL) {
+        poll_items = items;
+    }
+    modbus_value_t *values = heap_caps_realloc(poll_values, count * sizeof(*values), MALLOC_CAP_8BIT);
+    if (values != NULL) {
+        poll_values = values;
+    }
+    if (items == NULL || values == NULL) {
+        return false;
+    }
+
+    poll_scratch_capacity = count;
+    return true;
+}
+
+// Stores one block response into the device's published record. The plan
+// is held, so its register indices and value store stay valid without the
+// registry lock. Every point of the block carries the time its response
+// frame completed.
+static void apply_block(modbus_device_t *device, const modbus_poll_plan_t *plan,
+                        const modbus_plan_block_t *block, modbus_result_t result,
+                        const uint16_t *words, const uint8_t *bits, int64_t sampled_us)
+{
+    const modbus_plan_point_t *points = &plan->points[block->point_first];
+    const modbus_register_t *regs = device->registers;
+
+    record_poll_result(device, result, sampled_us);
+    if (result != MODBUS_RESULT_OK) {
+        for (uint32_t k = 0; k < block->point_count; k++) {
+            modbus_set_register_quality(device, points[k].register_index, MODBUS_QUALITY_BAD);
+        }
+        ESP_LOGW(TAG, "Failed to read %d point(s) of type %d at %d from device %d: %s",
+                  block->count, block->type, block->start, device->device_id,
+                  modbus_result_to_string(result));
+        return;
+    }
+
+    if (!poll_scratch_reserve(block->point_count)) {
+        ESP_LOGE(TAG, "Not enough memory to decode %" PRIu32 " point(s) of device %d",
+                  block->point_count, device->device_id);
+        return;
+    }
+
+    modbus_decode_item_t *items = poll_items;
+    modbus_value_t *values = poll_values;
+    bool bit_type = (block->type == REGISTER_TYPE_COIL || block->type == REGISTER_TYPE_DISCRETE);
+
+    if (bit_type) {
+        for (uint32_t k = 0; k < block->point_count; k++) {
+            values[k].u64 = bits[points[k].offset];
+        }
+    } else {
+        for (uint32_t k = 0; k < block->point_count; k++) {
+            const modbus_register_t *reg = &regs[points[k].register_index];
+            items[k].offset = points[k].offset;
+            items[k].data_type = reg->data_type;
+            items[k].word_order = reg->word_order;
+            items[k].length = reg->length;
+            items[k].bit_offset = reg->bit_offset;
+            items[k].bit_width = reg->bit_width;
+            items[k].text = NULL;
+        }
+        modbus_decode_block(words, items, block->point_count, values);
+    }
+
+    for (uint32_t k = 0; k < block->point_count; k++) {
+        char text[MODBUS_STRING_MAX_LEN + 1] = "";
+        if (!bit_type && items[k].data_type == MODBUS_DATA_STRING) {
+            items[k].text = text;
+            modbus_decode_block(words, &items[k], 1, &values[k]);
+        }
+        modbus_set_register_value(device, points[k].register_index, values[k], text, sampled_us);
+    }
+}
+
+// Runs one device's transactions from the plan. Neither the bus nor the
+// stores need the registry lock, so web and MQTT readers are never held up
+// by a slow or silent slave and edits never interrupt a read.
+// A device is online while any of its blocks answers and in error only
+// once a whole cycle failed, so one bad block does not make its status
+// (and the Sparkplug DBIRTH/DDEATH that follow it) flap within a cycle.
+static void poll_device(const modbus_poll_plan_t *plan, modbus_plan_device_t *entry)
+{
+    static uint8_t bits[MODBUS_MAX_READ_BITS];
+    static uint16_t words[MODBUS_MAX_READ_REGISTERS];
+    bool answered = false;
+    uint32_t b = 0;
+
+    for (; b < entry->block_count && polling_active; b++) {
+        const modbus_plan_block_t *block = &plan->blocks[entry->block_first + b];
+        int64_t sampled_us = 0;
+        modbus_result_t result = read_block(entry->device.device_id, block->type, block->start,
+                                            block->count, words, bits, &sampled_us);
+        apply_block(&entry->device, plan, block, result, words, bits, sampled_us);
+        answered |= result == MODBUS_RESULT_OK;
+
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    if (b == entry->block_count) {
+        entry->device.status = answered ? DEVICE_STATUS_ONLINE : DEVICE_STATUS_ERROR;
+    }
+}
+
 static void polling_task(void *pvParameters)
 {
     ESP_LOGI(TAG, "Modbus polling task started");
+    uint16_t next = 0;
 
+    // The plan is taken afresh for every device, so a committed edit is
+    // picked up at the next device and a superseded plan is let go quickly.
+    // When the device list changes, the walk simply continues at the same
+    // position of the new one.
     while (polling_active) {
-        uint8_t device_count = modbus_get_device_count();
-        if (device_count == 0) {
+        modbus_poll_plan_t *plan = modbus_poll_plan_acquire();
+        if (plan == NULL || plan->block_count == 0) {
+            modbus_poll_plan_release(plan);
+            next = 0;
             vTaskDelay(pdMS_TO_TICKS(1000));
             continue;
         }
 
-        vTaskDelay(pdMS_TO_TICKS(1));
-        uint8_t count;
-        modbus_device_t *devices = modbus_list_devices(&count);
-        if (devices != NULL) {
-            for (uint8_t i = 0; i < count && polling_active; i++) {
-                if (!devices[i].enabled) {
-                    continue;
-                }
-
-                for (uint8_t j = 0; j < devices[i].register_count && polling_active; j++) {
-                    uint16_t value;
-                    modbus_result_t result = MODBUS_RESULT_OK;
-
-                    switch (devices[i].registers[j].type) {
-                        case REGISTER_TYPE_HOLDING:
-                            result = modbus_read_holding_registers(devices[i].device_id,
-                                                                devices[i].registers[j].address, 1, &value);
-                            break;
-                        case REGISTER_TYPE_INPUT:
-                            result = modbus_read_input_registers(devices[i].device_id,
-                                                               devices[i].registers[j].address, 1, &value);
-                            break;
-                        case REGISTER_TYPE_COIL:
-                            {
-                                uint8_t coil_val;
-                                result = modbus_read_coils(devices[i].device_id,
-                                                          devices[i].registers[j].address, 1, &coil_val);
-                                value = coil_val;
-                            }
-                            break;
-                        case REGISTER_TYPE_DISCRETE:
-                            {
-                                uint8_t discrete_val;
-                                result = modbus_read_discrete_inputs(devices[i].device_id,
-                                                                devices[i].registers[j].address, 1, &discrete_val);
-                                value = discrete_val;
-                            }
-                            break;
-                    }
-
-                    devices[i].poll_count++;
-                    if (result == MODBUS_RESULT_OK) {
-                        modbus_update_register_value(devices[i].device_id,
-                                                   devices[i].registers[j].address, value);
-                        devices[i].last_seen = xTaskGetTickCount() * portTICK_PERIOD_MS;
-                        devices[i].status = DEVICE_STATUS_ONLINE;
-                    } else {
-                        devices[i].error_count++;
-                        devices[i].last_error = last_error;
-                        devices[i].status = DEVICE_STATUS_ERROR;
-                        ESP_LOGW(TAG, "Failed to read register %d from device %d: %s",
-                                  devices[i].registers[j].address, devices[i].device_id,
-                                  modbus_result_to_string(result));
-                    }
-
-                    vTaskDelay(pdMS_TO_TICKS(10));
-                }
-
-                if (devices[i].register_count > 0) {
-                    vTaskDelay(pdMS_TO_TICKS(devices[i].poll_interval_ms));
-                }
-            }
+        if (next >= plan->device_count) {
+            next = 0;
+            vTaskDelay(pdMS_TO_TICKS(1));
+        }
+        modbus_plan_device_t *entry = &plan->devices[next++];
+        uint32_t interval_ms = entry->device.poll_interval_ms;
+        bool polled = entry->block_count > 0;
+        if (polled) {
+            poll_device(plan, entry);
+        }
+        modbus_poll_plan_release(plan);
+
+        if (polled && interval_ms > 0) {
+            vTaskDelay(pdMS_TO_TICKS(interval_ms));
         }
     }
 
@@ -626,6 +848,8 @@ const char* modbus_result_to_string(modbus_result_t result)
         case MODBUS_RESULT_INVALID_RESPONSE: return "Invalid Response";
         case MODBUS_RESULT_UART_ERROR: return "UART Error";
         case MODBUS_RESULT_NOT_INITIALIZED: return "Not Initialized";
+        case MODBUS_RESULT_QUEUE_FULL: return "Queue Full";
+        case MODBUS_RESULT_INVALID_REGISTER: return "Invalid Register";
         default: return "Unknown";
     }
 }
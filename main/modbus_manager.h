@@ -22,7 +22,9 @@ typedef enum {
     MODBUS_RESULT_EXCEPTION,
     MODBUS_RESULT_INVALID_RESPONSE,
     MODBUS_RESULT_UART_ERROR,
-    MODBUS_RESULT_NOT_INITIALIZED
+    MODBUS_RESULT_NOT_INITIALIZED,
+    MODBUS_RESULT_QUEUE_FULL,
+    MODBUS_RESULT_INVALID_REGISTER
 } modbus_result_t;
 
 typedef struct {
@@ -58,6 +60,13 @@ modbus_result_t modbus_write_single_coil(uint8_t device_id, uint16_t address,
                                         bool value);
 modbus_result_t modbus_write_multiple_coils(uint8_t device_id, uint16_t address,
                                           uint8_t *values, uint16_t count);
+modbus_result_t modbus_read_write_multiple_registers(uint8_t device_id,
+                                                  uint16_t read_address, uint16_t read_count,
+                                                  uint16_t *read_values,
+                                                  uint16_t write_address,
+                                                  const uint16_t *write_values, uint16_t write_count);
+modbus_result_t modbus_write_register_verified(uint8_t device_id, uint16_t address,
+                                             uint16_t value, uint16_t *confirmed);
 
 esp_err_t modbus_manager_start_polling(void);
 esp_err_t modbus_manager_stop_polling(void);
@@ -0,0 +1,215 @@
+#include "modbus_poll_plan.h"
+#include "modbus_protocol.h"
+#include "modbus_pool.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "MODBUS_PLAN";
+
+#define POLL_BIT_GAP_MAX 64
+#define POLL_REGISTER_GAP_MAX 8
+
+// Guards the active pointer and every plan's reference count. Held only
+// for a pointer swap or a counter update.
+static portMUX_TYPE plan_mux = portMUX_INITIALIZER_UNLOCKED;
+static modbus_poll_plan_t *active_plan = NULL;
+// Head of the publish-order chain of plans not yet freed; only touched
+// under the registry lock.
+static modbus_poll_plan_t *oldest_plan = NULL;
+
+// qsort has no context argument; compiling runs under the registry lock,
+// so a file-scope pointer is safe.
+static const modbus_register_t *sort_registers = NULL;
+
+static int compare_points(const void *a, const void *b)
+{
+    uint16_t addr_a = sort_registers[((const modbus_plan_point_t *)a)->register_index].address;
+    uint16_t addr_b = sort_registers[((const modbus_plan_point_t *)b)->register_index].address;
+    return (addr_a > addr_b) - (addr_a < addr_b);
+}
+
+// Sorts the points of one register type by address and merges them into
+// blocks up to the protocol limit. Only devices flagged read_gaps are read
+// through small unused gaps of registers or bits; others get one block per
+// contiguous run. A multi-register point is never split across blocks, so
+// its words always come from the same response.
+static void plan_register_type(modbus_poll_plan_t *plan, const modbus_device_t *device,
+                               register_type_t type)
+{
+    const modbus_register_t *regs = device->registers;
+    modbus_plan_point_t *points = &plan->points[plan->point_count];
+    bool bit_type = (type == REGISTER_TYPE_COIL || type == REGISTER_TYPE_DISCRETE);
+    uint16_t max_count = bit_type ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS;
+    uint16_t max_gap = !device->read_gaps ? 0 : bit_type ? POLL_BIT_GAP_MAX : POLL_REGISTER_GAP_MAX;
+    uint32_t n = 0;
+
+    for (uint16_t j = 0; j < device->register_count; j++) {
+        if (regs[j].type == type) {
+            points[n++].register_index = j;
+        }
+    }
+    sort_registers = regs;
+    qsort(points, n, sizeof(*points), compare_points);
+
+    uint32_t i = 0;
+    while (i < n) {
+        uint32_t start = regs[points[i].register_index].address;
+        uint32_t end = start + modbus_register_span(&regs[points[i].register_index]);
+        uint32_t last = i;
+        while (last + 1 < n) {
+            const modbus_register_t *next = &regs[points[last + 1].register_index];
+            uint32_t next_end = next->address + modbus_register_span(next);
+            if (next->address > end + max_gap ||
+                (next_end > end ? next_end : end) - start > max_count) {
+                break;
+            }
+            if (next_end > end) {
+                end = next_end;
+            }
+            last++;
+        }
+
+        modbus_plan_block_t *block = &plan->blocks[plan->block_count++];
+        block->type = type;
+        block->start = start;
+        block->count = end - start;
+        block->point_first = plan->point_count + i;
+        block->point_count = last - i + 1;
+        for (uint32_t k = i; k <= last; k++) {
+            points[k].offset = regs[points[k].register_index].address - start;
+        }
+        i = last + 1;
+    }
+
+    plan->point_count += n;
+}
+
+modbus_poll_plan_t *modbus_poll_plan_create(uint32_t generation, uint16_t device_count,
+                                            uint32_t point_count, uint16_t retired_max)
+{
+    // Blocks never outnumber points, so one allocation sized for the worst
+    // case holds the whole plan.
+    size_t bytes = sizeof(modbus_poll_plan_t) + device_count * sizeof(modbus_plan_device_t) +
+                   point_count * (sizeof(modbus_plan_block_t) + sizeof(modbus_plan_point_t)) +
+                   retired_max * sizeof(modbus_plan_retired_t);
+    if (!modbus_heap_can_allocate(bytes)) {
+        ESP_LOGE(TAG, "Not enough memory to compile a poll plan for %" PRIu32 " point(s)", point_count);
+        return NULL;
+    }
+
+    modbus_poll_plan_t *plan = heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+    if (plan == NULL) {
+        return NULL;
+    }
+
+    memset(plan, 0, sizeof(*plan));
+    plan->generation = generation;
+    plan->refs = 1;
+    plan->devices = (modbus_plan_device_t *)(plan + 1);
+    plan->retired = (modbus_plan_retired_t *)(plan->devices + device_count);
+    plan->blocks = (modbus_plan_block_t *)(plan->retired + retired_max);
+    plan->points = (modbus_plan_point_t *)(plan->blocks + point_count);
+    return plan;
+}
+
+modbus_device_t *modbus_poll_plan_add_device(modbus_poll_plan_t *plan, const modbus_device_t *device)
+{
+    modbus_plan_device_t *entry = &plan->devices[plan->device_count++];
+    entry->device = *device;
+    plan->device_slot[device->device_id] = plan->device_count;
+
+    // Disabled devices are published for readers but get no blocks.
+    entry->block_first = plan->block_count;
+    if (device->enabled) {
+        plan_register_type(plan, device, REGISTER_TYPE_COIL);
+        plan_register_type(plan, device, REGISTER_TYPE_DISCRETE);
+        plan_register_type(plan, device, REGISTER_TYPE_HOLDING);
+        plan_register_type(plan, device, REGISTER_TYPE_INPUT);
+    }
+    entry->block_count = plan->block_count - entry->block_first;
+    return &entry->device;
+}
+
+void modbus_poll_plan_publish(modbus_poll_plan_t *plan)
+{
+    portENTER_CRITICAL(&plan_mux);
+    modbus_poll_plan_t *old = active_plan;
+    active_plan = plan;
+    portEXIT_CRITICAL(&plan_mux);
+
+    if (old != NULL) {
+        old->newer = plan;
+    } else {
+        oldest_plan = plan;
+    }
+    modbus_poll_plan_release(old);
+
+    ESP_LOGD(TAG, "Published plan %" PRIu32 ": %d device(s), %" PRIu32 " block(s), %" PRIu32 " point(s)",
+              plan->generation, plan->device_count, plan->block_count, plan->point_count);
+}
+
+void modbus_poll_plan_discard(modbus_poll_plan_t *plan)
+{
+    heap_caps_free(plan);
+}
+
+modbus_poll_plan_t *modbus_poll_plan_acquire(void)
+{
+    portENTER_CRITICAL(&plan_mux);
+    modbus_poll_plan_t *plan = active_plan;
+    if (plan != NULL) {
+        plan->refs++;
+    }
+    portEXIT_CRITICAL(&plan_mux);
+    return plan;
+}
+
+// The active plan holds one reference of its own, so a count of zero
+// means superseded and unused. Freeing waits for modbus_poll_plan_reclaim().
+void modbus_poll_plan_release(modbus_poll_plan_t *plan)
+{
+    if (plan == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&plan_mux);
+    plan->refs--;
+    portEXIT_CRITICAL(&plan_mux);
+}
+
+modbus_device_t *modbus_poll_plan_find_device(modbus_poll_plan_t *plan, uint8_t device_id)
+{
+    if (device_id > MODBUS_MAX_DEVICES || plan->device_slot[device_id] == 0) {
+        return NULL;
+    }
+    return &plan->devices[plan->device_slot[device_id] - 1].device;
+}
+
+// A plan's retired tables may still be read through any older plan, so
+// they go when the plan just before it does. Plans are freed strictly in
+// publish order, and a held plan keeps every newer one alive.
+bool modbus_poll_plan_reclaim(void (*release)(const modbus_plan_retired_t *retired))
+{
+    while (true) {
+        portENTER_CRITICAL(&plan_mux);
+        modbus_poll_plan_t *plan = oldest_plan;
+        bool held = plan != NULL && plan != active_plan && plan->refs > 0;
+        bool done = plan == NULL || plan == active_plan || held;
+        portEXIT_CRITICAL(&plan_mux);
+        if (done) {
+            return held;
+        }
+
+        modbus_poll_plan_t *next = plan->newer;
+        for (uint16_t i = 0; i < next->retired_count; i++) {
+            release(&next->retired[i]);
+        }
+        next->retired_count = 0;
+        oldest_plan = next;
+        heap_caps_free(plan);
+    }
+}
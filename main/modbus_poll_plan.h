@@ -0,0 +1,85 @@
+#ifndef MODBUS_POLL_PLAN_H
+#define MODBUS_POLL_PLAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "modbus_devices.h"
+
+// Published form of one device: a copy of its registry record whose
+// register table, point index and value store stay valid and unchanged for
+// as long as the plan is held, plus the blocks to poll. The poll task
+// writes the status fields and the values; everything else is read-only.
+typedef struct {
+    modbus_device_t device;
+    uint32_t block_first;
+    uint32_t block_count;
+} modbus_plan_device_t;
+
+typedef struct {
+    register_type_t type;
+    uint16_t start;
+    uint16_t count;
+    uint32_t point_first;
+    uint32_t point_count;
+} modbus_plan_block_t;
+
+typedef struct {
+    uint16_t register_index;
+    uint16_t offset;
+} modbus_plan_point_t;
+
+// Tables an older plan used that this one no longer does. NULL members
+// were carried over.
+typedef struct {
+    modbus_register_t *registers;
+    uint16_t register_count;
+    uint16_t register_capacity;
+    uint16_t *point_index;
+    modbus_value_store_t *values;
+} modbus_plan_retired_t;
+
+// Immutable snapshot of one registry generation: every device with its
+// published tables and value store, the block transactions to poll it
+// with, and which register index every word of a response belongs to.
+// Readers acquire it without the registry lock. Edits work on copies and
+// publish a replacement in one pointer swap; a superseded plan and the
+// tables it retired are freed once nobody holds it or any older plan.
+typedef struct modbus_poll_plan {
+    uint32_t generation;
+    uint32_t refs;
+    uint16_t device_count;
+    uint32_t block_count;
+    uint32_t point_count;
+    uint16_t retired_count;
+    modbus_plan_device_t *devices;
+    modbus_plan_block_t *blocks;
+    modbus_plan_point_t *points;
+    modbus_plan_retired_t *retired;
+    struct modbus_poll_plan *newer;
+    // Index into devices + 1 by device ID; 0 if absent.
+    uint8_t device_slot[MODBUS_MAX_DEVICES + 1];
+} modbus_poll_plan_t;
+
+// Building a plan runs under the registry lock: create sizes it for the
+// given totals, add_device copies a record and compiles its blocks, and
+// publish swaps it in, which cannot fail. An unpublished plan is dropped
+// with discard. create returns NULL when out of memory.
+modbus_poll_plan_t *modbus_poll_plan_create(uint32_t generation, uint16_t device_count,
+                                            uint32_t point_count, uint16_t retired_max);
+modbus_device_t *modbus_poll_plan_add_device(modbus_poll_plan_t *plan, const modbus_device_t *device);
+void modbus_poll_plan_publish(modbus_poll_plan_t *plan);
+void modbus_poll_plan_discard(modbus_poll_plan_t *plan);
+
+// Returns the active plan with a reference held, or NULL before the first
+// publish. Never blocks on the registry lock.
+modbus_poll_plan_t *modbus_poll_plan_acquire(void);
+void modbus_poll_plan_release(modbus_poll_plan_t *plan);
+modbus_device_t *modbus_poll_plan_find_device(modbus_poll_plan_t *plan, uint8_t device_id);
+
+// Frees superseded plans nobody holds any more, oldest first, passing the
+// tables each one's successor retired to `release`. Registry lock held.
+// Returns true while superseded plans are still held.
+bool modbus_poll_plan_reclaim(void (*release)(const modbus_plan_retired_t *retired));
+
+#endif
@@ -0,0 +1,109 @@
+#include "modbus_pool.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "MODBUS_POOL";
+
+// Chunk header is padded so items keep 8-byte alignment.
+#define CHUNK_HEADER_SIZE ((sizeof(modbus_pool_chunk_t) + 7) & ~(size_t)7)
+
+static size_t pool_slot_size(const modbus_pool_t *pool)
+{
+    return (pool->item_size + 7) & ~(size_t)7;
+}
+
+static size_t pool_chunk_size(const modbus_pool_t *pool)
+{
+    return CHUNK_HEADER_SIZE + pool_slot_size(pool) * pool->items_per_chunk;
+}
+
+bool modbus_heap_can_allocate(size_t bytes)
+{
+    return heap_caps_get_free_size(MALLOC_CAP_8BIT) >= bytes + MODBUS_HEAP_RESERVE_BYTES;
+}
+
+void modbus_pool_init(modbus_pool_t *pool, const char *name, size_t item_size, uint16_t items_per_chunk)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->name = name;
+    pool->item_size = item_size < sizeof(void *) ? sizeof(void *) : item_size;
+    pool->items_per_chunk = items_per_chunk;
+}
+
+static bool pool_grow(modbus_pool_t *pool)
+{
+    size_t size = pool_chunk_size(pool);
+    if (!modbus_heap_can_allocate(size)) {
+        ESP_LOGW(TAG, "%s: not enough heap for another %d item chunk", pool->name, pool->items_per_chunk);
+        return false;
+    }
+
+    modbus_pool_chunk_t *chunk = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    if (chunk == NULL) {
+        return false;
+    }
+
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+    pool->chunk_count++;
+
+    uint8_t *slot = (uint8_t *)chunk + CHUNK_HEADER_SIZE;
+    for (uint16_t i = 0; i < pool->items_per_chunk; i++) {
+        *(void **)slot = pool->free_list;
+        pool->free_list = slot;
+        slot += pool_slot_size(pool);
+    }
+    return true;
+}
+
+void *modbus_pool_alloc(modbus_pool_t *pool)
+{
+    if (pool->free_list == NULL && !pool_grow(pool)) {
+        return NULL;
+    }
+
+    void *item = pool->free_list;
+    pool->free_list = *(void **)item;
+    memset(item, 0, pool->item_size);
+
+    pool->items_in_use++;
+    if (pool->items_in_use > pool->peak_in_use) {
+        pool->peak_in_use = pool->items_in_use;
+    }
+    return item;
+}
+
+void modbus_pool_free(modbus_pool_t *pool, void *item)
+{
+    if (item == NULL) {
+        return;
+    }
+    *(void **)item = pool->free_list;
+    pool->free_list = item;
+    pool->items_in_use--;
+}
+
+void modbus_pool_reset(modbus_pool_t *pool)
+{
+    modbus_pool_chunk_t *chunk = pool->chunks;
+    while (chunk != NULL) {
+        modbus_pool_chunk_t *next = chunk->next;
+        heap_caps_free(chunk);
+        chunk = next;
+    }
+    pool->chunks = NULL;
+    pool->free_list = NULL;
+    pool->chunk_count = 0;
+    pool->items_in_use = 0;
+}
+
+void modbus_pool_get_stats(const modbus_pool_t *pool, modbus_pool_stats_t *stats)
+{
+    stats->name = pool->name;
+    stats->items_in_use = pool->items_in_use;
+    stats->items_capacity = pool->chunk_count * pool->items_per_chunk;
+    stats->peak_in_use = pool->peak_in_use;
+    stats->bytes_reserved = pool->chunk_count * pool_chunk_size(pool);
+    stats->bytes_in_use = pool->items_in_use * pool_slot_size(pool);
+}
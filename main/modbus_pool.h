@@ -0,0 +1,47 @@
+#ifndef MODBUS_POOL_H
+#define MODBUS_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Heap kept free for WiFi, MQTT and the HTTP server. Registry growth that
+// would dip below this fails with ESP_ERR_NO_MEM instead.
+#define MODBUS_HEAP_RESERVE_BYTES (48 * 1024)
+
+typedef struct modbus_pool_chunk {
+    struct modbus_pool_chunk *next;
+} modbus_pool_chunk_t;
+
+// Fixed-size object pool. Items are carved out of chunks allocated on
+// demand and recycled through a free list, so records never move and
+// freeing one does not fragment the heap.
+typedef struct {
+    const char *name;
+    size_t item_size;
+    uint16_t items_per_chunk;
+    modbus_pool_chunk_t *chunks;
+    void *free_list;
+    uint32_t chunk_count;
+    uint32_t items_in_use;
+    uint32_t peak_in_use;
+} modbus_pool_t;
+
+typedef struct {
+    const char *name;
+    uint32_t items_in_use;
+    uint32_t items_capacity;
+    uint32_t peak_in_use;
+    size_t bytes_reserved;
+    size_t bytes_in_use;
+} modbus_pool_stats_t;
+
+void modbus_pool_init(modbus_pool_t *pool, const char *name, size_t item_size, uint16_t items_per_chunk);
+void *modbus_pool_alloc(modbus_pool_t *pool);
+void modbus_pool_free(modbus_pool_t *pool, void *item);
+void modbus_pool_reset(modbus_pool_t *pool);
+void modbus_pool_get_stats(const modbus_pool_t *pool, modbus_pool_stats_t *stats);
+
+bool modbus_heap_can_allocate(size_t bytes);
+
+#endif
@@ -0,0 +1,15 @@
+#include "modbus_profiles.h"
+#include <string.h>
+
+const modbus_profile_t *modbus_profile_find(const char *id)
+{
+    if (id == NULL) {
+        return NULL;
+    }
+    for (uint16_t i = 0; i < modbus_profile_count; i++) {
+        if (strcmp(modbus_profiles[i].id, id) == 0) {
+            return &modbus_profiles[i];
+        }
+    }
+    return NULL;
+}
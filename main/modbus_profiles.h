@@ -0,0 +1,29 @@
+#ifndef MODBUS_PROFILES_H
+#define MODBUS_PROFILES_H
+
+#include <stdint.h>
+#include "modbus_devices.h"
+
+#define MODBUS_PROFILE_ID_MAX_LEN 24
+
+// Register map of one device model, generated at build time from
+// docs/devices/profiles/*.json by tools/gen_profiles.py. Everything here
+// lives in flash: the registers, their point index (laid out like the one
+// rebuild_point_index() builds) and the text area layout, so a device
+// using a profile only allocates its value store.
+typedef struct modbus_profile {
+    const char *id;
+    const char *name;
+    const modbus_register_t *registers;
+    uint16_t register_count;
+    const uint16_t *point_index;
+    uint16_t point_index_mask;
+    uint16_t text_bytes;
+} modbus_profile_t;
+
+extern const modbus_profile_t modbus_profiles[];
+extern const uint16_t modbus_profile_count;
+
+const modbus_profile_t *modbus_profile_find(const char *id);
+
+#endif
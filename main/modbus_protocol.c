@@ -4,6 +4,22 @@
 
 static const char *TAG = "MODBUS_PROTOCOL";
 
+// Each packed coil byte expands to eight 0/1 bytes, LSB first. Both ESP32
+// targets are little-endian, so entry n stored as a uint64_t is exactly the
+// eight output bytes for input byte n.
+#define BIT_SPREAD(b) ( \
+    ((uint64_t)(((b) >> 0) & 1) << 0)  | ((uint64_t)(((b) >> 1) & 1) << 8)  | \
+    ((uint64_t)(((b) >> 2) & 1) << 16) | ((uint64_t)(((b) >> 3) & 1) << 24) | \
+    ((uint64_t)(((b) >> 4) & 1) << 32) | ((uint64_t)(((b) >> 5) & 1) << 40) | \
+    ((uint64_t)(((b) >> 6) & 1) << 48) | ((uint64_t)(((b) >> 7) & 1) << 56))
+#define BIT_SPREAD4(n) BIT_SPREAD(n), BIT_SPREAD(n + 1), BIT_SPREAD(n + 2), BIT_SPREAD(n + 3)
+#define BIT_SPREAD16(n) BIT_SPREAD4(n), BIT_SPREAD4(n + 4), BIT_SPREAD4(n + 8), BIT_SPREAD4(n + 12)
+#define BIT_SPREAD64(n) BIT_SPREAD16(n), BIT_SPREAD16(n + 16), BIT_SPREAD16(n + 32), BIT_SPREAD16(n + 48)
+
+static const uint64_t bit_unpack_lut[256] = {
+    BIT_SPREAD64(0), BIT_SPREAD64(64), BIT_SPREAD64(128), BIT_SPREAD64(192)
+};
+
 uint16_t modbus_calculate_crc(const uint8_t *data, uint16_t length)
 {
     uint16_t crc = 0xFFFF;
@@ -50,6 +66,10 @@ esp_err_t modbus_build_request(uint8_t device_id, uint8_t function,
     frame[index++] = function;
 
     if (function == MODBUS_FC_WRITE_SINGLE_COIL || function == MODBUS_FC_WRITE_SINGLE_REGISTER) {
+        if (data == NULL || data_len < 1) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
         frame[index++] = (address >> 8) & 0xFF;
         frame[index++] = address & 0xFF;
 
@@ -57,9 +77,35 @@ esp_err_t modbus_build_request(uint8_t device_id, uint8_t function,
             frame[index++] = data[0] ? 0xFF : 0x00;
             frame[index++] = 0x00;
         } else {
-            frame[index++] = (data[0] >> 8) & 0xFF;
-            frame[index++] = data[0] & 0xFF;
+            if (data_len < 2) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            frame[index++] = data[0];
+            frame[index++] = data[1];
+        }
+    } else if (function == MODBUS_FC_READ_WRITE_MULTIPLE_REGISTERS) {
+        if (data == NULL || data_len < 6 || ((data_len - 4) & 0x01) ||
+            data_len - 4 > MODBUS_MAX_RW_WRITE_REGISTERS * 2) {
+            return ESP_ERR_INVALID_ARG;
         }
+
+        uint16_t write_quantity = (data[2] << 8) | data[3];
+        if (write_quantity * 2 != data_len - 4 || quantity == 0 ||
+            quantity > MODBUS_MAX_READ_REGISTERS) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        frame[index++] = (address >> 8) & 0xFF;
+        frame[index++] = address & 0xFF;
+        frame[index++] = (quantity >> 8) & 0xFF;
+        frame[index++] = quantity & 0xFF;
+        frame[index++] = data[0];
+        frame[index++] = data[1];
+        frame[index++] = data[2];
+        frame[index++] = data[3];
+        frame[index++] = data_len - 4;
+        memcpy(&frame[index], &data[4], data_len - 4);
+        index += data_len - 4;
     } else {
         frame[index++] = (address >> 8) & 0xFF;
         frame[index++] = address & 0xFF;
@@ -67,17 +113,11 @@ esp_err_t modbus_build_request(uint8_t device_id, uint8_t function,
         frame[index++] = quantity & 0xFF;
 
         if (data != NULL && data_len > 0) {
-            if (function == MODBUS_FC_WRITE_MULTIPLE_REGISTERS) {
-                frame[index++] = data_len * 2;
-                for (uint16_t i = 0; i < data_len; i++) {
-                    frame[index++] = (data[i] >> 8) & 0xFF;
-                    frame[index++] = data[i] & 0xFF;
-                }
-            } else if (function == MODBUS_FC_WRITE_MULTIPLE_COILS) {
+            if (function == MODBUS_FC_WRITE_MULTIPLE_REGISTERS ||
+                function == MODBUS_FC_WRITE_MULTIPLE_COILS) {
                 frame[index++] = data_len;
-                for (uint16_t i = 0; i < data_len; i++) {
-                    frame[index++] = data[i];
-                }
+                memcpy(&frame[index], data, data_len);
+                index += data_len;
             }
         }
     }
@@ -132,6 +172,7 @@ esp_err_t modbus_parse_response(const uint8_t *frame, uint16_t frame_len,
             
         case MODBUS_FC_READ_HOLDING_REGISTERS:
         case MODBUS_FC_READ_INPUT_REGISTERS:
+        case MODBUS_FC_READ_WRITE_MULTIPLE_REGISTERS:
             if (frame_len < 3) return ESP_ERR_INVALID_ARG;
             response->byte_count = frame[2];
             if (response->byte_count > MODBUS_MAX_DATA_LEN) {
@@ -187,6 +228,51 @@ esp_err_t modbus_build_exception_response(uint8_t device_id, uint8_t function,
     return ESP_OK;
 }
 
+uint16_t modbus_response_length(uint8_t function, uint16_t quantity)
+{
+    switch (function) {
+        case MODBUS_FC_READ_COILS:
+        case MODBUS_FC_READ_DISCRETE_INPUTS:
+            return 5 + (quantity + 7) / 8;
+        case MODBUS_FC_READ_HOLDING_REGISTERS:
+        case MODBUS_FC_READ_INPUT_REGISTERS:
+        case MODBUS_FC_READ_WRITE_MULTIPLE_REGISTERS:
+            return 5 + quantity * 2;
+        case MODBUS_FC_WRITE_SINGLE_COIL:
+        case MODBUS_FC_WRITE_SINGLE_REGISTER:
+        case MODBUS_FC_WRITE_MULTIPLE_COILS:
+        case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+void modbus_unpack_bits(const uint8_t *packed, uint16_t count, uint8_t *values)
+{
+    uint16_t full_bytes = count / 8;
+
+    for (uint16_t i = 0; i < full_bytes; i++) {
+        memcpy(&values[i * 8], &bit_unpack_lut[packed[i]], 8);
+    }
+
+    uint16_t tail = count & 0x07;
+    if (tail > 0) {
+        uint64_t spread = bit_unpack_lut[packed[full_bytes]];
+        memcpy(&values[full_bytes * 8], &spread, tail);
+    }
+}
+
+void modbus_pack_bits(const uint8_t *values, uint16_t count, uint8_t *packed)
+{
+    memset(packed, 0, (count + 7) / 8);
+    for (uint16_t i = 0; i < count; i++) {
+        if (values[i]) {
+            packed[i >> 3] |= 1 << (i & 0x07);
+        }
+    }
+}
+
 const char* modbus_exception_to_string(uint8_t exception_code)
 {
     switch (exception_code) {
@@ -232,6 +318,8 @@ const char* modbus_function_to_string(uint8_t function_code)
             return "Write Multiple Coils";
         case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
             return "Write Multiple Registers";
+        case MODBUS_FC_READ_WRITE_MULTIPLE_REGISTERS:
+            return "Read/Write Multiple Registers";
         default:
             return "Unknown function";
     }
@@ -5,8 +5,10 @@
 #include <stdbool.h>
 #include "esp_err.h"
 
-#define MODBUS_MAX_DATA_LEN 128
+#define MODBUS_MAX_DATA_LEN 250
 #define MODBUS_MAX_FRAME_LEN 256
+// Address, function code with bit 7 set, exception code and CRC.
+#define MODBUS_EXCEPTION_FRAME_LEN 5
 
 typedef enum {
     MODBUS_FC_READ_COILS = 0x01,
@@ -16,9 +18,16 @@ typedef enum {
     MODBUS_FC_WRITE_SINGLE_COIL = 0x05,
     MODBUS_FC_WRITE_SINGLE_REGISTER = 0x06,
     MODBUS_FC_WRITE_MULTIPLE_COILS = 0x0F,
-    MODBUS_FC_WRITE_MULTIPLE_REGISTERS = 0x10
+    MODBUS_FC_WRITE_MULTIPLE_REGISTERS = 0x10,
+    MODBUS_FC_READ_WRITE_MULTIPLE_REGISTERS = 0x17
 } modbus_function_code_t;
 
+#define MODBUS_MAX_READ_BITS 2000
+#define MODBUS_MAX_WRITE_BITS 1968
+#define MODBUS_MAX_READ_REGISTERS 125
+#define MODBUS_MAX_WRITE_REGISTERS 123
+#define MODBUS_MAX_RW_WRITE_REGISTERS 121
+
 typedef enum {
     MODBUS_EXCEPTION_ILLEGAL_FUNCTION = 0x01,
     MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS = 0x02,
@@ -60,6 +69,10 @@ typedef struct {
 uint16_t modbus_calculate_crc(const uint8_t *data, uint16_t length);
 bool modbus_validate_crc(const uint8_t *data, uint16_t length);
 
+// Register payloads in `data` are big-endian bytes as they appear on the wire.
+// For FC 0x17 `address`/`quantity` describe the read range and `data` starts
+// with the write address and write quantity (2 bytes each) followed by the
+// register values; `data_len` counts all of it.
 esp_err_t modbus_build_request(uint8_t device_id, uint8_t function, 
                               uint16_t address, uint16_t quantity,
                               const uint8_t *data, uint16_t data_len,
@@ -72,6 +85,13 @@ esp_err_t modbus_build_exception_response(uint8_t device_id, uint8_t function,
                                         uint8_t exception_code,
                                         uint8_t *frame, uint16_t *frame_len);
 
+// Length of a normal (non-exception) response frame to a request, CRC
+// included, or 0 if the function code is unknown.
+uint16_t modbus_response_length(uint8_t function, uint16_t quantity);
+
+void modbus_unpack_bits(const uint8_t *packed, uint16_t count, uint8_t *values);
+void modbus_pack_bits(const uint8_t *values, uint16_t count, uint8_t *packed);
+
 const char* modbus_exception_to_string(uint8_t exception_code);
 const char* modbus_function_to_string(uint8_t function_code);
 
@@ -0,0 +1,148 @@
+#include "modbus_strings.h"
+#include "modbus_pool.h"
+#include "esp_heap_caps.h"
+#include <string.h>
+
+#define STRING_BUCKETS_MIN 64
+
+typedef struct interned {
+    struct interned *next;
+    uint32_t hash;
+    uint32_t refs;
+    uint16_t len;
+    char text[];
+} interned_t;
+
+static interned_t **buckets = NULL;
+static uint32_t bucket_count = 0;
+static uint32_t string_count = 0;
+static size_t string_bytes = 0;
+
+static uint32_t str_hash(const char *str, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)str[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Finds the entry owning `str` by address, so pointers that merely hold
+// the same text (flash literals) are not mistaken for interned ones.
+static interned_t **find_owner(const char *str)
+{
+    if (buckets == NULL || str == NULL || str[0] == '\0') {
+        return NULL;
+    }
+    size_t len = strnlen(str, MODBUS_STR_MAX_LEN);
+    interned_t **link = &buckets[str_hash(str, len) & (bucket_count - 1)];
+    for (; *link != NULL; link = &(*link)->next) {
+        if ((*link)->text == str) {
+            return link;
+        }
+    }
+    return NULL;
+}
+
+// Keeps chains short by doubling the table once it averages one entry per
+// bucket. A failed grow is harmless; lookups just walk longer chains.
+static void grow_buckets(void)
+{
+    uint32_t count = bucket_count ? bucket_count * 2 : STRING_BUCKETS_MIN;
+    size_t bytes = count * sizeof(interned_t *);
+    if (!modbus_heap_can_allocate(bytes)) {
+        return;
+    }
+    interned_t **table = heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+    if (table == NULL) {
+        return;
+    }
+
+    memset(table, 0, bytes);
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        interned_t *entry = buckets[i];
+        while (entry != NULL) {
+            interned_t *next = entry->next;
+            uint32_t slot = entry->hash & (count - 1);
+            entry->next = table[slot];
+            table[slot] = entry;
+            entry = next;
+        }
+    }
+    heap_caps_free(buckets);
+    string_bytes += (count - bucket_count) * sizeof(interned_t *);
+    buckets = table;
+    bucket_count = count;
+}
+
+const char *modbus_str_intern(const char *str)
+{
+    if (str == NULL || str[0] == '\0') {
+        return "";
+    }
+
+    size_t len = strnlen(str, MODBUS_STR_MAX_LEN);
+    uint32_t hash = str_hash(str, len);
+    if (buckets != NULL) {
+        for (interned_t *entry = buckets[hash & (bucket_count - 1)]; entry != NULL; entry = entry->next) {
+            if (entry->hash == hash && entry->len == len && memcmp(entry->text, str, len) == 0) {
+                entry->refs++;
+                return entry->text;
+            }
+        }
+    }
+
+    if (string_count >= bucket_count) {
+        grow_buckets();
+        if (buckets == NULL) {
+            return NULL;
+        }
+    }
+
+    size_t bytes = sizeof(interned_t) + len + 1;
+    if (!modbus_heap_can_allocate(bytes)) {
+        return NULL;
+    }
+    interned_t *entry = heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    entry->hash = hash;
+    entry->refs = 1;
+    entry->len = len;
+    memcpy(entry->text, str, len);
+    entry->text[len] = '\0';
+    entry->next = buckets[hash & (bucket_count - 1)];
+    buckets[hash & (bucket_count - 1)] = entry;
+    string_count++;
+    string_bytes += bytes;
+    return entry->text;
+}
+
+void modbus_str_retain(const char *str)
+{
+    interned_t **link = find_owner(str);
+    if (link != NULL) {
+        (*link)->refs++;
+    }
+}
+
+void modbus_str_release(const char *str)
+{
+    interned_t **link = find_owner(str);
+    if (link == NULL || --(*link)->refs > 0) {
+        return;
+    }
+
+    interned_t *entry = *link;
+    *link = entry->next;
+    string_count--;
+    string_bytes -= sizeof(interned_t) + entry->len + 1;
+    heap_caps_free(entry);
+}
+
+size_t modbus_str_bytes(void)
+{
+    return string_bytes;
+}
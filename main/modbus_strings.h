@@ -0,0 +1,27 @@
+#ifndef MODBUS_STRINGS_H
+#define MODBUS_STRINGS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest string the table keeps; longer input is truncated.
+#define MODBUS_STR_MAX_LEN 255
+
+// Interned, reference-counted strings for register metadata. Equal strings
+// share one heap copy, so a unit like "V" is stored once however many
+// points use it, and the empty string costs nothing. A returned pointer
+// stays valid until its last reference is released. Strings that were
+// never interned, such as the literals in flash profiles, may be passed to
+// retain and release and are left alone.
+//
+// Not thread-safe on its own: callers hold the registry lock.
+
+// Returns the shared copy of `str` with one reference taken, "" for NULL
+// or empty input, or NULL when out of memory.
+const char *modbus_str_intern(const char *str);
+void modbus_str_retain(const char *str);
+void modbus_str_release(const char *str);
+
+size_t modbus_str_bytes(void);
+
+#endif
@@ -0,0 +1,184 @@
+#include "modbus_value_store.h"
+#include "modbus_pool.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include <string.h>
+#include <sys/time.h>
+
+// 2020-01-01T00:00:00Z; an earlier system time means the clock was never set.
+#define WALL_CLOCK_VALID_AFTER 1577836800
+
+// Serializes writers across both cores. Write sections only copy a few
+// words, so a single spinlock for every store is enough.
+static portMUX_TYPE value_store_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t last_layout_id = 0;
+
+static size_t store_header_size(void)
+{
+    return (sizeof(modbus_value_store_t) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+static size_t store_block_size(uint16_t count, uint16_t text_bytes)
+{
+    return store_header_size() +
+           (size_t)count * (2 * sizeof(uint64_t) + sizeof(int64_t) + 3 * sizeof(uint32_t) + sizeof(uint8_t)) +
+           text_bytes;
+}
+
+modbus_value_store_t *modbus_value_store_create(uint16_t count, uint16_t text_bytes)
+{
+    size_t bytes = store_block_size(count, text_bytes);
+    if (!modbus_heap_can_allocate(bytes)) {
+        return NULL;
+    }
+
+    uint8_t *block = heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+    if (block == NULL) {
+        return NULL;
+    }
+    memset(block, 0, bytes);
+
+    // Widest arrays first so every array stays naturally aligned.
+    modbus_value_store_t *store = (modbus_value_store_t *)block;
+    store->raw = (uint64_t *)(block + store_header_size());
+    store->timestamp_us = (int64_t *)(store->raw + count);
+    store->published_raw = (uint64_t *)(store->timestamp_us + count);
+    store->change_seq = (uint32_t *)(store->published_raw + count);
+    store->published_seq = store->change_seq + count;
+    store->published_ms = store->published_seq + count;
+    store->quality = (uint8_t *)(store->published_ms + count);
+    store->text = (char *)(store->quality + count);
+    store->count = count;
+    store->text_bytes = text_bytes;
+    // Stores are only created under the registry lock.
+    store->layout_id = ++last_layout_id;
+    return store;
+}
+
+void modbus_value_store_free(modbus_value_store_t *store)
+{
+    heap_caps_free(store);
+}
+
+void modbus_value_store_copy_point(modbus_value_store_t *dst, uint16_t dst_index, uint16_t dst_text,
+                                   const modbus_value_store_t *src, uint16_t src_index,
+                                   uint16_t src_text, uint16_t text_len)
+{
+    uint32_t begin;
+    do {
+        begin = modbus_value_store_read_begin(src);
+        dst->raw[dst_index] = src->raw[src_index];
+        dst->timestamp_us[dst_index] = src->timestamp_us[src_index];
+        dst->change_seq[dst_index] = src->change_seq[src_index];
+        dst->quality[dst_index] = src->quality[src_index];
+        if (src->seq > dst->seq) {
+            dst->seq = src->seq;
+        }
+        memcpy(&dst->text[dst_text], &src->text[src_text], text_len);
+    } while (modbus_value_store_read_retry(src, begin));
+
+    // The publisher may mark the old point meanwhile; losing that costs at
+    // most one repeated message.
+    dst->published_raw[dst_index] = src->published_raw[src_index];
+    dst->published_seq[dst_index] = src->published_seq[src_index];
+    dst->published_ms[dst_index] = src->published_ms[src_index];
+}
+
+bool modbus_value_store_set(modbus_value_store_t *store, uint16_t index, modbus_value_t value,
+                            int64_t timestamp_us)
+{
+    bool changed = store->raw[index] != value.u64 || store->quality[index] != MODBUS_QUALITY_GOOD;
+
+    store->raw[index] = value.u64;
+    store->timestamp_us[index] = timestamp_us;
+    store->quality[index] = MODBUS_QUALITY_GOOD;
+    if (changed) {
+        store->change_seq[index] = ++store->seq;
+    }
+    return changed;
+}
+
+void modbus_value_store_set_quality(modbus_value_store_t *store, uint16_t index, modbus_quality_t quality)
+{
+    if (store->quality[index] != quality) {
+        store->quality[index] = quality;
+        store->change_seq[index] = ++store->seq;
+    }
+}
+
+bool modbus_value_store_publish_pending(const modbus_value_store_t *store, uint16_t index)
+{
+    return store->published_seq[index] != store->change_seq[index];
+}
+
+void modbus_value_store_mark_seen(modbus_value_store_t *store, uint16_t index)
+{
+    store->published_seq[index] = store->change_seq[index];
+}
+
+void modbus_value_store_mark_published(modbus_value_store_t *store, uint16_t index, uint64_t raw,
+                                       uint32_t now_ms)
+{
+    store->published_seq[index] = store->change_seq[index];
+    store->published_raw[index] = raw;
+    store->published_ms[index] = now_ms;
+}
+
+void modbus_value_store_get(const modbus_value_store_t *store, uint16_t index, modbus_point_value_t *out)
+{
+    out->value.u64 = store->raw[index];
+    out->timestamp_us = store->timestamp_us[index];
+    out->change_seq = store->change_seq[index];
+    out->quality = store->quality[index];
+}
+
+void modbus_value_store_write_begin(modbus_value_store_t *store)
+{
+    portENTER_CRITICAL(&value_store_mux);
+    __atomic_store_n(&store->write_seq, store->write_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void modbus_value_store_write_end(modbus_value_store_t *store)
+{
+    __atomic_store_n(&store->write_seq, store->write_seq + 1, __ATOMIC_RELEASE);
+    portEXIT_CRITICAL(&value_store_mux);
+}
+
+uint32_t modbus_value_store_read_begin(const modbus_value_store_t *store)
+{
+    uint32_t begin;
+    while ((begin = __atomic_load_n(&store->write_seq, __ATOMIC_ACQUIRE)) & 1) {
+        // A writer on the other core is mid-update; it holds a spinlock
+        // with interrupts off, so this wait is a handful of cycles.
+    }
+    return begin;
+}
+
+bool modbus_value_store_read_retry(const modbus_value_store_t *store, uint32_t begin)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&store->write_seq, __ATOMIC_RELAXED) != begin;
+}
+
+size_t modbus_value_store_bytes(const modbus_value_store_t *store)
+{
+    return store != NULL ? store_block_size(store->count, store->text_bytes) : 0;
+}
+
+int64_t modbus_timestamp_to_unix_ms(int64_t timestamp_us)
+{
+    if (timestamp_us == 0) {
+        return 0;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (now.tv_sec < WALL_CLOCK_VALID_AFTER) {
+        return 0;
+    }
+
+    int64_t wall_us = (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+    return (wall_us - (esp_timer_get_time() - timestamp_us)) / 1000;
+}
@@ -0,0 +1,105 @@
+#ifndef MODBUS_VALUE_STORE_H
+#define MODBUS_VALUE_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "modbus_data.h"
+
+typedef enum {
+    MODBUS_QUALITY_UNKNOWN = 0,
+    MODBUS_QUALITY_GOOD = 1,
+    MODBUS_QUALITY_BAD = 2
+} modbus_quality_t;
+
+typedef struct {
+    modbus_value_t value;
+    int64_t timestamp_us;
+    uint32_t change_seq;
+    uint8_t quality;
+} modbus_point_value_t;
+
+// Live values of one device, kept apart from the register metadata as
+// parallel arrays indexed like device->registers. Scans over values or
+// change sequences touch only those arrays. String points keep their text
+// in a separate area addressed by the register's text_offset. The header,
+// the arrays and the text area share a single heap block whose layout is
+// fixed when the store is created: a registry edit that adds, removes or
+// reshapes points gets a new store with the next published snapshot (see
+// modbus_devices_commit()), and the old one is freed only after every
+// reader has let go of it. `layout_id` is unique per store.
+//
+// Values are guarded by a sequence lock: writers bump `write_seq` to an odd
+// number before touching a point and back to even afterwards, and readers
+// retry if the counter was odd or moved while they copied. Readers take no
+// lock at all, never block the poll task and never see a half-written
+// 64-bit value or a value paired with another sample's timestamp.
+//
+// Timestamps are esp_timer_get_time() microseconds taken when the response
+// frame carrying the value was received: monotonic from boot, never wrapping
+// and unaffected by clock adjustments. 0 means never sampled.
+typedef struct {
+    uint64_t *raw;
+    int64_t *timestamp_us;
+    uint64_t *published_raw;
+    uint32_t *change_seq;
+    uint32_t *published_seq;
+    uint32_t *published_ms;
+    uint8_t *quality;
+    char *text;
+    uint16_t count;
+    uint16_t text_bytes;
+    uint32_t layout_id;
+    uint32_t seq;
+    uint32_t write_seq;
+} modbus_value_store_t;
+
+// Allocates a store for `count` points and `text_bytes` of string text,
+// every point unknown. Returns NULL when out of memory.
+modbus_value_store_t *modbus_value_store_create(uint16_t count, uint16_t text_bytes);
+void modbus_value_store_free(modbus_value_store_t *store);
+// Carries one point over from the store it replaces: value, quality,
+// change sequence, publish state and `text_len` bytes of text. `src` may
+// be live; `dst` must not be published yet.
+void modbus_value_store_copy_point(modbus_value_store_t *dst, uint16_t dst_index, uint16_t dst_text,
+                                   const modbus_value_store_t *src, uint16_t src_index,
+                                   uint16_t src_text, uint16_t text_len);
+
+// Stores a new value and returns true when it differs from the previous
+// one (or the point was not good before); only then is the point stamped
+// with a fresh change sequence.
+bool modbus_value_store_set(modbus_value_store_t *store, uint16_t index, modbus_value_t value,
+                            int64_t timestamp_us);
+void modbus_value_store_set_quality(modbus_value_store_t *store, uint16_t index, modbus_quality_t quality);
+void modbus_value_store_get(const modbus_value_store_t *store, uint16_t index, modbus_point_value_t *out);
+
+// Publisher bookkeeping, touched only by the MQTT publisher task.
+// published_seq is the change sequence last evaluated for publishing;
+// published_raw and published_ms are the value and time last actually sent.
+// A change that was evaluated but filtered out is marked seen only, so the
+// next comparison is still against what subscribers last received.
+bool modbus_value_store_publish_pending(const modbus_value_store_t *store, uint16_t index);
+void modbus_value_store_mark_seen(modbus_value_store_t *store, uint16_t index);
+void modbus_value_store_mark_published(modbus_value_store_t *store, uint16_t index, uint64_t raw,
+                                       uint32_t now_ms);
+
+// Every set/set_quality and any text update must sit between write_begin
+// and write_end. Readers loop until read_retry returns false:
+//
+//     do {
+//         begin = modbus_value_store_read_begin(store);
+//         ...copy fields...
+//     } while (modbus_value_store_read_retry(store, begin));
+void modbus_value_store_write_begin(modbus_value_store_t *store);
+void modbus_value_store_write_end(modbus_value_store_t *store);
+uint32_t modbus_value_store_read_begin(const modbus_value_store_t *store);
+bool modbus_value_store_read_retry(const modbus_value_store_t *store, uint32_t begin);
+
+// Maps a sample timestamp to Unix milliseconds using the current system
+// time. Returns 0 if the timestamp is 0 or the wall clock was never set.
+int64_t modbus_timestamp_to_unix_ms(int64_t timestamp_us);
+
+size_t modbus_value_store_bytes(const modbus_value_store_t *store);
+
+#endif
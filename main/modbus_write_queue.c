@@ -0,0 +1,316 @@
+#include "modbus_write_queue.h"
+#include "modbus_protocol.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "MODBUS_WRITE_QUEUE";
+
+typedef struct {
+    uint8_t device_id;
+    register_type_t type;
+    uint16_t address;
+    uint16_t value;
+    uint32_t seq;
+    modbus_write_done_cb_t callback;
+    void *ctx;
+} write_request_t;
+
+typedef struct {
+    SemaphoreHandle_t done;
+    modbus_result_t result;
+} write_waiter_t;
+
+static write_request_t pending[MODBUS_WRITE_QUEUE_DEPTH];
+static uint8_t pending_count = 0;
+static uint32_t submit_seq = 0;
+static write_request_t batch[MODBUS_WRITE_QUEUE_DEPTH];
+static SemaphoreHandle_t queue_mutex = NULL;
+static TaskHandle_t write_task_handle = NULL;
+
+static bool request_before(const write_request_t *a, const write_request_t *b)
+{
+    if (a->device_id != b->device_id) {
+        return a->device_id < b->device_id;
+    }
+    if (a->type != b->type) {
+        return a->type < b->type;
+    }
+    if (a->address != b->address) {
+        return a->address < b->address;
+    }
+    return a->seq < b->seq;
+}
+
+static void sort_batch(uint8_t count)
+{
+    for (uint8_t i = 1; i < count; i++) {
+        write_request_t item = batch[i];
+        uint8_t j = i;
+        while (j > 0 && request_before(&item, &batch[j - 1])) {
+            batch[j] = batch[j - 1];
+            j--;
+        }
+        batch[j] = item;
+    }
+}
+
+static uint8_t next_address_end(uint8_t i, uint8_t end)
+{
+    uint8_t j = i + 1;
+    while (j < end && batch[j].address == batch[i].address) {
+        j++;
+    }
+    return j;
+}
+
+// Writes batch[first..last) as one frame. The entries are sorted by address
+// and cover a contiguous address range; duplicates of an address are
+// collapsed to the last submitted value.
+static void execute_run(uint8_t first, uint8_t last)
+{
+    uint8_t device_id = batch[first].device_id;
+    register_type_t type = batch[first].type;
+    uint16_t start = batch[first].address;
+    uint16_t values[MODBUS_WRITE_QUEUE_DEPTH];
+    uint8_t count = 0;
+
+    for (uint8_t i = first; i < last; i = next_address_end(i, last)) {
+        values[count++] = batch[next_address_end(i, last) - 1].value;
+    }
+
+    modbus_result_t result;
+    if (type == REGISTER_TYPE_COIL) {
+        if (count == 1) {
+            result = modbus_write_single_coil(device_id, start, values[0] != 0);
+        } else {
+            uint8_t bits[MODBUS_WRITE_QUEUE_DEPTH];
+            for (uint8_t k = 0; k < count; k++) {
+                bits[k] = values[k] != 0;
+            }
+            result = modbus_write_multiple_coils(device_id, start, bits, count);
+        }
+        for (uint8_t k = 0; k < count; k++) {
+            values[k] = values[k] != 0;
+        }
+    } else if (count == 1) {
+        result = modbus_write_register_verified(device_id, start, values[0], &values[0]);
+    } else {
+        result = modbus_write_multiple_registers(device_id, start, values, count);
+    }
+
+    if (count > 1) {
+        ESP_LOGI(TAG, "Coalesced %d write(s) into %s: device=%d, addr=%d, count=%d, result=%s",
+                  last - first, type == REGISTER_TYPE_COIL ? "FC0F" : "FC10",
+                  device_id, start, count, modbus_result_to_string(result));
+    }
+
+    if (result == MODBUS_RESULT_OK) {
+        for (uint8_t k = 0; k < count; k++) {
+            modbus_update_register_value(device_id, type, start + k, values[k]);
+        }
+    }
+
+    for (uint8_t i = first; i < last; i++) {
+        if (batch[i].callback != NULL) {
+            batch[i].callback(device_id, type, batch[i].address,
+                              values[batch[i].address - start], result, batch[i].ctx);
+        }
+    }
+}
+
+typedef struct {
+    uint8_t first;
+    uint8_t last;
+    uint32_t seq;
+} write_run_t;
+
+static write_run_t runs[MODBUS_WRITE_QUEUE_DEPTH];
+
+// Sorting by address finds the contiguous runs; each run then goes out in
+// the order its earliest write was submitted, so a command written after
+// its parameters still lands after them.
+static void process_batch(uint8_t count)
+{
+    sort_batch(count);
+
+    uint8_t run_count = 0;
+    uint8_t run_start = 0;
+    uint16_t run_addresses = 0;
+    uint32_t run_seq = UINT32_MAX;
+
+    for (uint8_t i = 0; i < count; i = next_address_end(i, count)) {
+        uint8_t next = next_address_end(i, count);
+        run_addresses++;
+        // Entries of one address are in submission order.
+        if (batch[i].seq < run_seq) {
+            run_seq = batch[i].seq;
+        }
+
+        uint16_t max_run = (batch[i].type == REGISTER_TYPE_COIL)
+            ? MODBUS_MAX_WRITE_BITS : MODBUS_MAX_WRITE_REGISTERS;
+        bool extend = next < count &&
+                      batch[next].device_id == batch[i].device_id &&
+                      batch[next].type == batch[i].type &&
+                      batch[next].address == batch[i].address + 1 &&
+                      run_addresses < max_run;
+        if (!extend) {
+            write_run_t run = { .first = run_start, .last = next, .seq = run_seq };
+            uint8_t j = run_count++;
+            while (j > 0 && runs[j - 1].seq > run.seq) {
+                runs[j] = runs[j - 1];
+                j--;
+            }
+            runs[j] = run;
+            run_start = next;
+            run_addresses = 0;
+            run_seq = UINT32_MAX;
+        }
+    }
+
+    for (uint8_t r = 0; r < run_count; r++) {
+        execute_run(runs[r].first, runs[r].last);
+    }
+}
+
+static void write_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "Modbus write task started");
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        vTaskDelay(pdMS_TO_TICKS(MODBUS_WRITE_COALESCE_WINDOW_MS));
+
+        xSemaphoreTake(queue_mutex, portMAX_DELAY);
+        uint8_t count = pending_count;
+        memcpy(batch, pending, count * sizeof(write_request_t));
+        pending_count = 0;
+        xSemaphoreGive(queue_mutex);
+
+        if (count > 0) {
+            process_batch(count);
+        }
+    }
+}
+
+esp_err_t modbus_write_queue_init(void)
+{
+    if (queue_mutex != NULL) {
+        return ESP_OK;
+    }
+
+    queue_mutex = xSemaphoreCreateMutex();
+    if (queue_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create write queue mutex");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(write_task, "modbus_write", 6144, NULL, 6, &write_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create write task");
+        vSemaphoreDelete(queue_mutex);
+        queue_mutex = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Modbus write queue initialized");
+    return ESP_OK;
+}
+
+esp_err_t modbus_write_queue_submit(uint8_t device_id, register_type_t type,
+                                    uint16_t address, uint16_t value,
+                                    modbus_write_done_cb_t callback, void *ctx)
+{
+    if (queue_mutex == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (type != REGISTER_TYPE_COIL && type != REGISTER_TYPE_HOLDING) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(queue_mutex, portMAX_DELAY);
+    if (pending_count >= MODBUS_WRITE_QUEUE_DEPTH) {
+        xSemaphoreGive(queue_mutex);
+        ESP_LOGW(TAG, "Write queue full, dropping write to device %d address %d", device_id, address);
+        return ESP_ERR_NO_MEM;
+    }
+
+    write_request_t *req = &pending[pending_count++];
+    req->device_id = device_id;
+    req->type = type;
+    req->address = address;
+    req->value = value;
+    req->seq = submit_seq++;
+    req->callback = callback;
+    req->ctx = ctx;
+    xSemaphoreGive(queue_mutex);
+
+    xTaskNotifyGive(write_task_handle);
+    return ESP_OK;
+}
+
+esp_err_t modbus_write_queue_submit_many(const modbus_write_item_t *items, uint8_t count,
+                                         modbus_write_done_cb_t callback, void *ctx)
+{
+    if (queue_mutex == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (items[i].type != REGISTER_TYPE_COIL && items[i].type != REGISTER_TYPE_HOLDING) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    xSemaphoreTake(queue_mutex, portMAX_DELAY);
+    if (count > MODBUS_WRITE_QUEUE_DEPTH - pending_count) {
+        xSemaphoreGive(queue_mutex);
+        ESP_LOGW(TAG, "Write queue full, dropping batch of %d write(s)", count);
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        write_request_t *req = &pending[pending_count++];
+        req->device_id = items[i].device_id;
+        req->type = items[i].type;
+        req->address = items[i].address;
+        req->value = items[i].value;
+        req->seq = submit_seq++;
+        req->callback = callback;
+        req->ctx = ctx;
+    }
+    xSemaphoreGive(queue_mutex);
+
+    xTaskNotifyGive(write_task_handle);
+    return ESP_OK;
+}
+
+static void waiter_done(uint8_t device_id, register_type_t type, uint16_t address,
+                        uint16_t value, modbus_result_t result, void *ctx)
+{
+    write_waiter_t *waiter = (write_waiter_t *)ctx;
+    waiter->result = result;
+    xSemaphoreGive(waiter->done);
+}
+
+modbus_result_t modbus_write_queue_write(uint8_t device_id, register_type_t type,
+                                         uint16_t address, uint16_t value)
+{
+    StaticSemaphore_t done_buffer;
+    write_waiter_t waiter = {
+        .done = xSemaphoreCreateBinaryStatic(&done_buffer),
+        .result = MODBUS_RESULT_NOT_INITIALIZED
+    };
+
+    esp_err_t err = modbus_write_queue_submit(device_id, type, address, value, waiter_done, &waiter);
+    if (err == ESP_ERR_NO_MEM) {
+        return MODBUS_RESULT_QUEUE_FULL;
+    } else if (err != ESP_OK) {
+        return MODBUS_RESULT_NOT_INITIALIZED;
+    }
+
+    xSemaphoreTake(waiter.done, portMAX_DELAY);
+    return waiter.result;
+}
@@ -0,0 +1,44 @@
+#ifndef MODBUS_WRITE_QUEUE_H
+#define MODBUS_WRITE_QUEUE_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "modbus_devices.h"
+#include "modbus_manager.h"
+
+#define MODBUS_WRITE_QUEUE_DEPTH 64
+#define MODBUS_WRITE_COALESCE_WINDOW_MS 20
+
+typedef void (*modbus_write_done_cb_t)(uint8_t device_id, register_type_t type,
+                                       uint16_t address, uint16_t value,
+                                       modbus_result_t result, void *ctx);
+
+typedef struct {
+    uint8_t device_id;
+    register_type_t type;
+    uint16_t address;
+    uint16_t value;
+} modbus_write_item_t;
+
+esp_err_t modbus_write_queue_init(void);
+
+// Queues a coil or holding register write. Writes submitted to the same
+// device within the coalescing window are merged: repeated writes to one
+// address keep only the latest value and contiguous addresses go out as a
+// single FC0F/FC10 frame. `callback` runs on the write task once the frame
+// carrying this write has completed.
+esp_err_t modbus_write_queue_submit(uint8_t device_id, register_type_t type,
+                                    uint16_t address, uint16_t value,
+                                    modbus_write_done_cb_t callback, void *ctx);
+
+// Queues several writes at once: either all of them are accepted or, if
+// the queue lacks room, none. They share one coalescing window, so
+// contiguous addresses go out together. `callback` runs once per item.
+esp_err_t modbus_write_queue_submit_many(const modbus_write_item_t *items, uint8_t count,
+                                         modbus_write_done_cb_t callback, void *ctx);
+
+// Blocking wrapper around modbus_write_queue_submit().
+modbus_result_t modbus_write_queue_write(uint8_t device_id, register_type_t type,
+                                         uint16_t address, uint16_t value);
+
+#endif
@@ -1,23 +1,158 @@
 #include "mqtt_gateway.h"
 #include "nvs_storage.h"
+#include "modbus_events.h"
+#include "modbus_poll_plan.h"
+#include "cbor_writer.h"
+#include "sparkplug.h"
+#include "modbus_bulk_write.h"
+#include "modbus_strings.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include <mqtt_client.h>
 #include "esp_wifi.h"
 #include "board.h"
 #include <string.h>
+#include <strings.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <math.h>
 
 static const char *TAG = "MQTT_CLIENT";
 
+#define PUBLISH_BATCH_LEN 16
+// Discovery configs are large, so fewer go per batch.
+#define DISCOVERY_BATCH_LEN 4
+#define PUBLISHER_HOLDOFF_TICK_MS 100
+#define STATE_PAYLOAD_LEN 1024
+// Room one more point needs in a device message: its quoted key and the
+// longest value, a string with every byte escaped.
+#define STATE_ENTRY_MAX (24 + MODBUS_STRING_MAX_LEN * 6)
+// Closing braces plus both timestamps.
+#define STATE_TAIL_MAX 64
+
+typedef struct {
+    char topic[128];
+    char payload[64];
+} outgoing_message_t;
+
+// stale_topic is the config topic under the point's other ID form (with or
+// without the type letter). Older firmware may have left a retained config
+// there, which is cleared so Home Assistant drops the duplicate entity.
+typedef struct {
+    char topic[128];
+    char stale_topic[128];
+    char payload[512];
+    const char *ha_type;
+} discovery_message_t;
+
+// PUBLISH_ALL sends every good point regardless of changes; it runs when a
+// connection comes up.
+typedef enum {
+    PUBLISH_CHANGES,
+    PUBLISH_FLUSH,
+    PUBLISH_ALL
+} publish_pass_t;
+
+// Topic strings of each device and point. Only a prefix change or a new
+// register layout alters them, so they are built once afterwards, interned
+// (point IDs repeat across devices) and looked up by device ID; publishing
+// then only formats the value. A string that could not be allocated is
+// left NULL and formatted on the spot instead. The cache belongs to the
+// publisher task; rebuilding it takes the registry lock, which guards the
+// string table and the prefix.
+typedef struct {
+    const char *state_topic;      // <prefix>/<id>/state
+    uint32_t layout_id;           // value store the entry was built for
+    uint16_t count;
+    const char **point_ids;       // [<type>]<addr>[_b<bit>]
+    const char **point_topics;    // <prefix>/<id>/<point>/state
+} device_topics_t;
+
 static esp_mqtt_client_handle_t mqtt_client = NULL;
 static mqtt_config_t mqtt_config;
 static mqtt_connection_state_t mqtt_state = MQTT_STATE_DISCONNECTED;
 static mqtt_register_write_cb_t write_callback = NULL;
+static mqtt_bulk_write_cb_t bulk_write_callback = NULL;
+// esp-mqtt event task only: a bulk document arriving in several fragments.
+static uint8_t *bulk_document = NULL;
+static size_t bulk_document_len = 0;
 static bool mqtt_initialized = false;
+static TaskHandle_t publisher_task_handle = NULL;
+// Publisher task only; filled from a held plan, then sent.
+static outgoing_message_t outgoing[PUBLISH_BATCH_LEN];
+static discovery_message_t discovery[DISCOVERY_BATCH_LEN];
+static char state_topic[128];
+static char state_payload[STATE_PAYLOAD_LEN];
+static cbor_writer_t state_cbor;
+static sparkplug_payload_t state_sparkplug;
+static volatile bool resync_pending = false;
+static volatile bool discovery_pending = false;
+
+// Sparkplug session. The node ID, NCMD topic and will are set up by
+// mqtt_client_start; everything else belongs to the publisher task.
+static char sparkplug_node[24];
+static char sparkplug_ncmd_topic[128];
+static uint8_t sparkplug_ndeath[32];
+static size_t sparkplug_ndeath_len = 0;
+// bdSeq of the current session; the first session gets 0.
+static uint8_t sparkplug_bdseq = UINT8_MAX;
+static uint8_t sparkplug_seq = 0;
+static bool sparkplug_node_born = false;
+static uint32_t sparkplug_generation = 0;
+// Bit per Modbus device ID: DBIRTH sent and no DDEATH since.
+static uint8_t sparkplug_born[(MODBUS_MAX_DEVICES + 8) / 8];
+
+// Per-device topic strings, indexed by device ID. Set stale under the
+// registry lock when the prefix changes.
+static device_topics_t *topic_cache[MODBUS_MAX_DEVICES + 1];
+static volatile bool topic_cache_stale = true;
+
+static void mqtt_dispatch_message(esp_mqtt_event_handle_t event);
+static void mqtt_subscribe_commands(void);
+static void publisher_task(void *pvParameters);
+
+// Identifies this gateway: the Home Assistant device identifier and the
+// Sparkplug edge node ID.
+static void gateway_id(char *buf, size_t len)
+{
+    uint8_t mac[6];
+    esp_wifi_get_mac(WIFI_IF_STA, mac);
+    snprintf(buf, len, "esp32modbus_%02x%02x%02x", mac[3], mac[4], mac[5]);
+}
 
-static void mqtt_parse_set_message(const char *topic, const char *payload);
-static void mqtt_subscribe_to_registers(void);
+// spBv1.0/<prefix>/<type>/<node>[/<device>]; the topic prefix is the
+// Sparkplug group ID and device ID 0 addresses the node itself.
+static void sparkplug_topic(char *buf, size_t len, const char *type, uint8_t device_id)
+{
+    if (device_id == 0) {
+        snprintf(buf, len, "%s/%s/%s/%s", SPARKPLUG_NAMESPACE, mqtt_config.prefix, type, sparkplug_node);
+    } else {
+        snprintf(buf, len, "%s/%s/%s/%s/%d", SPARKPLUG_NAMESPACE, mqtt_config.prefix, type,
+                 sparkplug_node, device_id);
+    }
+}
+
+// Starts a new Sparkplug session for the next connection: fresh bdSeq,
+// NDEATH will payload and topics.
+static void sparkplug_start_session(char *will_topic, size_t will_topic_len)
+{
+    gateway_id(sparkplug_node, sizeof(sparkplug_node));
+    sparkplug_topic(sparkplug_ncmd_topic, sizeof(sparkplug_ncmd_topic), "NCMD", 0);
+    sparkplug_topic(will_topic, will_topic_len, "NDEATH", 0);
+
+    sparkplug_bdseq++;
+    sparkplug_metric_t bdseq = {
+        .name = SPARKPLUG_METRIC_BDSEQ,
+        .datatype = SPARKPLUG_TYPE_UINT64,
+        .long_value = sparkplug_bdseq,
+    };
+    sparkplug_payload_t payload;
+    sparkplug_payload_begin(&payload, sparkplug_ndeath, sizeof(sparkplug_ndeath));
+    sparkplug_payload_metric(&payload, &bdseq);
+    sparkplug_ndeath_len = sparkplug_payload_end(&payload);
+}
 
 static void log_error_if_nonzero(const char *message, int error_code)
 {
@@ -38,7 +173,7 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
         mqtt_client_publish_lwt(true);
         mqtt_client_publish_discovery();
         mqtt_client_publish_all_registers();
-        mqtt_subscribe_to_registers();
+        mqtt_subscribe_commands();
         break;
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
@@ -54,19 +189,8 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
         ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
         break;
     case MQTT_EVENT_DATA:
-        ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-        char topic_buf[128];
-        char data_buf[256];
-        int copy_len = (event->topic_len < 127) ? event->topic_len : 127;
-        memcpy(topic_buf, event->topic, copy_len);
-        topic_buf[copy_len] = '\0';
-        
-        copy_len = (event->data_len < 255) ? event->data_len : 255;
-        memcpy(data_buf, event->data, copy_len);
-        data_buf[copy_len] = '\0';
-        
-        ESP_LOGI(TAG, "Received: topic=%s, data=%s", topic_buf, data_buf);
-        mqtt_parse_set_message(topic_buf, data_buf);
+        ESP_LOGD(TAG, "MQTT_EVENT_DATA");
+        mqtt_dispatch_message(event);
         break;
     case MQTT_EVENT_ERROR:
         ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
@@ -84,65 +208,206 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     }
 }
 
-static void mqtt_subscribe_to_registers(void)
+// One wildcard covers every point, so reconnects cost a single SUBSCRIBE
+// however large the register map is, and points added later need none.
+static void mqtt_subscribe_commands(void)
 {
     if (mqtt_client == NULL || mqtt_state != MQTT_STATE_CONNECTED) {
         return;
     }
 
-    uint8_t device_count = 0;
-    modbus_device_t *devices = modbus_list_devices(&device_count);
+    char topic[128];
+    snprintf(topic, sizeof(topic), "%s/+/+/set", mqtt_config.prefix);
+    int msg_id = esp_mqtt_client_subscribe(mqtt_client, topic, 0);
+    ESP_LOGI(TAG, "Subscribed to %s, msg_id=%d", topic, msg_id);
+
+    snprintf(topic, sizeof(topic), "%s/bulk/set", mqtt_config.prefix);
+    msg_id = esp_mqtt_client_subscribe(mqtt_client, topic, 0);
+    ESP_LOGI(TAG, "Subscribed to %s, msg_id=%d", topic, msg_id);
 
-    if (devices == NULL) {
-        return;
+    if (mqtt_config.telemetry_mode == MQTT_TELEMETRY_SPARKPLUG) {
+        msg_id = esp_mqtt_client_subscribe(mqtt_client, sparkplug_ncmd_topic, 0);
+        ESP_LOGI(TAG, "Subscribed to %s, msg_id=%d", sparkplug_ncmd_topic, msg_id);
     }
+}
 
-    for (uint8_t i = 0; i < device_count; i++) {
-        for (uint8_t j = 0; j < devices[i].register_count; j++) {
-            if (devices[i].registers[j].writable) {
-                char topic[128];
-                snprintf(topic, sizeof(topic), "%s/%d/%d/set", 
-                         mqtt_config.prefix, 
-                         devices[i].device_id, 
-                         devices[i].registers[j].address);
-                
-                int msg_id = esp_mqtt_client_subscribe(mqtt_client, topic, 0);
-                ESP_LOGI(TAG, "Subscribed to %s, msg_id=%d", topic, msg_id);
-            }
+// Reads a decimal number from [pos, end) up to the first non-digit.
+// Returns the position after it, or NULL if there are no digits or the
+// number exceeds `max`.
+static const char *parse_decimal(const char *pos, const char *end, uint32_t max, uint32_t *value)
+{
+    const char *start = pos;
+
+    *value = 0;
+    while (pos < end && *pos >= '0' && *pos <= '9') {
+        *value = *value * 10 + (*pos - '0');
+        if (*value > max) {
+            return NULL;
         }
+        pos++;
     }
+    return pos > start ? pos : NULL;
 }
 
-static void mqtt_parse_set_message(const char *topic, const char *payload)
+// Type letters of point IDs, indexed by register_type_t.
+static const char REGISTER_TYPE_LETTERS[] = "?cdhi";
+
+// The letter a point ID starts with, or "" for MQTT_REGISTER_TYPE_ANY.
+static const char *type_prefix(register_type_t type)
 {
-    char prefix_topic[64];
-    snprintf(prefix_topic, sizeof(prefix_topic), "%s/", mqtt_config.prefix);
-    
-    char *topic_ptr = strstr(topic, prefix_topic);
-    if (topic_ptr == NULL) {
-        return;
+    static const char *const prefixes[] = { "", "c", "d", "h", "i" };
+    return prefixes[type <= REGISTER_TYPE_INPUT ? type : 0];
+}
+
+// Matches <prefix>/<device>/[<type>]<address>/set in place; the topic from
+// esp-mqtt is a length-delimited span, not a C string. Without a type
+// letter *type is MQTT_REGISTER_TYPE_ANY.
+static bool parse_set_topic(const char *topic, size_t len, uint8_t *device_id, register_type_t *type,
+                            uint16_t *address)
+{
+    const char *end = topic + len;
+    size_t prefix_len = strlen(mqtt_config.prefix);
+    uint32_t id;
+    uint32_t addr;
+
+    if (len <= prefix_len || memcmp(topic, mqtt_config.prefix, prefix_len) != 0 || topic[prefix_len] != '/') {
+        return false;
     }
-    
-    topic_ptr += strlen(prefix_topic);
-    
-    uint8_t device_id;
-    uint16_t address;
-    if (sscanf(topic_ptr, "%hhu/%hu/set", &device_id, &address) == 2) {
-        uint16_t value;
 
-        if (strcasecmp(payload, "ON") == 0) {
-            value = 1;
-        } else if (strcasecmp(payload, "OFF") == 0) {
-            value = 0;
-        } else {
-            value = atoi(payload);
+    const char *pos = parse_decimal(topic + prefix_len + 1, end, MODBUS_MAX_DEVICES, &id);
+    if (pos == NULL || id == 0 || pos == end || *pos != '/') {
+        return false;
+    }
+    const char *letter = pos + 1 < end ? memchr(REGISTER_TYPE_LETTERS + 1, pos[1], 4) : NULL;
+    pos = parse_decimal(pos + (letter != NULL ? 2 : 1), end, UINT16_MAX, &addr);
+    if (pos == NULL || end - pos != 4 || memcmp(pos, "/set", 4) != 0) {
+        return false;
+    }
+
+    *device_id = id;
+    *type = letter != NULL ? (register_type_t)(letter - REGISTER_TYPE_LETTERS) : MQTT_REGISTER_TYPE_ANY;
+    *address = addr;
+    return true;
+}
+
+// ON/OFF (any case) or a whole number from -32768 to 65535, sent as the
+// raw 16-bit register value.
+static bool parse_set_payload(const char *data, size_t len, uint16_t *value)
+{
+    if (len == 2 && strncasecmp(data, "ON", 2) == 0) {
+        *value = 1;
+        return true;
+    }
+    if (len == 3 && strncasecmp(data, "OFF", 3) == 0) {
+        *value = 0;
+        return true;
+    }
+
+    bool negative = len > 0 && data[0] == '-';
+    uint32_t magnitude;
+    const char *end = data + len;
+    const char *pos = parse_decimal(data + (negative ? 1 : 0), end, negative ? 32768 : UINT16_MAX, &magnitude);
+    if (pos != end) {
+        return false;
+    }
+    *value = negative ? (uint16_t)-(int32_t)magnitude : (uint16_t)magnitude;
+    return true;
+}
+
+static bool is_bulk_topic(const char *topic, size_t len)
+{
+    size_t prefix_len = strlen(mqtt_config.prefix);
+    return len == prefix_len + 9 && memcmp(topic, mqtt_config.prefix, prefix_len) == 0 &&
+           memcmp(topic + prefix_len, "/bulk/set", 9) == 0;
+}
+
+static void run_bulk_write(const uint8_t *data, size_t len)
+{
+    ESP_LOGI(TAG, "MQTT bulk write: %u bytes", (unsigned)len);
+    if (bulk_write_callback != NULL) {
+        bulk_write_callback(data, len);
+    }
+}
+
+// esp-mqtt delivers messages larger than its buffer in several events;
+// only the first carries the topic. Bulk documents are stitched back
+// together, anything else that large is ignored.
+static void collect_fragment(esp_mqtt_event_handle_t event)
+{
+    if (event->current_data_offset == 0) {
+        free(bulk_document);
+        bulk_document = NULL;
+
+        if (!is_bulk_topic(event->topic, event->topic_len)) {
+            return;
         }
+        if (event->total_data_len > MODBUS_BULK_WRITE_DOC_MAX) {
+            ESP_LOGW(TAG, "Bulk document of %d bytes exceeds %d", event->total_data_len,
+                     MODBUS_BULK_WRITE_DOC_MAX);
+            return;
+        }
+        bulk_document = malloc(event->total_data_len);
+        if (bulk_document == NULL) {
+            ESP_LOGE(TAG, "No memory for a %d byte bulk document", event->total_data_len);
+            return;
+        }
+        bulk_document_len = event->total_data_len;
+    }
+
+    if (bulk_document == NULL ||
+        (size_t)event->current_data_offset + event->data_len > bulk_document_len) {
+        return;
+    }
+    memcpy(bulk_document + event->current_data_offset, event->data, event->data_len);
+
+    if ((size_t)event->current_data_offset + event->data_len == bulk_document_len) {
+        run_bulk_write(bulk_document, bulk_document_len);
+        free(bulk_document);
+        bulk_document = NULL;
+    }
+}
+
+static void mqtt_dispatch_message(esp_mqtt_event_handle_t event)
+{
+    if (event->current_data_offset != 0 || event->data_len != event->total_data_len) {
+        collect_fragment(event);
+        return;
+    }
 
-        ESP_LOGI(TAG, "MQTT set: device=%u, address=%u, value=%u", (unsigned int)device_id, (unsigned int)address, (unsigned int)value);
-        
-        if (write_callback != NULL) {
-            write_callback(device_id, address, value);
+    if (is_bulk_topic(event->topic, event->topic_len)) {
+        run_bulk_write((const uint8_t *)event->data, event->data_len);
+        return;
+    }
+
+    if (mqtt_config.telemetry_mode == MQTT_TELEMETRY_SPARKPLUG &&
+        event->topic_len == (int)strlen(sparkplug_ncmd_topic) &&
+        memcmp(event->topic, sparkplug_ncmd_topic, event->topic_len) == 0) {
+        if (sparkplug_rebirth_requested((const uint8_t *)event->data, event->data_len)) {
+            ESP_LOGI(TAG, "Sparkplug rebirth requested");
+            resync_pending = true;
+            xTaskNotifyGive(publisher_task_handle);
         }
+        return;
+    }
+
+    uint8_t device_id;
+    register_type_t type;
+    uint16_t address;
+    uint16_t value;
+    if (!parse_set_topic(event->topic, event->topic_len, &device_id, &type, &address)) {
+        ESP_LOGD(TAG, "Ignoring message on %.*s", event->topic_len, event->topic);
+        return;
+    }
+    if (!parse_set_payload(event->data, event->data_len, &value)) {
+        ESP_LOGW(TAG, "Invalid value '%.*s' for device %u register %s%u",
+                 event->data_len, event->data, device_id, type_prefix(type), address);
+        return;
+    }
+
+    ESP_LOGI(TAG, "MQTT set: device=%u, register=%s%u, value=%u",
+             device_id, type_prefix(type), address, value);
+    if (write_callback != NULL) {
+        write_callback(device_id, type, address, value);
     }
 }
 
@@ -154,6 +419,12 @@ esp_err_t mqtt_client_init(void)
 
     memset(&mqtt_config, 0, sizeof(mqtt_config));
     mqtt_state = MQTT_STATE_DISCONNECTED;
+
+    if (xTaskCreate(publisher_task, "mqtt_publish", 4096, NULL, 4, &publisher_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create publisher task");
+        return ESP_ERR_NO_MEM;
+    }
+    modbus_events_set_consumer(publisher_task_handle);
     mqtt_initialized = true;
 
     ESP_LOGI(TAG, "MQTT client initialized");
@@ -172,7 +443,10 @@ esp_err_t mqtt_client_start(const mqtt_config_t *config)
         return ESP_ERR_INVALID_ARG;
     }
 
+    modbus_devices_lock();
     memcpy(&mqtt_config, config, sizeof(mqtt_config_t));
+    topic_cache_stale = true;
+    modbus_devices_unlock();
 
     if (mqtt_client != NULL) {
         esp_mqtt_client_stop(mqtt_client);
@@ -192,7 +466,7 @@ esp_err_t mqtt_client_start(const mqtt_config_t *config)
 
     ESP_LOGI(TAG, "Connecting to MQTT broker: %s", mqtt_uri);
 
-    char lwt_topic[64];
+    char lwt_topic[128];
     snprintf(lwt_topic, sizeof(lwt_topic), "%s/tele/LWT", mqtt_config.prefix);
 
     esp_mqtt_client_config_t mqtt_cfg = {
@@ -205,6 +479,16 @@ esp_err_t mqtt_client_start(const mqtt_config_t *config)
         .session.last_will.retain = true
     };
 
+    // A Sparkplug node's will is its NDEATH, tagged with the bdSeq its
+    // next NBIRTH repeats so the host can match them up.
+    if (mqtt_config.telemetry_mode == MQTT_TELEMETRY_SPARKPLUG) {
+        sparkplug_start_session(lwt_topic, sizeof(lwt_topic));
+        mqtt_cfg.session.last_will.msg = (const char *)sparkplug_ndeath;
+        mqtt_cfg.session.last_will.msg_len = sparkplug_ndeath_len;
+        mqtt_cfg.session.last_will.qos = 1;
+        mqtt_cfg.session.last_will.retain = false;
+    }
+
     mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
     if (mqtt_client == NULL) {
         ESP_LOGE(TAG, "Failed to initialize MQTT client");
@@ -248,25 +532,186 @@ mqtt_connection_state_t mqtt_client_get_state(void)
     return mqtt_state;
 }
 
-esp_err_t mqtt_client_publish_register(uint8_t device_id, const char *device_name, 
-                                        const modbus_register_t *reg)
+// <addr>, e.g. 1000. Bitfields share their register address with the
+// whole-word point, so they get their own topic level: <addr>_b<bit>.
+// `typed` puts the register type letter in front (c0, d0, h1000, i1000).
+static void format_point_id(const modbus_register_t *reg, bool typed, char *buf, size_t len)
 {
-    if (mqtt_client == NULL || mqtt_state != MQTT_STATE_CONNECTED) {
-        return ESP_FAIL;
+    const char *prefix = type_prefix(typed ? reg->type : MQTT_REGISTER_TYPE_ANY);
+    if (modbus_register_is_bitfield(reg)) {
+        snprintf(buf, len, "%s%d_b%d", prefix, reg->address, reg->bit_offset);
+    } else {
+        snprintf(buf, len, "%s%d", prefix, reg->address);
+    }
+}
+
+// The type letter is only added where another register type of the
+// device uses the same address, so existing topics keep their names.
+static void register_topic_id(const modbus_device_t *device, const modbus_register_t *reg,
+                              char *buf, size_t len)
+{
+    format_point_id(reg, modbus_register_address_shared(device, reg), buf, len);
+}
+
+static void release_device_topics(device_topics_t *topics)
+{
+    modbus_str_release(topics->state_topic);
+    for (uint16_t i = 0; i < topics->count; i++) {
+        modbus_str_release(topics->point_ids[i]);
+        modbus_str_release(topics->point_topics[i]);
+    }
+    heap_caps_free(topics);
+}
+
+static device_topics_t *build_device_topics(const modbus_device_t *device)
+{
+    size_t size = sizeof(device_topics_t) + 2 * device->register_count * sizeof(const char *);
+    if (!modbus_heap_can_allocate(size)) {
+        return NULL;
+    }
+    device_topics_t *topics = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    if (topics == NULL) {
+        return NULL;
     }
 
     char topic[128];
-    char payload[64];
+    topics->layout_id = device->values->layout_id;
+    topics->count = device->register_count;
+    topics->point_ids = (const char **)(topics + 1);
+    topics->point_topics = topics->point_ids + topics->count;
+    snprintf(topic, sizeof(topic), "%s/%d/state", mqtt_config.prefix, device->device_id);
+    topics->state_topic = modbus_str_intern(topic);
+
+    for (uint16_t i = 0; i < topics->count; i++) {
+        char point_id[16];
+        register_topic_id(device, &device->registers[i], point_id, sizeof(point_id));
+        snprintf(topic, sizeof(topic), "%s/%d/%s/state", mqtt_config.prefix, device->device_id, point_id);
+        topics->point_ids[i] = modbus_str_intern(point_id);
+        topics->point_topics[i] = modbus_str_intern(topic);
+    }
+    return topics;
+}
+
+// `device` is a published record. Every register edit gives the device a
+// new value store, so an entry built for another layout_id is rebuilt.
+static const device_topics_t *device_topics(const modbus_device_t *device)
+{
+    device_topics_t *topics = topic_cache[device->device_id];
+    if (!topic_cache_stale && topics != NULL && topics->layout_id == device->values->layout_id) {
+        return topics;
+    }
+
+    modbus_devices_lock();
+    if (topic_cache_stale) {
+        for (uint16_t id = 0; id <= MODBUS_MAX_DEVICES; id++) {
+            if (topic_cache[id] != NULL) {
+                release_device_topics(topic_cache[id]);
+                topic_cache[id] = NULL;
+            }
+        }
+        topic_cache_stale = false;
+    }
+
+    topics = topic_cache[device->device_id];
+    if (topics == NULL || topics->layout_id != device->values->layout_id) {
+        if (topics != NULL) {
+            release_device_topics(topics);
+        }
+        topics = build_device_topics(device);
+        topic_cache[device->device_id] = topics;
+    }
+    modbus_devices_unlock();
+    return topics;
+}
+
+static const char *point_id(const modbus_device_t *device, uint16_t index, char *buf, size_t len)
+{
+    const device_topics_t *topics = device_topics(device);
+    if (topics != NULL && index < topics->count && topics->point_ids[index] != NULL) {
+        return topics->point_ids[index];
+    }
+    register_topic_id(device, &device->registers[index], buf, len);
+    return buf;
+}
+
+static const char *point_state_topic(const modbus_device_t *device, uint16_t index, char *buf, size_t len)
+{
+    const device_topics_t *topics = device_topics(device);
+    if (topics != NULL && index < topics->count && topics->point_topics[index] != NULL) {
+        return topics->point_topics[index];
+    }
+    char id[16];
+    register_topic_id(device, &device->registers[index], id, sizeof(id));
+    snprintf(buf, len, "%s/%d/%s/state", mqtt_config.prefix, device->device_id, id);
+    return buf;
+}
+
+static const char *device_state_topic(const modbus_device_t *device, char *buf, size_t len)
+{
+    const device_topics_t *topics = device_topics(device);
+    if (topics != NULL && topics->state_topic != NULL) {
+        return topics->state_topic;
+    }
+    snprintf(buf, len, "%s/%d/state", mqtt_config.prefix, device->device_id);
+    return buf;
+}
+
+static uint32_t publisher_now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static uint32_t flush_interval_ms(void)
+{
+    uint16_t interval = mqtt_config.publish_interval;
+    return (interval > 0 ? interval : MQTT_DEFAULT_INTERVAL) * 1000;
+}
 
-    snprintf(topic, sizeof(topic), "%s/%d/%d/state", 
-             mqtt_config.prefix, device_id, reg->address);
+static bool is_bit_point(const modbus_register_t *reg)
+{
+    return reg->type == REGISTER_TYPE_COIL || reg->type == REGISTER_TYPE_DISCRETE ||
+           (modbus_register_is_bitfield(reg) && reg->bit_width == 1);
+}
+
+static void format_point_state(const modbus_device_t *device, uint16_t index, modbus_value_t value,
+                               const char *text, char *topic, size_t topic_len,
+                               char *payload, size_t payload_len)
+{
+    const modbus_register_t *reg = &device->registers[index];
+    const char *cached = point_state_topic(device, index, topic, topic_len);
 
-    if (reg->type == REGISTER_TYPE_COIL || reg->type == REGISTER_TYPE_DISCRETE) {
-        snprintf(payload, sizeof(payload), "%s", reg->last_value ? "ON" : "OFF");
+    if (cached != topic) {
+        snprintf(topic, topic_len, "%s", cached);
+    }
+
+    if (is_bit_point(reg)) {
+        snprintf(payload, payload_len, "%s", value.u64 ? "ON" : "OFF");
+    } else if (modbus_register_is_bitfield(reg)) {
+        modbus_value_format(MODBUS_DATA_UINT64, value, reg->scale, reg->offset,
+                            NULL, payload, payload_len);
     } else {
-        float scaled = (float)reg->last_value * reg->scale + reg->offset;
-        snprintf(payload, sizeof(payload), "%.2f", scaled);
+        modbus_value_format(reg->data_type, value, reg->scale, reg->offset,
+                            text, payload, payload_len);
     }
+}
+
+esp_err_t mqtt_client_publish_register(modbus_device_t *device, uint16_t index)
+{
+    if (mqtt_client == NULL || mqtt_state != MQTT_STATE_CONNECTED) {
+        return ESP_FAIL;
+    }
+
+    modbus_point_value_t point;
+    char text[MODBUS_STRING_MAX_LEN + 1];
+    modbus_read_register_value(device, index, &point, text, sizeof(text));
+    if (point.quality != MODBUS_QUALITY_GOOD) {
+        return ESP_OK;
+    }
+    modbus_value_store_mark_published(device->values, index, point.value.u64, publisher_now_ms());
+
+    char topic[128];
+    char payload[64];
+    format_point_state(device, index, point.value, text, topic, sizeof(topic), payload, sizeof(payload));
 
     int msg_id = esp_mqtt_client_publish(mqtt_client, topic, payload, 0, 0, 1);
     ESP_LOGI(TAG, "Published %s: %s (msg_id=%d)", topic, payload, msg_id);
@@ -274,104 +719,844 @@ esp_err_t mqtt_client_publish_register(uint8_t device_id, const char *device_nam
     return ESP_OK;
 }
 
-esp_err_t mqtt_client_publish_all_registers(void)
+// Coils, strings and one-bit fields publish on any change; numeric points
+// only once the engineering value leaves the deadband around the value
+// subscribers last received.
+static bool outside_deadband(const modbus_register_t *reg, modbus_value_t value, modbus_value_t last)
 {
-    if (mqtt_client == NULL || mqtt_state != MQTT_STATE_CONNECTED) {
-        return ESP_FAIL;
+    if (reg->deadband <= 0 || is_bit_point(reg) || reg->data_type == MODBUS_DATA_STRING) {
+        return value.u64 != last.u64;
+    }
+
+    uint8_t data_type = modbus_register_is_bitfield(reg) ? MODBUS_DATA_UINT64 : reg->data_type;
+    double current = modbus_value_to_double(data_type, value) * reg->scale + reg->offset;
+    double previous = modbus_value_to_double(data_type, last) * reg->scale + reg->offset;
+    double delta = fabs(current - previous);
+    if (reg->deadband_mode == DEADBAND_PERCENT) {
+        return delta > fabs(previous) * reg->deadband / 100.0;
     }
+    return delta > reg->deadband;
+}
 
-    uint8_t device_count = 0;
-    modbus_device_t *devices = modbus_list_devices(&device_count);
+// Decides whether a point goes out now; if so, marks it published and
+// returns its current value. A flush evaluates every changed point and
+// resends those whose heartbeat expired; an on-change pass only takes
+// points with publish_min_ms whose holdoff has passed, and sets *deferred
+// for the ones still waiting. `device` is a record of a held plan.
+static bool take_point(modbus_device_t *device, uint16_t index, publish_pass_t pass, uint32_t now_ms,
+                       bool *deferred, modbus_point_value_t *point, char *text, size_t text_len)
+{
+    const modbus_register_t *reg = &device->registers[index];
+    modbus_value_store_t *values = device->values;
+    uint32_t since_publish = now_ms - values->published_ms[index];
+    bool never_published = values->published_ms[index] == 0;
+    bool flush = pass != PUBLISH_CHANGES;
+    bool heartbeat = pass == PUBLISH_ALL ||
+                     (flush && reg->heartbeat_s > 0 && !never_published &&
+                      since_publish >= reg->heartbeat_s * 1000u);
 
-    if (devices == NULL) {
-        return ESP_OK;
+    if (!heartbeat) {
+        if (!modbus_value_store_publish_pending(values, index) || (!flush && reg->publish_min_ms == 0)) {
+            return false;
+        }
+        if (!flush && !never_published && since_publish < reg->publish_min_ms) {
+            *deferred = true;
+            return false;
+        }
+    }
+
+    modbus_read_register_value(device, index, point, text, text_len);
+    modbus_value_t last = { .u64 = values->published_raw[index] };
+    if (point->quality != MODBUS_QUALITY_GOOD ||
+        (!heartbeat && !never_published && !outside_deadband(reg, point->value, last))) {
+        modbus_value_store_mark_seen(values, index);
+        return false;
     }
 
-    for (uint8_t i = 0; i < device_count; i++) {
-        for (uint8_t j = 0; j < devices[i].register_count; j++) {
-            mqtt_client_publish_register(devices[i].device_id, devices[i].name, 
-                                        &devices[i].registers[j]);
+    modbus_value_store_mark_published(values, index, point->value.u64, now_ms);
+    return true;
+}
+
+// Queues the point's message in the outgoing batch if it is due.
+static void collect_point(modbus_device_t *device, uint16_t index, publish_pass_t pass, uint32_t now_ms,
+                          uint16_t *count, bool *deferred)
+{
+    modbus_point_value_t point;
+    char text[MODBUS_STRING_MAX_LEN + 1];
+    if (!take_point(device, index, pass, now_ms, deferred, &point, text, sizeof(text))) {
+        return;
+    }
+
+    outgoing_message_t *msg = &outgoing[(*count)++];
+    format_point_state(device, index, point.value, text, msg->topic, sizeof(msg->topic),
+                       msg->payload, sizeof(msg->payload));
+}
+
+// Sends the collected batch.
+static void send_outgoing(uint16_t count)
+{
+    for (uint16_t i = 0; i < count; i++) {
+        if (mqtt_client == NULL || mqtt_state != MQTT_STATE_CONNECTED) {
+            return;
         }
+        int msg_id = esp_mqtt_client_publish(mqtt_client, outgoing[i].topic, outgoing[i].payload, 0, 0, 1);
+        ESP_LOGD(TAG, "Published %s: %s (msg_id=%d)", outgoing[i].topic, outgoing[i].payload, msg_id);
     }
+}
 
-    return ESP_OK;
+// Publishes the points named by queued change events, in batches. Events
+// from a value store that has since been replaced are skipped; the next
+// flush covers those points. Returns true if any point is still inside
+// its holdoff.
+static bool publish_events(uint32_t now_ms)
+{
+    bool deferred = false;
+    bool more = true;
+
+    while (more) {
+        uint16_t count = 0;
+        modbus_change_event_t event;
+
+        modbus_poll_plan_t *plan = modbus_poll_plan_acquire();
+        while (count < PUBLISH_BATCH_LEN && (more = modbus_events_pop(&event))) {
+            modbus_device_t *device = plan != NULL ? modbus_poll_plan_find_device(plan, event.device_id) : NULL;
+            if (device != NULL && event.layout_id == device->values->layout_id) {
+                collect_point(device, event.register_index, PUBLISH_CHANGES, now_ms, &count, &deferred);
+            }
+        }
+        modbus_poll_plan_release(plan);
+
+        send_outgoing(count);
+    }
+    return deferred;
 }
 
-esp_err_t mqtt_client_publish_discovery(void)
+// Walks every point of the published snapshot one batch at a time; a
+// committed edit is picked up at the next batch. Returns true if any point
+// is still inside its holdoff.
+static bool publish_scan(publish_pass_t pass, uint32_t now_ms)
 {
-    if (mqtt_client == NULL || mqtt_state != MQTT_STATE_CONNECTED) {
-        return ESP_FAIL;
+    bool deferred = false;
+    uint8_t device_pos = 0;
+    uint16_t register_pos = 0;
+    bool done = false;
+
+    while (!done) {
+        uint16_t count = 0;
+
+        modbus_poll_plan_t *plan = modbus_poll_plan_acquire();
+        uint16_t device_count = plan != NULL ? plan->device_count : 0;
+        done = true;
+        for (; device_pos < device_count && done; device_pos++, register_pos = 0) {
+            modbus_device_t *device = &plan->devices[device_pos].device;
+            for (; register_pos < device->register_count; register_pos++) {
+                if (count == PUBLISH_BATCH_LEN) {
+                    done = false;
+                    break;
+                }
+                collect_point(device, register_pos, pass, now_ms, &count, &deferred);
+            }
+            if (!done) {
+                break;
+            }
+        }
+        modbus_poll_plan_release(plan);
+
+        send_outgoing(count);
     }
+    return deferred;
+}
 
-    uint8_t device_count = 0;
-    modbus_device_t *devices = modbus_list_devices(&device_count);
+// Appends a JSON string, escaping quotes, backslashes and control bytes.
+// The caller guarantees room for the worst case.
+static size_t append_json_string(char *buf, size_t pos, const char *text)
+{
+    buf[pos++] = '"';
+    for (const unsigned char *p = (const unsigned char *)text; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            buf[pos++] = '\\';
+            buf[pos++] = *p;
+        } else if (*p < 0x20) {
+            pos += sprintf(&buf[pos], "\\u%04x", *p);
+        } else {
+            buf[pos++] = *p;
+        }
+    }
+    buf[pos++] = '"';
+    return pos;
+}
 
-    if (devices == NULL) {
-        return ESP_OK;
+// Adds `"<point>":<value>` to the open values object of a device message.
+// Bit points become booleans, strings JSON strings and numbers stay bare;
+// a NaN or infinite float has no JSON form and is sent as null.
+static size_t append_state_value(const modbus_device_t *device, uint16_t index, modbus_value_t value,
+                                 const char *text, char *buf, size_t pos)
+{
+    const modbus_register_t *reg = &device->registers[index];
+    char id[16];
+    pos += sprintf(&buf[pos], "%s\"%s\":", buf[pos - 1] == '{' ? "" : ",",
+                   point_id(device, index, id, sizeof(id)));
+
+    if (is_bit_point(reg)) {
+        return pos + sprintf(&buf[pos], "%s", value.u64 ? "true" : "false");
+    }
+    if (reg->data_type == MODBUS_DATA_STRING && !modbus_register_is_bitfield(reg)) {
+        return append_json_string(buf, pos, text);
     }
 
-    uint8_t mac[6];
-    esp_wifi_get_mac(WIFI_IF_STA, mac);
-    char device_id[24];
-    snprintf(device_id, sizeof(device_id), "esp32modbus_%02x%02x%02x", mac[3], mac[4], mac[5]);
+    char number[64];
+    modbus_value_format(modbus_register_is_bitfield(reg) ? MODBUS_DATA_UINT64 : reg->data_type,
+                        value, reg->scale, reg->offset, NULL, number, sizeof(number));
+    // printf spells the non-finite values inf and nan; no number has an n.
+    return pos + sprintf(&buf[pos], "%s", strchr(number, 'n') != NULL ? "null" : number);
+}
 
-    for (uint8_t i = 0; i < device_count; i++) {
-        for (uint8_t j = 0; j < devices[i].register_count; j++) {
-            char topic[128];
-            char payload[512];
-            char unique_id[64];
-            
-            snprintf(unique_id, sizeof(unique_id), "%s_%d_%d", 
-                    device_id, devices[i].device_id, devices[i].registers[j].address);
-
-            const char *ha_type;
-            const char *value_template;
-            
-            if (devices[i].registers[j].type == REGISTER_TYPE_COIL && devices[i].registers[j].writable) {
-                ha_type = "switch";
-                snprintf(topic, sizeof(topic), "homeassistant/switch/%s/config", unique_id);
-                snprintf(payload, sizeof(payload),
-                    "{\"name\": \"%s\", \"command_topic\": \"%s/%d/%d/set\", "
-                    "\"state_topic\": \"%s/%d/%d/state\", "
-                    "\"unique_id\": \"%s\", "
-                    "\"device\": {\"name\": \"%s\", \"identifiers\": \"%s\", \"manufacturer\": \"Custom\", \"model\": \"%s\"}}",
-                    devices[i].registers[j].name,
-                    mqtt_config.prefix, devices[i].device_id, devices[i].registers[j].address,
-                    mqtt_config.prefix, devices[i].device_id, devices[i].registers[j].address,
-                    unique_id, BOARD_NAME, device_id, BOARD_MCU);
-            } else if (devices[i].registers[j].writable) {
-                ha_type = "number";
-                snprintf(topic, sizeof(topic), "homeassistant/number/%s/config", unique_id);
-                snprintf(payload, sizeof(payload),
-                    "{\"name\": \"%s\", \"command_topic\": \"%s/%d/%d/set\", "
-                    "\"state_topic\": \"%s/%d/%d/state\", "
-                    "\"value_template\": \"{{ value }}\", "
-                    "\"unique_id\": \"%s\", "
-                    "\"device\": {\"name\": \"%s\", \"identifiers\": \"%s\", \"manufacturer\": \"Custom\", \"model\": \"%s\"}}",
-                    devices[i].registers[j].name,
-                    mqtt_config.prefix, devices[i].device_id, devices[i].registers[j].address,
-                    mqtt_config.prefix, devices[i].device_id, devices[i].registers[j].address,
-                    unique_id, BOARD_NAME, device_id, BOARD_MCU);
+static size_t finish_state_json(size_t pos, int64_t newest_us, int64_t unix_ms)
+{
+    pos += sprintf(&state_payload[pos], "},\"timestamp_us\":%" PRId64, newest_us);
+    if (unix_ms > 0) {
+        pos += sprintf(&state_payload[pos], ",\"time_unix_ms\":%" PRId64, unix_ms);
+    }
+    state_payload[pos++] = '}';
+    return pos;
+}
+
+// Float32 points and scaled 16-bit ones lose nothing in a 32-bit float;
+// wider integers and float64 need a double.
+static bool fits_float(uint8_t data_type)
+{
+    return data_type == MODBUS_DATA_FLOAT32 || data_type == MODBUS_DATA_UINT16 ||
+           data_type == MODBUS_DATA_INT16;
+}
+
+// CBOR form of a point, keyed like the JSON one. Unscaled integers stay
+// integers and floats keep their native width, so the common case needs no
+// text formatting and little floating-point work, which is emulated in
+// software on the ESP32-C3.
+static void put_state_cbor(const modbus_device_t *device, uint16_t index, modbus_value_t value,
+                           const char *text)
+{
+    const modbus_register_t *reg = &device->registers[index];
+    char id[16];
+    cbor_put_text(&state_cbor, point_id(device, index, id, sizeof(id)));
+
+    if (is_bit_point(reg)) {
+        cbor_put_bool(&state_cbor, value.u64 != 0);
+        return;
+    }
+
+    uint8_t data_type = modbus_register_is_bitfield(reg) ? MODBUS_DATA_UINT64 : reg->data_type;
+    bool unscaled = reg->scale == 1.0f && reg->offset == 0.0f;
+    if (data_type == MODBUS_DATA_STRING) {
+        cbor_put_text(&state_cbor, text);
+    } else if (unscaled && (data_type == MODBUS_DATA_INT16 || data_type == MODBUS_DATA_INT32 ||
+                            data_type == MODBUS_DATA_INT64)) {
+        cbor_put_int(&state_cbor, value.i64);
+    } else if (unscaled && modbus_data_type_is_integer(data_type)) {
+        cbor_put_uint(&state_cbor, value.u64);
+    } else {
+        double scaled = modbus_value_to_double(data_type, value);
+        if (!unscaled) {
+            scaled = scaled * reg->scale + reg->offset;
+        }
+        if (fits_float(data_type)) {
+            cbor_put_float(&state_cbor, (float)scaled);
+        } else {
+            cbor_put_double(&state_cbor, scaled);
+        }
+    }
+}
+
+// Same layout as the JSON message, as one open-ended CBOR map.
+static size_t begin_state_cbor(void)
+{
+    cbor_writer_init(&state_cbor, (uint8_t *)state_payload, sizeof(state_payload));
+    cbor_put_map_open(&state_cbor);
+    cbor_put_text(&state_cbor, "values");
+    cbor_put_map_open(&state_cbor);
+    return state_cbor.len;
+}
+
+static size_t finish_state_cbor(int64_t newest_us, int64_t unix_ms)
+{
+    cbor_put_break(&state_cbor);
+    cbor_put_text(&state_cbor, "timestamp_us");
+    cbor_put_int(&state_cbor, newest_us);
+    if (unix_ms > 0) {
+        cbor_put_text(&state_cbor, "time_unix_ms");
+        cbor_put_int(&state_cbor, unix_ms);
+    }
+    cbor_put_break(&state_cbor);
+    return state_cbor.overflow ? 0 : state_cbor.len;
+}
+
+// Sparkplug wants UTC milliseconds; until the clock is set, time since boot
+// is the best there is.
+static uint64_t sparkplug_time_ms(int64_t timestamp_us)
+{
+    int64_t unix_ms = modbus_timestamp_to_unix_ms(timestamp_us);
+    return unix_ms > 0 ? unix_ms : timestamp_us / 1000;
+}
+
+static bool sparkplug_device_born(uint8_t device_id)
+{
+    return sparkplug_born[device_id / 8] & (1u << (device_id % 8));
+}
+
+static void sparkplug_set_born(uint8_t device_id, bool born)
+{
+    if (born) {
+        sparkplug_born[device_id / 8] |= 1u << (device_id % 8);
+    } else {
+        sparkplug_born[device_id / 8] &= ~(1u << (device_id % 8));
+    }
+}
+
+// Sparkplug metric of a point, with the same typing rules as CBOR. The
+// alias is <device_id> << 16 | register index: unique across the node and
+// stable until the registry changes, which forces a rebirth. `name` is
+// set for births only.
+static void point_metric(const modbus_device_t *device, uint16_t index, const modbus_point_value_t *point,
+                         const char *text, bool birth, sparkplug_metric_t *metric)
+{
+    const modbus_register_t *reg = &device->registers[index];
+    uint8_t data_type = modbus_register_is_bitfield(reg) ? MODBUS_DATA_UINT64 : reg->data_type;
+    bool unscaled = reg->scale == 1.0f && reg->offset == 0.0f;
+    modbus_value_t value = point->value;
+
+    memset(metric, 0, sizeof(*metric));
+    metric->name = birth ? reg->name : NULL;
+    metric->alias = (uint64_t)device->device_id << 16 | index;
+    metric->timestamp_ms = point->timestamp_us != 0 ? sparkplug_time_ms(point->timestamp_us) : 0;
+    metric->is_null = point->quality != MODBUS_QUALITY_GOOD;
+
+    if (is_bit_point(reg)) {
+        metric->datatype = SPARKPLUG_TYPE_BOOLEAN;
+        metric->boolean_value = value.u64 != 0;
+    } else if (data_type == MODBUS_DATA_STRING) {
+        metric->datatype = SPARKPLUG_TYPE_STRING;
+        metric->string_value = text;
+    } else if (unscaled && modbus_data_type_is_integer(data_type)) {
+        switch (data_type) {
+            case MODBUS_DATA_INT16:
+                metric->datatype = SPARKPLUG_TYPE_INT16;
+                metric->int_value = (uint32_t)(int32_t)value.i64;
+                break;
+            case MODBUS_DATA_INT32:
+                metric->datatype = SPARKPLUG_TYPE_INT32;
+                metric->int_value = (uint32_t)(int32_t)value.i64;
+                break;
+            case MODBUS_DATA_UINT16:
+                metric->datatype = SPARKPLUG_TYPE_UINT16;
+                metric->int_value = (uint32_t)value.u64;
+                break;
+            case MODBUS_DATA_INT64:
+                metric->datatype = SPARKPLUG_TYPE_INT64;
+                metric->long_value = (uint64_t)value.i64;
+                break;
+            case MODBUS_DATA_UINT32:
+                metric->datatype = SPARKPLUG_TYPE_UINT32;
+                metric->long_value = value.u64;
+                break;
+            default:
+                metric->datatype = SPARKPLUG_TYPE_UINT64;
+                metric->long_value = value.u64;
+                break;
+        }
+    } else {
+        double scaled = modbus_value_to_double(data_type, value);
+        if (!unscaled) {
+            scaled = scaled * reg->scale + reg->offset;
+        }
+        if (fits_float(data_type)) {
+            metric->datatype = SPARKPLUG_TYPE_FLOAT;
+            metric->float_value = (float)scaled;
+        } else {
+            metric->datatype = SPARKPLUG_TYPE_DOUBLE;
+            metric->double_value = scaled;
+        }
+    }
+}
+
+// NBIRTH opens the session: sequence numbers restart at 0 and every device
+// has to be born again after it.
+static void sparkplug_publish_nbirth(void)
+{
+    uint8_t buf[96];
+    char topic[128];
+    sparkplug_metric_t bdseq = {
+        .name = SPARKPLUG_METRIC_BDSEQ,
+        .datatype = SPARKPLUG_TYPE_UINT64,
+        .long_value = sparkplug_bdseq,
+    };
+    sparkplug_metric_t rebirth = {
+        .name = SPARKPLUG_METRIC_REBIRTH,
+        .datatype = SPARKPLUG_TYPE_BOOLEAN,
+        .boolean_value = false,
+    };
+    sparkplug_payload_t payload;
+
+    sparkplug_seq = 0;
+    sparkplug_payload_begin(&payload, buf, sizeof(buf));
+    sparkplug_payload_timestamp(&payload, sparkplug_time_ms(esp_timer_get_time()));
+    sparkplug_payload_seq(&payload, sparkplug_seq++);
+    sparkplug_payload_metric(&payload, &bdseq);
+    sparkplug_payload_metric(&payload, &rebirth);
+
+    sparkplug_topic(topic, sizeof(topic), "NBIRTH", 0);
+    int msg_id = esp_mqtt_client_publish(mqtt_client, topic, (const char *)buf,
+                                         sparkplug_payload_end(&payload), 0, 0);
+    ESP_LOGI(TAG, "Published NBIRTH bdSeq=%u (msg_id=%d)", sparkplug_bdseq, msg_id);
+
+    memset(sparkplug_born, 0, sizeof(sparkplug_born));
+    sparkplug_node_born = true;
+}
+
+// DBIRTH names and types every point of a device and carries its current
+// value, null for points that are not good. It cannot be split, so it is
+// built in a heap buffer sized for the device. Plan held; returns
+// the buffer for the caller to free, or NULL.
+static uint8_t *build_dbirth(modbus_device_t *device, uint32_t now_ms, size_t *len)
+{
+    size_t size = 32;
+    for (uint16_t i = 0; i < device->register_count; i++) {
+        size += SPARKPLUG_METRIC_OVERHEAD + strlen(device->registers[i].name);
+        if (device->registers[i].data_type == MODBUS_DATA_STRING) {
+            size += MODBUS_STRING_MAX_LEN;
+        }
+    }
+    if (!modbus_heap_can_allocate(size)) {
+        return NULL;
+    }
+    uint8_t *buf = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    sparkplug_payload_t payload;
+    sparkplug_payload_begin(&payload, buf, size);
+    sparkplug_payload_timestamp(&payload, sparkplug_time_ms(esp_timer_get_time()));
+    sparkplug_payload_seq(&payload, sparkplug_seq++);
+    for (uint16_t i = 0; i < device->register_count; i++) {
+        modbus_point_value_t point;
+        char text[MODBUS_STRING_MAX_LEN + 1];
+        sparkplug_metric_t metric;
+
+        modbus_read_register_value(device, i, &point, text, sizeof(text));
+        point_metric(device, i, &point, text, true, &metric);
+        sparkplug_payload_metric(&payload, &metric);
+        if (point.quality == MODBUS_QUALITY_GOOD) {
+            modbus_value_store_mark_published(device->values, i, point.value.u64, now_ms);
+        } else {
+            modbus_value_store_mark_seen(device->values, i);
+        }
+    }
+
+    *len = sparkplug_payload_end(&payload);
+    if (*len == 0) {
+        heap_caps_free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+// Brings the session in line with the registry: NBIRTH when it starts,
+// DBIRTH for devices that came online (for all of them after a registry
+// edit, since aliases may have moved) and DDEATH for devices that went
+// offline, were disabled or were removed.
+static void sparkplug_sync_devices(uint32_t now_ms)
+{
+    if (!sparkplug_node_born) {
+        sparkplug_publish_nbirth();
+    }
+
+    modbus_poll_plan_t *plan = modbus_poll_plan_acquire();
+    uint32_t generation = plan != NULL ? plan->generation : 0;
+    bool rebirth = generation != sparkplug_generation;
+    sparkplug_generation = generation;
+
+    for (uint16_t id = 1; id <= MODBUS_MAX_DEVICES; id++) {
+        modbus_device_t *device = plan != NULL ? modbus_poll_plan_find_device(plan, id) : NULL;
+        bool online = device != NULL && device->enabled && device->status == DEVICE_STATUS_ONLINE;
+        bool born = sparkplug_device_born(id);
+        uint8_t death[24];
+        uint8_t *buf = NULL;
+        size_t len = 0;
+        const char *type;
+
+        if (online && (!born || rebirth)) {
+            buf = build_dbirth(device, now_ms, &len);
+            if (buf == NULL) {
+                ESP_LOGE(TAG, "No memory for DBIRTH of device %d", id);
+                continue;
+            }
+            type = "DBIRTH";
+        } else if (!online && born) {
+            sparkplug_payload_t payload;
+            sparkplug_payload_begin(&payload, death, sizeof(death));
+            sparkplug_payload_timestamp(&payload, sparkplug_time_ms(esp_timer_get_time()));
+            sparkplug_payload_seq(&payload, sparkplug_seq++);
+            len = sparkplug_payload_end(&payload);
+            type = "DDEATH";
+        } else {
+            continue;
+        }
+        sparkplug_set_born(id, online);
+
+        // The next pass catches anything that changed meanwhile.
+        char topic[128];
+        sparkplug_topic(topic, sizeof(topic), type, id);
+        int msg_id = esp_mqtt_client_publish(mqtt_client, topic, (const char *)(buf != NULL ? buf : death),
+                                             len, 0, 0);
+        ESP_LOGI(TAG, "Published %s (%u bytes, msg_id=%d)", topic, (unsigned int)len, msg_id);
+        heap_caps_free(buf);
+    }
+    modbus_poll_plan_release(plan);
+}
+
+// Device mode: one <prefix>/<id>/state message per device carrying every
+// point due in this pass, stamped with the newest sample it includes, as
+// JSON or CBOR, or a Sparkplug DDATA for each born device. A device whose
+// due points do not fit one payload continues in another.
+// The plan is held while one message is built and released before it is
+// sent. Returns true if any point is still inside its holdoff.
+static bool publish_device_states(publish_pass_t pass, uint32_t now_ms)
+{
+    bool deferred = false;
+    uint8_t device_pos = 0;
+    uint16_t register_pos = 0;
+
+    while (true) {
+        uint16_t count = 0;
+        int64_t newest_us = 0;
+
+        modbus_poll_plan_t *plan = modbus_poll_plan_acquire();
+        if (plan == NULL || device_pos >= plan->device_count) {
+            modbus_poll_plan_release(plan);
+            break;
+        }
+
+        modbus_device_t *device = &plan->devices[device_pos].device;
+        uint8_t mode = mqtt_config.telemetry_mode;
+        if (mode == MQTT_TELEMETRY_SPARKPLUG && !sparkplug_device_born(device->device_id)) {
+            device_pos++;
+            register_pos = 0;
+            modbus_poll_plan_release(plan);
+            continue;
+        }
+
+        size_t pos;
+        if (mode == MQTT_TELEMETRY_SPARKPLUG) {
+            sparkplug_payload_begin(&state_sparkplug, (uint8_t *)state_payload, sizeof(state_payload));
+            pos = 0;
+        } else if (mode == MQTT_TELEMETRY_DEVICE_CBOR) {
+            pos = begin_state_cbor();
+        } else {
+            pos = sprintf(state_payload, "{\"values\":{");
+        }
+        for (; register_pos < device->register_count; register_pos++) {
+            if (pos + STATE_ENTRY_MAX + STATE_TAIL_MAX > sizeof(state_payload)) {
+                break;
+            }
+            modbus_point_value_t point;
+            char text[MODBUS_STRING_MAX_LEN + 1];
+            if (!take_point(device, register_pos, pass, now_ms, &deferred, &point, text, sizeof(text))) {
+                continue;
+            }
+            if (mode == MQTT_TELEMETRY_SPARKPLUG) {
+                sparkplug_metric_t metric;
+                point_metric(device, register_pos, &point, text, false, &metric);
+                sparkplug_payload_metric(&state_sparkplug, &metric);
+                pos = state_sparkplug.len;
+            } else if (mode == MQTT_TELEMETRY_DEVICE_CBOR) {
+                put_state_cbor(device, register_pos, point.value, text);
+                pos = state_cbor.len;
             } else {
-                ha_type = "sensor";
-                snprintf(topic, sizeof(topic), "homeassistant/sensor/%s/config", unique_id);
-                snprintf(payload, sizeof(payload),
-                    "{\"name\": \"%s\", \"state_topic\": \"%s/%d/%d/state\", "
-                    "\"unit_of_measurement\": \"%s\", "
-                    "\"value_template\": \"{{ value }}\", "
-                    "\"unique_id\": \"%s\", "
-                    "\"device\": {\"name\": \"%s\", \"identifiers\": \"%s\", \"manufacturer\": \"Custom\", \"model\": \"%s\"}}",
-                    devices[i].registers[j].name,
-                    mqtt_config.prefix, devices[i].device_id, devices[i].registers[j].address,
-                    devices[i].registers[j].unit,
-                    unique_id, BOARD_NAME, device_id, BOARD_MCU);
+                pos = append_state_value(device, register_pos, point.value, text, state_payload, pos);
+            }
+            if (point.timestamp_us > newest_us) {
+                newest_us = point.timestamp_us;
+            }
+            count++;
+        }
+        if (mode == MQTT_TELEMETRY_SPARKPLUG) {
+            sparkplug_topic(state_topic, sizeof(state_topic), "DDATA", device->device_id);
+        } else {
+            const char *topic = device_state_topic(device, state_topic, sizeof(state_topic));
+            if (topic != state_topic) {
+                snprintf(state_topic, sizeof(state_topic), "%s", topic);
+            }
+        }
+        if (register_pos >= device->register_count) {
+            device_pos++;
+            register_pos = 0;
+        }
+        modbus_poll_plan_release(plan);
+
+        if (count == 0) {
+            continue;
+        }
+        int64_t unix_ms = modbus_timestamp_to_unix_ms(newest_us);
+        if (mode == MQTT_TELEMETRY_SPARKPLUG) {
+            sparkplug_payload_timestamp(&state_sparkplug, sparkplug_time_ms(newest_us));
+            sparkplug_payload_seq(&state_sparkplug, sparkplug_seq++);
+            pos = sparkplug_payload_end(&state_sparkplug);
+        } else if (mode == MQTT_TELEMETRY_DEVICE_CBOR) {
+            pos = finish_state_cbor(newest_us, unix_ms);
+        } else {
+            pos = finish_state_json(pos, newest_us, unix_ms);
+        }
+        if (pos == 0) {
+            ESP_LOGE(TAG, "Message for %s does not fit the payload buffer", state_topic);
+            continue;
+        }
+
+        if (mqtt_client == NULL || mqtt_state != MQTT_STATE_CONNECTED) {
+            break;
+        }
+        // Sparkplug forbids retained DDATA: a new host would replay stale
+        // values before the births tell it what they mean.
+        int msg_id = esp_mqtt_client_publish(mqtt_client, state_topic, state_payload, pos, 0,
+                                             mode != MQTT_TELEMETRY_SPARKPLUG);
+        ESP_LOGD(TAG, "Published %s: %u point(s) (msg_id=%d)", state_topic, count, msg_id);
+    }
+    return deferred;
+}
+
+// Empties the change queue; returns true if it held anything.
+static bool discard_events(void)
+{
+    modbus_change_event_t event;
+    bool any = false;
+    while (modbus_events_pop(&event)) {
+        any = true;
+    }
+    return any;
+}
+
+// Builds the Home Assistant config of one point of a held plan.
+static void format_discovery(const modbus_device_t *device, uint16_t index, const char *gateway,
+                             discovery_message_t *msg)
+{
+    char unique_id[64];
+    char id_buf[16];
+    char state_buf[128];
+    const modbus_register_t *reg = &device->registers[index];
+    const char *id = point_id(device, index, id_buf, sizeof(id_buf));
+    const char *state = point_state_topic(device, index, state_buf, sizeof(state_buf));
+
+    snprintf(unique_id, sizeof(unique_id), "%s_%d_%s", 
+            gateway, device->device_id, id);
+
+    const char *ha_type;
+
+    if (reg->type == REGISTER_TYPE_COIL && reg->writable) {
+        ha_type = "switch";
+        snprintf(msg->topic, sizeof(msg->topic), "homeassistant/switch/%s/config", unique_id);
+        snprintf(msg->payload, sizeof(msg->payload),
+            "{\"name\": \"%s\", \"command_topic\": \"%s/%d/%s/set\", "
+            "\"state_topic\": \"%s\", "
+            "\"unique_id\": \"%s\", "
+            "\"device\": {\"name\": \"%s\", \"identifiers\": \"%s\", \"manufacturer\": \"Custom\", \"model\": \"%s\"}}",
+            reg->name,
+            mqtt_config.prefix, device->device_id, id,
+            state,
+            unique_id, BOARD_NAME, gateway, BOARD_MCU);
+    } else if (modbus_register_is_bitfield(reg) && reg->bit_width == 1) {
+        ha_type = "binary_sensor";
+        snprintf(msg->topic, sizeof(msg->topic), "homeassistant/binary_sensor/%s/config", unique_id);
+        snprintf(msg->payload, sizeof(msg->payload),
+            "{\"name\": \"%s\", \"state_topic\": \"%s\", "
+            "\"payload_on\": \"ON\", \"payload_off\": \"OFF\", "
+            "\"unique_id\": \"%s\", "
+            "\"device\": {\"name\": \"%s\", \"identifiers\": \"%s\", \"manufacturer\": \"Custom\", \"model\": \"%s\"}}",
+            reg->name,
+            state,
+            unique_id, BOARD_NAME, gateway, BOARD_MCU);
+    } else if (reg->type == REGISTER_TYPE_HOLDING && modbus_register_accepts_write(reg)) {
+        ha_type = "number";
+        snprintf(msg->topic, sizeof(msg->topic), "homeassistant/number/%s/config", unique_id);
+        snprintf(msg->payload, sizeof(msg->payload),
+            "{\"name\": \"%s\", \"command_topic\": \"%s/%d/%s/set\", "
+            "\"state_topic\": \"%s\", "
+            "\"value_template\": \"{{ value }}\", "
+            "\"unique_id\": \"%s\", "
+            "\"device\": {\"name\": \"%s\", \"identifiers\": \"%s\", \"manufacturer\": \"Custom\", \"model\": \"%s\"}}",
+            reg->name,
+            mqtt_config.prefix, device->device_id, id,
+            state,
+            unique_id, BOARD_NAME, gateway, BOARD_MCU);
+    } else {
+        ha_type = "sensor";
+        snprintf(msg->topic, sizeof(msg->topic), "homeassistant/sensor/%s/config", unique_id);
+        snprintf(msg->payload, sizeof(msg->payload),
+            "{\"name\": \"%s\", \"state_topic\": \"%s\", "
+            "\"unit_of_measurement\": \"%s\", "
+            "\"value_template\": \"{{ value }}\", "
+            "\"unique_id\": \"%s\", "
+            "\"device\": {\"name\": \"%s\", \"identifiers\": \"%s\", \"manufacturer\": \"Custom\", \"model\": \"%s\"}}",
+            reg->name,
+            state,
+            reg->unit,
+            unique_id, BOARD_NAME, gateway, BOARD_MCU);
+    }
+    msg->ha_type = ha_type;
+
+    char stale_id[16];
+    format_point_id(reg, !modbus_register_address_shared(device, reg), stale_id, sizeof(stale_id));
+    snprintf(msg->stale_topic, sizeof(msg->stale_topic), "homeassistant/%s/%s_%d_%s/config",
+             ha_type, gateway, device->device_id, stale_id);
+}
+
+// Walks every point like publish_scan: configs are built a few at a time
+// and published before the next batch is built.
+static void publish_discovery_batches(void)
+{
+    char gateway[24];
+    gateway_id(gateway, sizeof(gateway));
+    uint8_t device_pos = 0;
+    uint16_t register_pos = 0;
+    bool done = false;
+
+    while (!done) {
+        uint16_t count = 0;
+
+        modbus_poll_plan_t *plan = modbus_poll_plan_acquire();
+        uint16_t device_count = plan != NULL ? plan->device_count : 0;
+        done = true;
+        for (; device_pos < device_count && done; device_pos++, register_pos = 0) {
+            modbus_device_t *device = &plan->devices[device_pos].device;
+            for (; register_pos < device->register_count; register_pos++) {
+                if (count == DISCOVERY_BATCH_LEN) {
+                    done = false;
+                    break;
+                }
+                format_discovery(device, register_pos, gateway, &discovery[count++]);
+            }
+            if (!done) {
+                break;
+            }
+        }
+        modbus_poll_plan_release(plan);
+
+        for (uint16_t i = 0; i < count; i++) {
+            if (mqtt_client == NULL || mqtt_state != MQTT_STATE_CONNECTED) {
+                return;
+            }
+            int msg_id = esp_mqtt_client_publish(mqtt_client, discovery[i].topic, discovery[i].payload, 0, 1, true);
+            ESP_LOGI(TAG, "Published HA discovery: %s (msg_id=%d)", discovery[i].ha_type, msg_id);
+            esp_mqtt_client_publish(mqtt_client, discovery[i].stale_topic, "", 0, 1, true);
+        }
+    }
+}
+
+// Owns all periodic MQTT traffic. Polling only records values; this task
+// flushes every changed point once per publish_interval, publishes points
+// with publish_min_ms as soon as their holdoff allows, and coalesces
+// anything that changed several times in between into one message.
+static void publisher_task(void *pvParameters)
+{
+    uint32_t reported_drops = 0;
+    uint32_t last_flush_ms = publisher_now_ms();
+    bool deferred = false;
+
+    while (true) {
+        uint32_t interval_ms = flush_interval_ms();
+        uint32_t since_flush = publisher_now_ms() - last_flush_ms;
+        uint32_t wait_ms = since_flush >= interval_ms ? 0 : interval_ms - since_flush;
+        if (deferred && wait_ms > PUBLISHER_HOLDOFF_TICK_MS) {
+            wait_ms = PUBLISHER_HOLDOFF_TICK_MS;
+        }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms));
+
+        uint32_t now_ms = publisher_now_ms();
+        if (mqtt_client == NULL || mqtt_state != MQTT_STATE_CONNECTED) {
+            discard_events();
+            deferred = false;
+            last_flush_ms = now_ms;
+            continue;
+        }
+
+        if (mqtt_config.telemetry_mode != MQTT_TELEMETRY_POINT) {
+            // Events only say that something is due; the device pass
+            // finds what, so each device still goes out as one message.
+            bool changed = discard_events();
+            if (mqtt_config.telemetry_mode == MQTT_TELEMETRY_SPARKPLUG) {
+                // Births carry every value, so a resync is a new session
+                // rather than a full DDATA pass.
+                if (resync_pending) {
+                    resync_pending = false;
+                    sparkplug_node_born = false;
+                    last_flush_ms = now_ms;
+                }
+                sparkplug_sync_devices(now_ms);
             }
+            if (resync_pending) {
+                resync_pending = false;
+                deferred = publish_device_states(PUBLISH_ALL, now_ms);
+                last_flush_ms = now_ms;
+            } else if (now_ms - last_flush_ms >= interval_ms) {
+                deferred = publish_device_states(PUBLISH_FLUSH, now_ms);
+                last_flush_ms = now_ms;
+            } else if (changed || deferred) {
+                deferred = publish_device_states(PUBLISH_CHANGES, now_ms);
+            }
+        } else {
+            if (discovery_pending) {
+                discovery_pending = false;
+                publish_discovery_batches();
+            }
+            deferred = publish_events(now_ms);
+            if (resync_pending) {
+                resync_pending = false;
+                deferred = publish_scan(PUBLISH_ALL, now_ms);
+                last_flush_ms = now_ms;
+            } else if (now_ms - last_flush_ms >= interval_ms) {
+                deferred = publish_scan(PUBLISH_FLUSH, now_ms);
+                last_flush_ms = now_ms;
+            } else if (deferred) {
+                deferred = publish_scan(PUBLISH_CHANGES, now_ms);
+            }
+        }
 
-            int msg_id = esp_mqtt_client_publish(mqtt_client, topic, payload, 0, 1, true);
-            ESP_LOGI(TAG, "Published HA discovery: %s (msg_id=%d)", ha_type, msg_id);
+        modbus_events_stats_t stats;
+        modbus_events_get_stats(&stats);
+        if (stats.dropped != reported_drops) {
+            ESP_LOGW(TAG, "Change queue full, %" PRIu32 " update(s) dropped",
+                      stats.dropped - reported_drops);
+            reported_drops = stats.dropped;
         }
     }
+}
 
+esp_err_t mqtt_client_publish_all_registers(void)
+{
+    if (mqtt_client == NULL || mqtt_state != MQTT_STATE_CONNECTED) {
+        return ESP_FAIL;
+    }
+
+    // The publisher task sends the resync in batches, taking the registry
+    // lock only while building each one.
+    resync_pending = true;
+    xTaskNotifyGive(publisher_task_handle);
+    return ESP_OK;
+}
+
+// Like the state resync, discovery is sent by the publisher task so the
+// event task never holds the registry lock across network writes.
+esp_err_t mqtt_client_publish_discovery(void)
+{
+    if (mqtt_client == NULL || mqtt_state != MQTT_STATE_CONNECTED) {
+        return ESP_FAIL;
+    }
+
+    // Discovery entities follow the per-point state topics.
+    if (mqtt_config.telemetry_mode != MQTT_TELEMETRY_POINT) {
+        return ESP_OK;
+    }
+
+    discovery_pending = true;
+    xTaskNotifyGive(publisher_task_handle);
     return ESP_OK;
 }
 
@@ -381,6 +1566,18 @@ esp_err_t mqtt_client_publish_lwt(bool online)
         return ESP_FAIL;
     }
 
+    // NBIRTH comes from the publisher task once it has resynced.
+    if (mqtt_config.telemetry_mode == MQTT_TELEMETRY_SPARKPLUG) {
+        if (!online) {
+            char topic[128];
+            sparkplug_topic(topic, sizeof(topic), "NDEATH", 0);
+            int msg_id = esp_mqtt_client_publish(mqtt_client, topic, (const char *)sparkplug_ndeath,
+                                                 sparkplug_ndeath_len, 1, 0);
+            ESP_LOGI(TAG, "Published NDEATH (msg_id=%d)", msg_id);
+        }
+        return ESP_OK;
+    }
+
     char topic[64];
     snprintf(topic, sizeof(topic), "%s/tele/LWT", mqtt_config.prefix);
     
@@ -390,14 +1587,73 @@ esp_err_t mqtt_client_publish_lwt(bool online)
     return ESP_OK;
 }
 
+esp_err_t mqtt_client_publish_bulk_result(const char *payload)
+{
+    if (mqtt_client == NULL || mqtt_state != MQTT_STATE_CONNECTED) {
+        return ESP_FAIL;
+    }
+
+    char topic[128];
+    snprintf(topic, sizeof(topic), "%s/bulk/result", mqtt_config.prefix);
+    if (esp_mqtt_client_enqueue(mqtt_client, topic, payload, 0, 0, 0, true) < 0) {
+        ESP_LOGW(TAG, "Failed to queue bulk write result");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t mqtt_client_publish_write_result(uint8_t device_id, register_type_t type, uint16_t address,
+                                           uint16_t value, modbus_result_t result, uint32_t latency_ms)
+{
+    if (mqtt_client == NULL || mqtt_state != MQTT_STATE_CONNECTED) {
+        return ESP_FAIL;
+    }
+
+    // Same point ID as the state topic; a typed command naming no point is
+    // answered under the ID it used.
+    bool typed = false;
+    if (type != MQTT_REGISTER_TYPE_ANY) {
+        modbus_devices_lock();
+        modbus_device_t *device = modbus_get_device(device_id);
+        modbus_register_t *reg = device != NULL ? modbus_get_register(device_id, type, address) : NULL;
+        typed = reg == NULL || modbus_register_address_shared(device, reg);
+        modbus_devices_unlock();
+    }
+
+    char topic[128];
+    char payload[128];
+    snprintf(topic, sizeof(topic), "%s/%u/%s%u/result", mqtt_config.prefix, device_id,
+             type_prefix(typed ? type : MQTT_REGISTER_TYPE_ANY), address);
+    snprintf(payload, sizeof(payload),
+             "{\"value\":%u,\"code\":%d,\"result\":\"%s\",\"latency_ms\":%" PRIu32 "}",
+             value, (int)result, modbus_result_to_string(result), latency_ms);
+
+    // Usually called from the Modbus write task; enqueueing keeps it from
+    // waiting on the network while the bus sits idle.
+    int msg_id = esp_mqtt_client_enqueue(mqtt_client, topic, payload, 0, 0, 0, true);
+    if (msg_id < 0) {
+        ESP_LOGW(TAG, "Failed to queue write result for %s", topic);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
 void mqtt_client_set_register_write_callback(mqtt_register_write_cb_t callback)
 {
     write_callback = callback;
 }
 
+void mqtt_client_set_bulk_write_callback(mqtt_bulk_write_cb_t callback)
+{
+    bulk_write_callback = callback;
+}
+
 esp_err_t mqtt_client_update_config(const mqtt_config_t *config)
 {
+    modbus_devices_lock();
     memcpy(&mqtt_config, config, sizeof(mqtt_config_t));
+    topic_cache_stale = true;
+    modbus_devices_unlock();
     
     if (config->enabled && strlen(config->broker) > 0) {
         if (mqtt_client != NULL) {
@@ -5,6 +5,7 @@
 #include "esp_err.h"
 #include <mqtt_client.h>
 #include "modbus_devices.h"
+#include "modbus_manager.h"
 #include "nvs_storage.h"
 
 #define MQTT_CLIENT_TAG "MQTT_CLIENT"
@@ -16,7 +17,16 @@ typedef enum {
     MQTT_STATE_ERROR
 } mqtt_connection_state_t;
 
-typedef void (*mqtt_register_write_cb_t)(uint8_t device_id, uint16_t address, uint16_t value);
+// A /set topic may name the point by bare address, as published for
+// addresses only one register type uses; `type` is then
+// MQTT_REGISTER_TYPE_ANY and the coil, or else the holding register, at
+// that address is meant.
+#define MQTT_REGISTER_TYPE_ANY ((register_type_t)0)
+typedef void (*mqtt_register_write_cb_t)(uint8_t device_id, register_type_t type, uint16_t address,
+                                         uint16_t value);
+// Receives a complete <prefix>/bulk/set document, reassembled if it arrived
+// in fragments. The buffer is only valid during the call.
+typedef void (*mqtt_bulk_write_cb_t)(const uint8_t *data, size_t len);
 
 esp_err_t mqtt_client_init(void);
 esp_err_t mqtt_client_start(const mqtt_config_t *config);
@@ -24,13 +34,23 @@ esp_err_t mqtt_client_stop(void);
 bool mqtt_client_is_connected(void);
 mqtt_connection_state_t mqtt_client_get_state(void);
 
-esp_err_t mqtt_client_publish_register(uint8_t device_id, const char *device_name, 
-                                       const modbus_register_t *reg);
+esp_err_t mqtt_client_publish_register(modbus_device_t *device, uint16_t index);
 esp_err_t mqtt_client_publish_all_registers(void);
 esp_err_t mqtt_client_publish_discovery(void);
 esp_err_t mqtt_client_publish_lwt(bool online);
+// Reports the outcome of a /set command on <prefix>/<id>/<point>/result,
+// where <point> is the point ID used in its state topic: the address, with
+// the type letter in front only if another type shares it (e.g. 1000 or
+// h1000). Callable from any task: the message is queued on the client,
+// not sent inline.
+esp_err_t mqtt_client_publish_write_result(uint8_t device_id, register_type_t type, uint16_t address,
+                                           uint16_t value, modbus_result_t result, uint32_t latency_ms);
+// Publishes a JSON payload to <prefix>/bulk/result; queued like write
+// results.
+esp_err_t mqtt_client_publish_bulk_result(const char *payload);
 
 void mqtt_client_set_register_write_callback(mqtt_register_write_cb_t callback);
+void mqtt_client_set_bulk_write_callback(mqtt_bulk_write_cb_t callback);
 
 esp_err_t mqtt_client_update_config(const mqtt_config_t *config);
 
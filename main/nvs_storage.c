@@ -222,6 +222,9 @@ esp_err_t nvs_save_mqtt_config(const mqtt_config_t *config)
     err = nvs_set_u16(nvs_handle, NVS_MQTT_INTERVAL_KEY, config->publish_interval);
     if (err != ESP_OK) goto save_error;
 
+    err = nvs_set_u8(nvs_handle, NVS_MQTT_TELEMETRY_KEY, config->telemetry_mode);
+    if (err != ESP_OK) goto save_error;
+
 save_error:
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Error saving MQTT config: %s", esp_err_to_name(err));
@@ -249,6 +252,7 @@ esp_err_t nvs_load_mqtt_config(mqtt_config_t *config)
         config->password[0] = '\0';
         strcpy(config->prefix, MQTT_DEFAULT_PREFIX);
         config->publish_interval = MQTT_DEFAULT_INTERVAL;
+        config->telemetry_mode = MQTT_TELEMETRY_POINT;
         return ESP_ERR_NOT_FOUND;
     }
 
@@ -288,6 +292,11 @@ esp_err_t nvs_load_mqtt_config(mqtt_config_t *config)
     err = nvs_get_u16(nvs_handle, NVS_MQTT_INTERVAL_KEY, &interval);
     config->publish_interval = (err == ESP_OK) ? interval : MQTT_DEFAULT_INTERVAL;
 
+    uint8_t telemetry_mode;
+    err = nvs_get_u8(nvs_handle, NVS_MQTT_TELEMETRY_KEY, &telemetry_mode);
+    config->telemetry_mode = (err == ESP_OK && telemetry_mode < MQTT_TELEMETRY_MODE_COUNT) ?
+                             telemetry_mode : MQTT_TELEMETRY_POINT;
+
     ESP_LOGI(TAG, "MQTT config loaded: enabled=%d, broker=%s, port=%d, prefix=%s",
               config->enabled, config->broker, config->port, config->prefix);
 
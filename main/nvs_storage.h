@@ -21,6 +21,7 @@
 #define NVS_MQTT_PASSWORD_KEY "password"
 #define NVS_MQTT_PREFIX_KEY "prefix"
 #define NVS_MQTT_INTERVAL_KEY "interval"
+#define NVS_MQTT_TELEMETRY_KEY "telemetry"
 
 #define MQTT_BROKER_MAX_LEN 64
 #define MQTT_USERNAME_MAX_LEN 32
@@ -30,6 +31,15 @@
 #define MQTT_DEFAULT_PORT 1883
 #define MQTT_DEFAULT_INTERVAL 30
 
+// How point values are laid out on the broker.
+typedef enum {
+    MQTT_TELEMETRY_POINT = 0,        // one <prefix>/<id>/<point>/state message per point
+    MQTT_TELEMETRY_DEVICE = 1,       // one <prefix>/<id>/state JSON object per device
+    MQTT_TELEMETRY_DEVICE_CBOR = 2,  // the same per-device message encoded as CBOR
+    MQTT_TELEMETRY_SPARKPLUG = 3,    // Sparkplug B edge node, group ID = prefix
+    MQTT_TELEMETRY_MODE_COUNT
+} mqtt_telemetry_mode_t;
+
 typedef struct {
     bool enabled;
     char broker[MQTT_BROKER_MAX_LEN];
@@ -38,6 +48,7 @@ typedef struct {
     char password[MQTT_PASSWORD_MAX_LEN];
     char prefix[MQTT_PREFIX_MAX_LEN];
     uint16_t publish_interval;
+    uint8_t telemetry_mode;
 } mqtt_config_t;
 
 esp_err_t nvs_storage_init(void);
@@ -0,0 +1,268 @@
+#include "sparkplug.h"
+#include <string.h>
+
+#define WIRE_VARINT 0
+#define WIRE_FIXED64 1
+#define WIRE_LEN 2
+#define WIRE_FIXED32 5
+
+// Field numbers of org.eclipse.tahu.protobuf.Payload and its Metric.
+#define PAYLOAD_TIMESTAMP 1
+#define PAYLOAD_METRICS 2
+#define PAYLOAD_SEQ 3
+#define METRIC_NAME 1
+#define METRIC_ALIAS 2
+#define METRIC_TIMESTAMP 3
+#define METRIC_DATATYPE 4
+#define METRIC_IS_NULL 7
+#define METRIC_INT_VALUE 10
+#define METRIC_LONG_VALUE 11
+#define METRIC_FLOAT_VALUE 12
+#define METRIC_DOUBLE_VALUE 13
+#define METRIC_BOOLEAN_VALUE 14
+#define METRIC_STRING_VALUE 15
+
+// A metric is encoded here first so its length prefix is known; names and
+// string values are bounded by the register limits.
+#define METRIC_SCRATCH_LEN 192
+
+static void put_raw(sparkplug_payload_t *p, const void *data, size_t len)
+{
+    if (p->overflow || p->size - p->len < len) {
+        p->overflow = true;
+        return;
+    }
+    memcpy(&p->buf[p->len], data, len);
+    p->len += len;
+}
+
+static void put_varint(sparkplug_payload_t *p, uint64_t value)
+{
+    uint8_t bytes[10];
+    size_t n = 0;
+    do {
+        bytes[n] = value & 0x7f;
+        value >>= 7;
+        if (value != 0) {
+            bytes[n] |= 0x80;
+        }
+        n++;
+    } while (value != 0);
+    put_raw(p, bytes, n);
+}
+
+static void put_key(sparkplug_payload_t *p, uint32_t field, uint8_t wire_type)
+{
+    put_varint(p, (uint64_t)field << 3 | wire_type);
+}
+
+static void put_varint_field(sparkplug_payload_t *p, uint32_t field, uint64_t value)
+{
+    put_key(p, field, WIRE_VARINT);
+    put_varint(p, value);
+}
+
+static void put_len_field(sparkplug_payload_t *p, uint32_t field, const void *data, size_t len)
+{
+    put_key(p, field, WIRE_LEN);
+    put_varint(p, len);
+    put_raw(p, data, len);
+}
+
+// Fixed-width fields are little-endian on the wire.
+static void put_fixed_field(sparkplug_payload_t *p, uint32_t field, uint64_t bits, size_t width)
+{
+    uint8_t bytes[8];
+    for (size_t i = 0; i < width; i++) {
+        bytes[i] = (uint8_t)(bits >> (8 * i));
+    }
+    put_key(p, field, width == 4 ? WIRE_FIXED32 : WIRE_FIXED64);
+    put_raw(p, bytes, width);
+}
+
+void sparkplug_payload_begin(sparkplug_payload_t *p, uint8_t *buf, size_t size)
+{
+    p->buf = buf;
+    p->size = size;
+    p->len = 0;
+    p->overflow = false;
+}
+
+void sparkplug_payload_timestamp(sparkplug_payload_t *p, uint64_t timestamp_ms)
+{
+    put_varint_field(p, PAYLOAD_TIMESTAMP, timestamp_ms);
+}
+
+void sparkplug_payload_seq(sparkplug_payload_t *p, uint64_t seq)
+{
+    put_varint_field(p, PAYLOAD_SEQ, seq);
+}
+
+void sparkplug_payload_metric(sparkplug_payload_t *p, const sparkplug_metric_t *metric)
+{
+    uint8_t scratch[METRIC_SCRATCH_LEN];
+    sparkplug_payload_t m;
+    sparkplug_payload_begin(&m, scratch, sizeof(scratch));
+
+    if (metric->name != NULL) {
+        put_len_field(&m, METRIC_NAME, metric->name, strlen(metric->name));
+    }
+    if (metric->alias != 0) {
+        put_varint_field(&m, METRIC_ALIAS, metric->alias);
+    }
+    if (metric->timestamp_ms != 0) {
+        put_varint_field(&m, METRIC_TIMESTAMP, metric->timestamp_ms);
+    }
+    if (metric->name != NULL) {
+        put_varint_field(&m, METRIC_DATATYPE, metric->datatype);
+    }
+
+    if (metric->is_null) {
+        put_varint_field(&m, METRIC_IS_NULL, 1);
+    } else {
+        switch (metric->datatype) {
+            case SPARKPLUG_TYPE_INT16:
+            case SPARKPLUG_TYPE_INT32:
+            case SPARKPLUG_TYPE_UINT16:
+                put_varint_field(&m, METRIC_INT_VALUE, metric->int_value);
+                break;
+            case SPARKPLUG_TYPE_FLOAT: {
+                uint32_t bits;
+                memcpy(&bits, &metric->float_value, sizeof(bits));
+                put_fixed_field(&m, METRIC_FLOAT_VALUE, bits, 4);
+                break;
+            }
+            case SPARKPLUG_TYPE_DOUBLE: {
+                uint64_t bits;
+                memcpy(&bits, &metric->double_value, sizeof(bits));
+                put_fixed_field(&m, METRIC_DOUBLE_VALUE, bits, 8);
+                break;
+            }
+            case SPARKPLUG_TYPE_BOOLEAN:
+                put_varint_field(&m, METRIC_BOOLEAN_VALUE, metric->boolean_value ? 1 : 0);
+                break;
+            case SPARKPLUG_TYPE_STRING:
+                put_len_field(&m, METRIC_STRING_VALUE, metric->string_value, strlen(metric->string_value));
+                break;
+            default:
+                put_varint_field(&m, METRIC_LONG_VALUE, metric->long_value);
+                break;
+        }
+    }
+
+    if (m.overflow) {
+        p->overflow = true;
+        return;
+    }
+    put_len_field(p, PAYLOAD_METRICS, scratch, m.len);
+}
+
+size_t sparkplug_payload_end(sparkplug_payload_t *p)
+{
+    return p->overflow ? 0 : p->len;
+}
+
+static bool get_varint(const uint8_t **pos, const uint8_t *end, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64 && *pos < end; shift += 7) {
+        uint8_t byte = *(*pos)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Skips one field of the given wire type; false if it runs past `end` or
+// uses a type Sparkplug never sends.
+static bool skip_field(const uint8_t **pos, const uint8_t *end, uint8_t wire_type)
+{
+    uint64_t len;
+    switch (wire_type) {
+        case WIRE_VARINT:
+            return get_varint(pos, end, &len);
+        case WIRE_FIXED64:
+            len = 8;
+            break;
+        case WIRE_FIXED32:
+            len = 4;
+            break;
+        case WIRE_LEN:
+            if (!get_varint(pos, end, &len)) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+    }
+    if (len > (uint64_t)(end - *pos)) {
+        return false;
+    }
+    *pos += len;
+    return true;
+}
+
+static bool metric_requests_rebirth(const uint8_t *pos, const uint8_t *end)
+{
+    bool named = false;
+    bool value = false;
+
+    while (pos < end) {
+        uint64_t key;
+        if (!get_varint(&pos, end, &key)) {
+            return false;
+        }
+        uint32_t field = key >> 3;
+        uint8_t wire_type = key & 7;
+
+        if (field == METRIC_NAME && wire_type == WIRE_LEN) {
+            uint64_t len;
+            if (!get_varint(&pos, end, &len) || len > (uint64_t)(end - pos)) {
+                return false;
+            }
+            named = len == strlen(SPARKPLUG_METRIC_REBIRTH) &&
+                    memcmp(pos, SPARKPLUG_METRIC_REBIRTH, len) == 0;
+            pos += len;
+        } else if (field == METRIC_BOOLEAN_VALUE && wire_type == WIRE_VARINT) {
+            uint64_t v;
+            if (!get_varint(&pos, end, &v)) {
+                return false;
+            }
+            value = v != 0;
+        } else if (!skip_field(&pos, end, wire_type)) {
+            return false;
+        }
+    }
+    return named && value;
+}
+
+bool sparkplug_rebirth_requested(const uint8_t *data, size_t len)
+{
+    const uint8_t *pos = data;
+    const uint8_t *end = data + len;
+
+    while (pos < end) {
+        uint64_t key;
+        if (!get_varint(&pos, end, &key)) {
+            return false;
+        }
+        uint32_t field = key >> 3;
+        uint8_t wire_type = key & 7;
+
+        if (field == PAYLOAD_METRICS && wire_type == WIRE_LEN) {
+            uint64_t metric_len;
+            if (!get_varint(&pos, end, &metric_len) || metric_len > (uint64_t)(end - pos)) {
+                return false;
+            }
+            if (metric_requests_rebirth(pos, pos + metric_len)) {
+                return true;
+            }
+            pos += metric_len;
+        } else if (!skip_field(&pos, end, wire_type)) {
+            return false;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,73 @@
+#ifndef SPARKPLUG_H
+#define SPARKPLUG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SPARKPLUG_NAMESPACE "spBv1.0"
+#define SPARKPLUG_METRIC_BDSEQ "bdSeq"
+#define SPARKPLUG_METRIC_REBIRTH "Node Control/Rebirth"
+
+// Metric data types from the Sparkplug B specification. Only the ones the
+// gateway produces are listed.
+typedef enum {
+    SPARKPLUG_TYPE_INT16 = 2,
+    SPARKPLUG_TYPE_INT32 = 3,
+    SPARKPLUG_TYPE_INT64 = 4,
+    SPARKPLUG_TYPE_UINT16 = 6,
+    SPARKPLUG_TYPE_UINT32 = 7,
+    SPARKPLUG_TYPE_UINT64 = 8,
+    SPARKPLUG_TYPE_FLOAT = 9,
+    SPARKPLUG_TYPE_DOUBLE = 10,
+    SPARKPLUG_TYPE_BOOLEAN = 11,
+    SPARKPLUG_TYPE_STRING = 12
+} sparkplug_type_t;
+
+// One metric. `name` and `datatype` are sent together, in births and
+// deaths; data messages leave name NULL and the alias identifies the
+// metric. An alias or timestamp_ms of 0 is left out. `datatype` always
+// selects the value field: Int8/16/32 and UInt8/16 travel in
+// int_value, the 64-bit types and UInt32 in long_value, signed values as
+// two's complement, as the specification lays out.
+typedef struct {
+    const char *name;
+    uint64_t alias;
+    uint64_t timestamp_ms;
+    sparkplug_type_t datatype;
+    bool is_null;
+    union {
+        uint32_t int_value;
+        uint64_t long_value;
+        float float_value;
+        double double_value;
+        bool boolean_value;
+        const char *string_value;
+    };
+} sparkplug_metric_t;
+
+// Hand-written protobuf encoder for the Sparkplug B Payload message,
+// writing into a caller-owned buffer. Fields may be added in any order;
+// like cbor_writer, an overflow is sticky and reported by payload_end.
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+} sparkplug_payload_t;
+
+void sparkplug_payload_begin(sparkplug_payload_t *p, uint8_t *buf, size_t size);
+void sparkplug_payload_timestamp(sparkplug_payload_t *p, uint64_t timestamp_ms);
+void sparkplug_payload_seq(sparkplug_payload_t *p, uint64_t seq);
+void sparkplug_payload_metric(sparkplug_payload_t *p, const sparkplug_metric_t *metric);
+// Returns the encoded length, or 0 if the buffer was too small.
+size_t sparkplug_payload_end(sparkplug_payload_t *p);
+
+// Largest encoding of a metric besides its name and string value.
+#define SPARKPLUG_METRIC_OVERHEAD 48
+
+// True if an NCMD payload sets Node Control/Rebirth to true. Malformed
+// input returns false.
+bool sparkplug_rebirth_requested(const uint8_t *data, size_t len);
+
+#endif
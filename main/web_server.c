@@ -2,10 +2,17 @@
 #include "nvs_storage.h"
 #include "wifi_manager.h"
 #include "modbus_devices.h"
+#include "modbus_poll_plan.h"
+#include "modbus_data.h"
+#include "modbus_profiles.h"
 #include "modbus_manager.h"
+#include "modbus_write_queue.h"
+#include "modbus_bulk_write.h"
 #include "mqtt_gateway.h"
+#include "modbus_events.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "cJSON.h"
 #include <string.h>
 #include <stdlib.h>
@@ -174,6 +181,7 @@ static esp_err_t post_save_handler(httpd_req_t *req)
             httpd_resp_set_type(req, "text/html");
             httpd_resp_send(req, "Credentials saved. Rebooting...", strlen("Credentials saved. Rebooting..."));
             
+            modbus_devices_save();
             vTaskDelay(pdMS_TO_TICKS(2000));
             esp_restart();
             return ESP_OK;
@@ -193,6 +201,7 @@ static esp_err_t post_clear_handler(httpd_req_t *req)
     httpd_resp_set_type(req, "text/html");
     httpd_resp_send(req, "Credentials cleared. Rebooting...", strlen("Credentials cleared. Rebooting..."));
 
+    modbus_devices_save();
     vTaskDelay(pdMS_TO_TICKS(2000));
     wifi_manager_clear_credentials();
     return ESP_OK;
@@ -200,49 +209,88 @@ static esp_err_t post_clear_handler(httpd_req_t *req)
 
 
 
+// Renders the published snapshot, after publishing any edit still
+// waiting for the commit task so the UI reads back what it just saved.
+// The held plan keeps every record valid, so rendering takes no lock.
 static esp_err_t api_get_devices_handler(httpd_req_t *req)
 {
-    uint8_t count = 0;
-    const modbus_device_t *devices = modbus_list_devices(&count);
-
-    if (devices == NULL) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to get devices");
-        return ESP_FAIL;
-    }
+    modbus_devices_commit();
+    modbus_poll_plan_t *plan = modbus_poll_plan_acquire();
+    uint16_t count = plan != NULL ? plan->device_count : 0;
 
+    int64_t now_us = esp_timer_get_time();
     cJSON *root = cJSON_CreateArray();
-    for (uint8_t i = 0; i < count; i++) {
+    for (uint16_t i = 0; i < count; i++) {
+        const modbus_device_t *record = &plan->devices[i].device;
         cJSON *device = cJSON_CreateObject();
-        cJSON_AddNumberToObject(device, "device_id", devices[i].device_id);
-        cJSON_AddStringToObject(device, "name", devices[i].name);
-        cJSON_AddStringToObject(device, "description", devices[i].description);
-        cJSON_AddNumberToObject(device, "poll_interval_ms", devices[i].poll_interval_ms);
-        cJSON_AddNumberToObject(device, "baudrate", devices[i].baudrate);
-        cJSON_AddNumberToObject(device, "parity", devices[i].parity);
-        cJSON_AddNumberToObject(device, "enabled", devices[i].enabled);
-        cJSON_AddNumberToObject(device, "status", devices[i].status);
-        cJSON_AddNumberToObject(device, "last_error", devices[i].last_error);
-        cJSON_AddNumberToObject(device, "poll_count", devices[i].poll_count);
-        cJSON_AddNumberToObject(device, "error_count", devices[i].error_count);
+        cJSON_AddNumberToObject(device, "device_id", record->device_id);
+        cJSON_AddStringToObject(device, "name", record->name);
+        cJSON_AddStringToObject(device, "description", record->description);
+        cJSON_AddNumberToObject(device, "poll_interval_ms", record->poll_interval_ms);
+        cJSON_AddNumberToObject(device, "baudrate", record->baudrate);
+        cJSON_AddNumberToObject(device, "parity", record->parity);
+        cJSON_AddNumberToObject(device, "enabled", record->enabled);
+        cJSON_AddBoolToObject(device, "supports_fc23", record->supports_fc23);
+        cJSON_AddBoolToObject(device, "read_gaps", record->read_gaps);
+        if (record->profile != NULL) {
+            cJSON_AddStringToObject(device, "profile", record->profile->id);
+        } else {
+            cJSON_AddNullToObject(device, "profile");
+        }
+        cJSON_AddNumberToObject(device, "status", record->status);
+        cJSON_AddNumberToObject(device, "last_error", record->last_error);
+        cJSON_AddNumberToObject(device, "poll_count", record->poll_count);
+        cJSON_AddNumberToObject(device, "error_count", record->error_count);
 
         cJSON *registers = cJSON_CreateArray();
-        for (uint8_t j = 0; j < devices[i].register_count; j++) {
+        for (uint16_t j = 0; j < record->register_count; j++) {
             cJSON *reg = cJSON_CreateObject();
-            cJSON_AddNumberToObject(reg, "address", devices[i].registers[j].address);
-            cJSON_AddNumberToObject(reg, "type", devices[i].registers[j].type);
-            cJSON_AddStringToObject(reg, "name", devices[i].registers[j].name);
-            cJSON_AddStringToObject(reg, "unit", devices[i].registers[j].unit);
-            cJSON_AddNumberToObject(reg, "scale", devices[i].registers[j].scale);
-            cJSON_AddNumberToObject(reg, "offset", devices[i].registers[j].offset);
-            cJSON_AddNumberToObject(reg, "writable", devices[i].registers[j].writable);
-            cJSON_AddNumberToObject(reg, "last_value", devices[i].registers[j].last_value);
-            cJSON_AddNumberToObject(reg, "last_update", devices[i].registers[j].last_update);
+            cJSON_AddNumberToObject(reg, "address", record->registers[j].address);
+            cJSON_AddNumberToObject(reg, "type", record->registers[j].type);
+            cJSON_AddStringToObject(reg, "name", record->registers[j].name);
+            cJSON_AddStringToObject(reg, "unit", record->registers[j].unit);
+            cJSON_AddStringToObject(reg, "description", record->registers[j].description);
+            cJSON_AddNumberToObject(reg, "scale", record->registers[j].scale);
+            cJSON_AddNumberToObject(reg, "offset", record->registers[j].offset);
+            cJSON_AddNumberToObject(reg, "writable", record->registers[j].writable);
+            cJSON_AddNumberToObject(reg, "data_type", record->registers[j].data_type);
+            cJSON_AddNumberToObject(reg, "word_order", record->registers[j].word_order);
+            cJSON_AddNumberToObject(reg, "length", record->registers[j].length);
+            if (modbus_register_is_bitfield(&record->registers[j])) {
+                cJSON_AddNumberToObject(reg, "bit_offset", record->registers[j].bit_offset);
+                cJSON_AddNumberToObject(reg, "bit_width", record->registers[j].bit_width);
+            }
+            cJSON_AddNumberToObject(reg, "publish_min_ms", record->registers[j].publish_min_ms);
+            cJSON_AddNumberToObject(reg, "deadband", record->registers[j].deadband);
+            cJSON_AddNumberToObject(reg, "deadband_mode", record->registers[j].deadband_mode);
+            cJSON_AddNumberToObject(reg, "heartbeat_s", record->registers[j].heartbeat_s);
+
+            modbus_point_value_t point;
+            char text[MODBUS_STRING_MAX_LEN + 1];
+            modbus_read_register_value(record, j, &point, text, sizeof(text));
+            cJSON_AddNumberToObject(reg, "last_value",
+                                    modbus_value_to_double(record->registers[j].data_type, point.value));
+            if (record->registers[j].data_type == MODBUS_DATA_STRING) {
+                cJSON_AddStringToObject(reg, "text", text);
+            }
+            cJSON_AddNumberToObject(reg, "last_update", point.timestamp_us / 1000);
+            cJSON_AddNumberToObject(reg, "timestamp_us", point.timestamp_us);
+            int64_t unix_ms = modbus_timestamp_to_unix_ms(point.timestamp_us);
+            if (unix_ms > 0) {
+                cJSON_AddNumberToObject(reg, "time_unix_ms", unix_ms);
+            }
+            if (point.timestamp_us > 0) {
+                cJSON_AddNumberToObject(reg, "age_ms", (now_us - point.timestamp_us) / 1000);
+            }
+            cJSON_AddNumberToObject(reg, "quality", point.quality);
+            cJSON_AddNumberToObject(reg, "change_seq", point.change_seq);
             cJSON_AddItemToArray(registers, reg);
         }
-        cJSON_AddNumberToObject(device, "register_count", devices[i].register_count);
+        cJSON_AddNumberToObject(device, "register_count", record->register_count);
         cJSON_AddItemToObject(device, "registers", registers);
         cJSON_AddItemToArray(root, device);
     }
+    modbus_poll_plan_release(plan);
 
     char *json_str = cJSON_PrintUnformatted(root);
     httpd_resp_set_type(req, "application/json");
@@ -333,15 +381,41 @@ static esp_err_t api_post_device_handler(httpd_req_t *req)
     device.poll_interval_ms = poll_interval->valueint;
     device.baudrate = baudrate->valueint;
     device.enabled = enabled->type == cJSON_True;
+
+    cJSON *fc23 = cJSON_GetObjectItem(root, "supports_fc23");
+    if (fc23 && cJSON_IsBool(fc23)) {
+        device.supports_fc23 = cJSON_IsTrue(fc23);
+    }
+
+    cJSON *read_gaps = cJSON_GetObjectItem(root, "read_gaps");
+    if (read_gaps && cJSON_IsBool(read_gaps)) {
+        device.read_gaps = cJSON_IsTrue(read_gaps);
+    }
+
+    cJSON *profile = cJSON_GetObjectItem(root, "profile");
+    if (profile && !cJSON_IsNull(profile) &&
+        (!cJSON_IsString(profile) || (profile->valuestring[0] != '\0' &&
+                                      modbus_profile_find(profile->valuestring) == NULL))) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown profile");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
     device.register_count = 0;
 
     esp_err_t err = modbus_add_device(&device);
+    if (err == ESP_OK && cJSON_IsString(profile) && profile->valuestring[0] != '\0') {
+        err = modbus_set_device_profile(device.device_id, profile->valuestring);
+        if (err != ESP_OK) {
+            modbus_remove_device(device.device_id);
+        }
+    }
     if (err == ESP_OK) {
-        modbus_devices_save();
+        modbus_devices_schedule_save();
         httpd_resp_set_type(req, "application/json");
         httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
     } else if (err == ESP_ERR_NO_MEM) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Maximum devices reached");
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Maximum devices reached or out of memory");
     } else if (err == ESP_ERR_INVALID_ARG) {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Device ID already exists");
     } else {
@@ -371,7 +445,7 @@ static esp_err_t api_delete_device_handler(httpd_req_t *req)
             esp_err_t err = modbus_remove_device(device_id);
             
             if (err == ESP_OK) {
-                modbus_devices_save();
+                modbus_devices_schedule_save();
                 httpd_resp_set_type(req, "application/json");
                 httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
                 return ESP_OK;
@@ -428,6 +502,8 @@ static esp_err_t api_put_device_handler(httpd_req_t *req)
             cJSON *baudrate = cJSON_GetObjectItem(root, "baudrate");
             cJSON *parity = cJSON_GetObjectItem(root, "parity");
             cJSON *enabled = cJSON_GetObjectItem(root, "enabled");
+            cJSON *fc23 = cJSON_GetObjectItem(root, "supports_fc23");
+            cJSON *read_gaps = cJSON_GetObjectItem(root, "read_gaps");
 
             if (new_id && cJSON_IsNumber(new_id)) {
                 if (new_id->valueint < 1 || new_id->valueint > 247) {
@@ -478,6 +554,16 @@ static esp_err_t api_put_device_handler(httpd_req_t *req)
                 return ESP_FAIL;
             }
 
+            // Present and null or empty detaches the device from its profile.
+            cJSON *profile = cJSON_GetObjectItem(root, "profile");
+            if (profile && !cJSON_IsNull(profile) &&
+                (!cJSON_IsString(profile) || (profile->valuestring[0] != '\0' &&
+                                              modbus_profile_find(profile->valuestring) == NULL))) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown profile");
+                cJSON_Delete(root);
+                return ESP_FAIL;
+            }
+
             modbus_device_t device;
             memset(&device, 0, sizeof(device));
 
@@ -509,11 +595,23 @@ static esp_err_t api_put_device_handler(httpd_req_t *req)
                 device.enabled = enabled->type == cJSON_True;
             }
 
+            if (fc23 && cJSON_IsBool(fc23)) {
+                device.supports_fc23 = cJSON_IsTrue(fc23);
+            }
+
+            if (read_gaps && cJSON_IsBool(read_gaps)) {
+                device.read_gaps = cJSON_IsTrue(read_gaps);
+            }
+
             device.register_count = 0;
 
             esp_err_t err = modbus_update_device(device_id, &device);
+            if (err == ESP_OK && profile) {
+                err = modbus_set_device_profile(device.device_id,
+                                                cJSON_IsString(profile) ? profile->valuestring : NULL);
+            }
             if (err == ESP_OK) {
-                modbus_devices_save();
+                modbus_devices_schedule_save();
                 httpd_resp_set_type(req, "application/json");
                 httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
             } else if (err == ESP_ERR_NOT_FOUND) {
@@ -536,8 +634,8 @@ static esp_err_t api_put_device_handler(httpd_req_t *req)
 
 static esp_err_t api_post_register_handler(httpd_req_t *req)
 {
-    char buf[512];
-    int ret = httpd_req_recv(req, buf, sizeof(buf));
+    char buf[1024];
+    int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
     if (ret <= 0) {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to receive data");
         return ESP_FAIL;
@@ -617,35 +715,110 @@ static esp_err_t api_post_register_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
+    cJSON *unit = cJSON_GetObjectItem(root, "unit");
+    cJSON *desc = cJSON_GetObjectItem(root, "description");
+    if (strlen(name->valuestring) >= REGISTER_NAME_MAX_LEN ||
+        (unit && unit->valuestring && strlen(unit->valuestring) >= REGISTER_UNIT_MAX_LEN) ||
+        (desc && desc->valuestring && strlen(desc->valuestring) >= REGISTER_DESC_MAX_LEN)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Text too long: name max 63, unit max 15, description max 255 characters");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    // The registry interns its own copies of these strings.
     modbus_register_t reg = {0};
     reg.address = address->valueint;
     reg.type = type->valueint;
-    strncpy(reg.name, name->valuestring, sizeof(reg.name) - 1);
-    
-    cJSON *unit = cJSON_GetObjectItem(root, "unit");
-    if (unit && unit->valuestring) {
-        strncpy(reg.unit, unit->valuestring, sizeof(reg.unit) - 1);
-    }
-    
+    reg.name = name->valuestring;
+    reg.unit = unit ? unit->valuestring : NULL;
     reg.scale = scale->valuedouble;
     reg.offset = offset->valuedouble;
     reg.writable = writable->type == cJSON_True;
-    
-    cJSON *desc = cJSON_GetObjectItem(root, "description");
-    if (desc && desc->valuestring) {
-        strncpy(reg.description, desc->valuestring, sizeof(reg.description) - 1);
+    reg.description = desc ? desc->valuestring : NULL;
+
+    cJSON *data_type = cJSON_GetObjectItem(root, "data_type");
+    if (data_type) {
+        if (!cJSON_IsNumber(data_type) || !modbus_data_type_is_valid(data_type->valueint)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid data_type: must be 0-8");
+            cJSON_Delete(root);
+            return ESP_FAIL;
+        }
+        reg.data_type = data_type->valueint;
+    }
+
+    cJSON *word_order = cJSON_GetObjectItem(root, "word_order");
+    if (word_order) {
+        if (!cJSON_IsNumber(word_order) || word_order->valueint < MODBUS_ORDER_ABCD ||
+            word_order->valueint > MODBUS_ORDER_DCBA) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid word_order: must be 0 (ABCD), 1 (CDAB), 2 (BADC), or 3 (DCBA)");
+            cJSON_Delete(root);
+            return ESP_FAIL;
+        }
+        reg.word_order = word_order->valueint;
+    }
+
+    cJSON *length = cJSON_GetObjectItem(root, "length");
+    if (length) {
+        if (!cJSON_IsNumber(length) || length->valueint < 1 || length->valueint > MODBUS_STRING_MAX_REGS) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid length: must be 1-16 registers");
+            cJSON_Delete(root);
+            return ESP_FAIL;
+        }
+        reg.length = length->valueint;
+    }
+
+    cJSON *bit_width = cJSON_GetObjectItem(root, "bit_width");
+    if (bit_width) {
+        cJSON *bit_offset = cJSON_GetObjectItem(root, "bit_offset");
+        if (!cJSON_IsNumber(bit_width) || bit_width->valueint < 0 || bit_width->valueint > 64 ||
+            (bit_offset && (!cJSON_IsNumber(bit_offset) || bit_offset->valueint < 0 || bit_offset->valueint > 63))) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid bitfield: bit_offset must be 0-63, bit_width 0-64");
+            cJSON_Delete(root);
+            return ESP_FAIL;
+        }
+        reg.bit_width = bit_width->valueint;
+        reg.bit_offset = bit_offset ? bit_offset->valueint : 0;
     }
 
+    cJSON *publish_min_ms = cJSON_GetObjectItem(root, "publish_min_ms");
+    if (publish_min_ms) {
+        if (!cJSON_IsNumber(publish_min_ms) || publish_min_ms->valueint < 0 || publish_min_ms->valueint > UINT16_MAX) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid publish_min_ms: must be 0-65535");
+            cJSON_Delete(root);
+            return ESP_FAIL;
+        }
+        reg.publish_min_ms = publish_min_ms->valueint;
+    }
+
+    cJSON *deadband = cJSON_GetObjectItem(root, "deadband");
+    cJSON *deadband_mode = cJSON_GetObjectItem(root, "deadband_mode");
+    cJSON *heartbeat_s = cJSON_GetObjectItem(root, "heartbeat_s");
+    if ((deadband && (!cJSON_IsNumber(deadband) || deadband->valuedouble < 0)) ||
+        (deadband_mode && (!cJSON_IsNumber(deadband_mode) || deadband_mode->valueint < DEADBAND_ABSOLUTE ||
+                           deadband_mode->valueint > DEADBAND_PERCENT)) ||
+        (heartbeat_s && (!cJSON_IsNumber(heartbeat_s) || heartbeat_s->valueint < 0 ||
+                         heartbeat_s->valueint > UINT16_MAX))) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                            "Invalid reporting: deadband >= 0, deadband_mode 0 (absolute) or 1 (percent), heartbeat_s 0-65535");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+    reg.deadband = deadband ? deadband->valuedouble : 0;
+    reg.deadband_mode = deadband_mode ? deadband_mode->valueint : DEADBAND_ABSOLUTE;
+    reg.heartbeat_s = heartbeat_s ? heartbeat_s->valueint : 0;
+
     esp_err_t err = modbus_add_register(device_id->valueint, &reg);
     
     if (err == ESP_OK) {
-        modbus_devices_save();
+        modbus_devices_schedule_save();
         httpd_resp_set_type(req, "application/json");
         httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
     } else if (err == ESP_ERR_NOT_FOUND) {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Device not found");
     } else if (err == ESP_ERR_NO_MEM) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Maximum registers (20) reached for device");
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Not enough memory for another register");
+    } else if (err == ESP_ERR_INVALID_ARG && modbus_register_is_bitfield(&reg)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bitfield already exists or does not fit an integer holding/input register");
     } else if (err == ESP_ERR_INVALID_ARG) {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Register address already exists for this device");
     } else {
@@ -661,10 +834,16 @@ static esp_err_t api_delete_register_handler(httpd_req_t *req)
     char url_buf[100];
     char *device_id_str = NULL;
     char *address_str = NULL;
+    char *bit_str = NULL;
+    char *type_str = NULL;
 
     if (httpd_req_get_url_query_str(req, url_buf, sizeof(url_buf)) == ESP_OK) {
         device_id_str = extract_query_value(url_buf, "device_id");
         address_str = extract_query_value(url_buf, "address");
+        bit_str = extract_query_value(url_buf, "bit");
+        type_str = extract_query_value(url_buf, "type");
+        int type = type_str != NULL ? atoi(type_str) : 0;
+        free(type_str);
         
         if (device_id_str != NULL && address_str != NULL) {
             uint8_t device_id = atoi(device_id_str);
@@ -674,6 +853,7 @@ static esp_err_t api_delete_register_handler(httpd_req_t *req)
                 httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device ID: must be 0-247");
                 free(device_id_str);
                 free(address_str);
+                free(bit_str);
                 return ESP_FAIL;
             }
             
@@ -681,16 +861,29 @@ static esp_err_t api_delete_register_handler(httpd_req_t *req)
                 httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid register address: must be 0-65535");
                 free(device_id_str);
                 free(address_str);
+                free(bit_str);
                 return ESP_FAIL;
             }
             
             free(device_id_str);
             free(address_str);
-            
-            esp_err_t err = modbus_remove_register(device_id, address);
+
+            esp_err_t err;
+            if (bit_str != NULL) {
+                err = modbus_remove_bitfield(device_id, address, atoi(bit_str));
+                free(bit_str);
+            } else if (type != 0) {
+                err = modbus_remove_register(device_id, (register_type_t)type, address);
+            } else {
+                // Without a type, remove the first point found at the address.
+                err = ESP_ERR_NOT_FOUND;
+                for (int t = REGISTER_TYPE_COIL; t <= REGISTER_TYPE_INPUT && err == ESP_ERR_NOT_FOUND; t++) {
+                    err = modbus_remove_register(device_id, (register_type_t)t, address);
+                }
+            }
             
             if (err == ESP_OK) {
-                modbus_devices_save();
+                modbus_devices_schedule_save();
                 httpd_resp_set_type(req, "application/json");
                 httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
                 return ESP_OK;
@@ -707,6 +900,7 @@ static esp_err_t api_delete_register_handler(httpd_req_t *req)
     httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid request: device_id and address required");
     if (device_id_str) free(device_id_str);
     if (address_str) free(address_str);
+    if (bit_str) free(bit_str);
     return ESP_FAIL;
 }
 
@@ -770,32 +964,31 @@ static esp_err_t api_post_write_handler(httpd_req_t *req)
             free(device_id_str);
             free(address_str);
 
-            modbus_register_t *reg = modbus_get_register(device_id, address);
+            modbus_devices_lock();
+            modbus_register_t *reg = modbus_find_writable_register(device_id, address);
+            register_type_t type = reg != NULL ? reg->type : 0;
+            bool accepts_write = reg != NULL && modbus_register_accepts_write(reg);
+            modbus_devices_unlock();
             if (reg == NULL) {
                 httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Register not found");
                 cJSON_Delete(root);
                 return ESP_FAIL;
             }
+            if (type == REGISTER_TYPE_HOLDING && !accepts_write) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Register is read-only or spans more than one word");
+                cJSON_Delete(root);
+                return ESP_FAIL;
+            }
 
             modbus_result_t result;
 
-            switch (reg->type) {
+            switch (type) {
                 case REGISTER_TYPE_COIL:
-                    {
-                        bool coil_value = (value != 0);
-                        result = modbus_write_single_coil(device_id, address, coil_value);
-                        if (result == MODBUS_RESULT_OK) {
-                            uint16_t coil_result = coil_value ? 1 : 0;
-                            modbus_update_register_value(device_id, address, coil_result);
-                        }
-                    }
+                    result = modbus_write_queue_write(device_id, REGISTER_TYPE_COIL, address, value != 0);
                     break;
 
                 case REGISTER_TYPE_HOLDING:
-                    result = modbus_write_single_register(device_id, address, value);
-                    if (result == MODBUS_RESULT_OK) {
-                        modbus_update_register_value(device_id, address, value);
-                    }
+                    result = modbus_write_queue_write(device_id, REGISTER_TYPE_HOLDING, address, value);
                     break;
 
                 case REGISTER_TYPE_DISCRETE:
@@ -833,6 +1026,123 @@ static esp_err_t api_post_write_handler(httpd_req_t *req)
     return ESP_FAIL;
 }
 
+static esp_err_t api_post_bulk_write_handler(httpd_req_t *req)
+{
+    if (req->content_len == 0 || req->content_len > MODBUS_BULK_WRITE_DOC_MAX) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Body must be 1-4096 bytes");
+        return ESP_FAIL;
+    }
+
+    uint8_t *body = malloc(req->content_len);
+    modbus_bulk_write_t *bulk = malloc(sizeof(*bulk));
+    if (body == NULL || bulk == NULL) {
+        free(body);
+        free(bulk);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+
+    size_t received = 0;
+    while (received < req->content_len) {
+        int ret = httpd_req_recv(req, (char *)body + received, req->content_len - received);
+        if (ret <= 0) {
+            free(body);
+            free(bulk);
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to receive data");
+            return ESP_FAIL;
+        }
+        received += ret;
+    }
+
+    char error[128];
+    esp_err_t err = modbus_bulk_write_parse(bulk, body, received, error, sizeof(error));
+    free(body);
+    if (err != ESP_OK) {
+        free(bulk);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, error);
+        return ESP_FAIL;
+    }
+
+    err = modbus_bulk_write_execute(bulk);
+    if (err != ESP_OK) {
+        free(bulk);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                            err == ESP_ERR_NO_MEM ? "Write queue is full" : "Write queue unavailable");
+        return ESP_FAIL;
+    }
+
+    char *json = modbus_bulk_write_result_json(bulk);
+    free(bulk);
+    if (json == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json, strlen(json));
+    free(json);
+    return ESP_OK;
+}
+
+static esp_err_t api_get_profiles_handler(httpd_req_t *req)
+{
+    cJSON *root = cJSON_CreateArray();
+    for (uint16_t i = 0; i < modbus_profile_count; i++) {
+        cJSON *profile = cJSON_CreateObject();
+        cJSON_AddStringToObject(profile, "id", modbus_profiles[i].id);
+        cJSON_AddStringToObject(profile, "name", modbus_profiles[i].name);
+        cJSON_AddNumberToObject(profile, "register_count", modbus_profiles[i].register_count);
+        cJSON_AddItemToArray(root, profile);
+    }
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_str, strlen(json_str));
+
+    free(json_str);
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
+static esp_err_t api_get_memory_handler(httpd_req_t *req)
+{
+    modbus_registry_stats_t stats;
+    modbus_devices_get_stats(&stats);
+
+    cJSON *root = cJSON_CreateObject();
+
+    cJSON *devices = cJSON_CreateObject();
+    cJSON_AddNumberToObject(devices, "in_use", stats.devices.items_in_use);
+    cJSON_AddNumberToObject(devices, "capacity", stats.devices.items_capacity);
+    cJSON_AddNumberToObject(devices, "peak", stats.devices.peak_in_use);
+    cJSON_AddNumberToObject(devices, "bytes_reserved", stats.devices.bytes_reserved + stats.device_table_bytes);
+    cJSON_AddNumberToObject(devices, "bytes_in_use", stats.devices.bytes_in_use);
+    cJSON_AddItemToObject(root, "devices", devices);
+
+    cJSON *registers = cJSON_CreateObject();
+    cJSON_AddNumberToObject(registers, "in_use", stats.registers_in_use);
+    cJSON_AddNumberToObject(registers, "capacity", stats.registers_capacity);
+    cJSON_AddNumberToObject(registers, "bytes_reserved", stats.register_bytes_reserved);
+    cJSON_AddNumberToObject(registers, "bytes_in_use", stats.register_bytes_in_use);
+    cJSON_AddNumberToObject(registers, "in_flash", stats.profile_registers);
+    cJSON_AddNumberToObject(registers, "value_bytes", stats.value_bytes_reserved);
+    cJSON_AddNumberToObject(registers, "index_bytes", stats.index_bytes_reserved);
+    cJSON_AddNumberToObject(registers, "string_bytes", stats.string_bytes);
+    cJSON_AddItemToObject(root, "registers", registers);
+
+    cJSON_AddNumberToObject(root, "free_heap", stats.free_heap);
+    cJSON_AddNumberToObject(root, "largest_free_block", stats.largest_free_block);
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_str, strlen(json_str));
+
+    free(json_str);
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
 static esp_err_t api_get_logging_config_handler(httpd_req_t *req)
 {
     bool enabled = modbus_manager_get_logging();
@@ -900,7 +1210,14 @@ static esp_err_t api_get_mqtt_handler(httpd_req_t *req)
     cJSON_AddStringToObject(root, "username", config.username);
     cJSON_AddStringToObject(root, "prefix", config.prefix);
     cJSON_AddNumberToObject(root, "publish_interval", config.publish_interval);
+    cJSON_AddNumberToObject(root, "telemetry_mode", config.telemetry_mode);
     cJSON_AddNumberToObject(root, "connected", mqtt_client_is_connected());
+
+    modbus_events_stats_t events;
+    modbus_events_get_stats(&events);
+    cJSON_AddNumberToObject(root, "queue_pending", events.pending);
+    cJSON_AddNumberToObject(root, "queue_capacity", events.capacity);
+    cJSON_AddNumberToObject(root, "queue_dropped", events.dropped);
     
     char *json_str = cJSON_PrintUnformatted(root);
     httpd_resp_set_type(req, "application/json");
@@ -970,6 +1287,16 @@ static esp_err_t api_post_mqtt_handler(httpd_req_t *req)
     } else {
         config.publish_interval = MQTT_DEFAULT_INTERVAL;
     }
+
+    cJSON *telemetry_mode = cJSON_GetObjectItem(root, "telemetry_mode");
+    if (telemetry_mode && cJSON_IsNumber(telemetry_mode)) {
+        if (telemetry_mode->valueint < 0 || telemetry_mode->valueint >= MQTT_TELEMETRY_MODE_COUNT) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid telemetry_mode");
+            cJSON_Delete(root);
+            return ESP_FAIL;
+        }
+        config.telemetry_mode = telemetry_mode->valueint;
+    }
     
     esp_err_t err = nvs_save_mqtt_config(&config);
     if (err != ESP_OK) {
@@ -1105,6 +1432,24 @@ static httpd_uri_t uri_handlers[] = {
         .handler = api_post_write_handler,
         .user_ctx = NULL
     },
+    {
+        .uri = "/api/modbus/bulk-write",
+        .method = HTTP_POST,
+        .handler = api_post_bulk_write_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/profiles",
+        .method = HTTP_GET,
+        .handler = api_get_profiles_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/memory",
+        .method = HTTP_GET,
+        .handler = api_get_memory_handler,
+        .user_ctx = NULL
+    },
     {
         .uri = "/api/modbus/logging-config",
         .method = HTTP_GET,
@@ -1135,7 +1480,7 @@ esp_err_t web_server_start(void)
 {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.stack_size = 8192;
-    config.max_uri_handlers = 24;
+    config.max_uri_handlers = 32;
 
     ESP_LOGI(TAG, "Starting HTTP server on port %" PRIu16, config.server_port);
     if (httpd_start(&server, &config) == ESP_OK) {
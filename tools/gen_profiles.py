@@ -0,0 +1,250 @@
+#!/usr/bin/env python3
+"""Compiles device profiles (docs/devices/profiles/*.json) into const C tables.
+
+Each profile is one JSON object:
+
+    {
+      "id": "m31_aaax4440g",
+      "name": "M31-AAAX4440G (4DI + 4AI + 4DO)",
+      "registers": [
+        {"address": 1000, "type": "input", "name": "AI1", "unit": "mA",
+         "data_type": "float32", "description": "Analog input 1 current"}
+      ]
+    }
+
+Register fields match the REST API. `type`, `data_type`, `word_order` and
+`deadband_mode` take either the numeric value or its name ("holding",
+"float32", "CDAB", "percent").
+
+The output holds the register map, the text area layout and the point hash
+index for every profile, laid out exactly as modbus_devices.c builds them
+at runtime, so a device can use them straight from flash.
+
+Usage: gen_profiles.py OUTPUT.c PROFILE.json...
+"""
+
+import json
+import os
+import sys
+
+REGISTER_TYPES = {"coil": 1, "discrete": 2, "holding": 3, "input": 4}
+DATA_TYPES = ["uint16", "int16", "uint32", "int32", "float32",
+              "uint64", "int64", "float64", "string"]
+WORD_ORDERS = ["ABCD", "CDAB", "BADC", "DCBA"]
+DEADBAND_MODES = ["absolute", "percent"]
+TYPE_NAMES = {1: "REGISTER_TYPE_COIL", 2: "REGISTER_TYPE_DISCRETE",
+              3: "REGISTER_TYPE_HOLDING", 4: "REGISTER_TYPE_INPUT"}
+
+# REGISTER_*_MAX_LEN from modbus_devices.h, including the terminator.
+NAME_SIZE = 64
+UNIT_SIZE = 16
+DESC_SIZE = 256
+PROFILE_ID_SIZE = 24
+STRING_MAX_REGS = 16
+DATA_STRING = DATA_TYPES.index("string")
+
+
+class ProfileError(Exception):
+    pass
+
+
+def lookup(value, names, field):
+    if isinstance(value, str):
+        key = value if field == "word_order" else value.lower()
+        if key not in names:
+            raise ProfileError(f"unknown {field} '{value}'")
+        return names[key] if isinstance(names, dict) else names.index(key)
+    if not isinstance(value, int) or value not in (names.values() if isinstance(names, dict) else range(len(names))):
+        raise ProfileError(f"invalid {field} {value!r}")
+    return value
+
+
+def check_string(value, size, field):
+    if not isinstance(value, str):
+        raise ProfileError(f"{field} must be a string")
+    if len(value.encode("utf-8")) >= size:
+        raise ProfileError(f"{field} '{value}' is longer than {size - 1} bytes")
+    return value
+
+
+def data_type_registers(data_type, length):
+    if data_type in (2, 3, 4):
+        return 2
+    if data_type in (5, 6, 7):
+        return 4
+    if data_type == DATA_STRING:
+        return min(length, STRING_MAX_REGS) if length else 1
+    return 1
+
+
+def parse_register(raw):
+    reg = {
+        "address": raw.get("address"),
+        "type": lookup(raw.get("type"), REGISTER_TYPES, "type"),
+        "name": check_string(raw.get("name", ""), NAME_SIZE, "name"),
+        "unit": check_string(raw.get("unit", ""), UNIT_SIZE, "unit"),
+        "scale": float(raw.get("scale", 1.0)),
+        "offset": float(raw.get("offset", 0.0)),
+        "writable": bool(raw.get("writable", False)),
+        "description": check_string(raw.get("description", ""), DESC_SIZE, "description"),
+        "data_type": lookup(raw.get("data_type", 0), DATA_TYPES, "data_type"),
+        "word_order": lookup(raw.get("word_order", 0), WORD_ORDERS, "word_order"),
+        "length": int(raw.get("length", 0)),
+        "bit_offset": int(raw.get("bit_offset", 0)),
+        "bit_width": int(raw.get("bit_width", 0)),
+        "publish_min_ms": int(raw.get("publish_min_ms", 0)),
+        "deadband": float(raw.get("deadband", 0.0)),
+        "deadband_mode": lookup(raw.get("deadband_mode", 0), DEADBAND_MODES, "deadband_mode"),
+        "heartbeat_s": int(raw.get("heartbeat_s", 0)),
+    }
+    if not isinstance(reg["address"], int) or not 0 <= reg["address"] <= 0xFFFF:
+        raise ProfileError(f"invalid address {reg['address']!r}")
+    if not reg["name"]:
+        raise ProfileError(f"register at {reg['address']} has no name")
+    if not 0 <= reg["length"] <= 255:
+        raise ProfileError(f"invalid length {reg['length']}")
+    if not 0 <= reg["publish_min_ms"] <= 0xFFFF:
+        raise ProfileError(f"invalid publish_min_ms {reg['publish_min_ms']}")
+    if not 0 <= reg["heartbeat_s"] <= 0xFFFF:
+        raise ProfileError(f"invalid heartbeat_s {reg['heartbeat_s']}")
+    if reg["deadband"] < 0:
+        raise ProfileError(f"invalid deadband {reg['deadband']}")
+    if reg["bit_width"]:
+        if reg["type"] not in (3, 4) or reg["data_type"] in (4, 7, DATA_STRING):
+            raise ProfileError(f"bitfield '{reg['name']}' needs an integer holding or input register")
+        if reg["bit_offset"] + reg["bit_width"] > 16 * data_type_registers(reg["data_type"], reg["length"]):
+            raise ProfileError(f"bitfield '{reg['name']}' does not fit its register")
+    return reg
+
+
+def point_hash(reg_type, address):
+    return (((reg_type << 16) | address) * 2654435761) & 0xFFFFFFFF
+
+
+# Mirrors rebuild_point_index(): at least 16 slots, load factor at most one
+# half, linear probing, slot value is register index + 1, bitfields skipped.
+def build_index(registers):
+    slots = 16
+    while slots < len(registers) * 2:
+        slots <<= 1
+    mask = slots - 1
+    table = [0] * slots
+    for i, reg in enumerate(registers):
+        if reg["bit_width"]:
+            continue
+        slot = point_hash(reg["type"], reg["address"]) & mask
+        while table[slot]:
+            other = registers[table[slot] - 1]
+            if other["type"] == reg["type"] and other["address"] == reg["address"]:
+                raise ProfileError(f"'{reg['name']}' duplicates '{other['name']}'")
+            slot = (slot + 1) & mask
+        table[slot] = i + 1
+    return table, mask
+
+
+def load_profile(path):
+    with open(path, encoding="utf-8") as f:
+        raw = json.load(f)
+    profile_id = check_string(raw.get("id", ""), PROFILE_ID_SIZE, "id")
+    if not profile_id or not profile_id.replace("_", "").isalnum():
+        raise ProfileError(f"id '{profile_id}' must be a non-empty C identifier")
+    registers = [parse_register(r) for r in raw.get("registers", [])]
+    if not registers:
+        raise ProfileError("profile has no registers")
+
+    # Same sequential layout attach_text() produces on load.
+    text_bytes = 0
+    for reg in registers:
+        reg["text_offset"] = 0
+        if reg["data_type"] == DATA_STRING:
+            reg["text_offset"] = text_bytes
+            text_bytes += data_type_registers(DATA_STRING, reg["length"]) * 2 + 1
+    index, mask = build_index(registers)
+    return {
+        "id": profile_id,
+        "name": check_string(raw.get("name", profile_id), 64, "name"),
+        "registers": registers,
+        "index": index,
+        "mask": mask,
+        "text_bytes": text_bytes,
+    }
+
+
+def c_string(value):
+    return json.dumps(value, ensure_ascii=True)
+
+
+def c_float(value):
+    text = repr(float(value))
+    return (text if "." in text or "e" in text else text + ".0") + "f"
+
+
+def emit(profiles, sources):
+    out = ["// Generated by tools/gen_profiles.py from:"]
+    out += [f"//   {src}" for src in sources]
+    out += ["// Do not edit; change the profile description instead.", "",
+            '#include "modbus_profiles.h"', ""]
+
+    for p in profiles:
+        out.append(f"static const modbus_register_t {p['id']}_registers[] = {{")
+        for reg in p["registers"]:
+            out.append(
+                f"    {{ .address = {reg['address']}, .type = {TYPE_NAMES[reg['type']]}, "
+                f".name = {c_string(reg['name'])}, .unit = {c_string(reg['unit'])}, "
+                f".scale = {c_float(reg['scale'])}, .offset = {c_float(reg['offset'])}, "
+                f".writable = {'true' if reg['writable'] else 'false'}, "
+                f".description = {c_string(reg['description'])}, "
+                f".data_type = {reg['data_type']}, .word_order = {reg['word_order']}, "
+                f".length = {reg['length']}, .bit_offset = {reg['bit_offset']}, "
+                f".bit_width = {reg['bit_width']}, .publish_min_ms = {reg['publish_min_ms']}, "
+                f".heartbeat_s = {reg['heartbeat_s']}, .deadband = {c_float(reg['deadband'])}, "
+                f".deadband_mode = {reg['deadband_mode']}, .text_offset = {reg['text_offset']} }},")
+        out.append("};")
+        out.append("")
+        out.append(f"static const uint16_t {p['id']}_index[] = {{")
+        for i in range(0, len(p["index"]), 16):
+            out.append("    " + ", ".join(str(v) for v in p["index"][i:i + 16]) + ",")
+        out.append("};")
+        out.append("")
+
+    out.append(f"const modbus_profile_t modbus_profiles[] = {{")
+    for p in profiles:
+        out.append(
+            f"    {{ .id = {c_string(p['id'])}, .name = {c_string(p['name'])}, "
+            f".registers = {p['id']}_registers, .register_count = {len(p['registers'])}, "
+            f".point_index = {p['id']}_index, .point_index_mask = {p['mask']}, "
+            f".text_bytes = {p['text_bytes']} }},")
+    if not profiles:
+        out.append("    { .id = \"\" },")
+    out.append("};")
+    out.append("")
+    out.append(f"const uint16_t modbus_profile_count = {len(profiles)};")
+    return "\n".join(out) + "\n"
+
+
+def main(argv):
+    if len(argv) < 2:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        return 2
+
+    output, sources = argv[1], sorted(argv[2:])
+    profiles = []
+    for path in sources:
+        try:
+            profiles.append(load_profile(path))
+        except (ProfileError, ValueError, TypeError) as e:
+            print(f"{path}: {e}", file=sys.stderr)
+            return 1
+
+    ids = [p["id"] for p in profiles]
+    if len(set(ids)) != len(ids):
+        print("duplicate profile id", file=sys.stderr)
+        return 1
+
+    with open(output, "w", encoding="utf-8") as f:
+        f.write(emit(profiles, [os.path.basename(s) for s in sources]))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))